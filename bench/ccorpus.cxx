@@ -0,0 +1,501 @@
+#include "ccorpus.hxx"
+#include "constants.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+
+#include <elf.h>
+#include <endian.h>
+#include <zlib.h>
+
+constexpr static uint64_t KERNBASE = 0xffff'ffff'8000'0000;
+constexpr static size_t PAGE = 4096;
+
+// same constants as sys/module.h
+constexpr static int MDT_DEPEND  = 1;
+constexpr static int MDT_VERSION = 3;
+
+namespace {
+
+// Deterministic filler that compresses about as well as real code
+class filler
+{
+public:
+    filler(uint64_t seed)
+        : m_state(seed | 1)
+    {
+    }
+
+    void fill(char* p, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 7;
+            m_state ^= m_state << 17;
+            p[i] = char(m_state % 48);
+        }
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// Sections of an ELF file being put together
+struct section {
+    std::string name;
+    Elf64_Shdr shdr;
+    std::vector<char> bytes;
+};
+
+// A string table under construction
+class strtab
+{
+public:
+    strtab()
+        : m_bytes(1, '\0')
+    {
+    }
+
+    Elf64_Word add(std::string_view s) {
+        Elf64_Word off = m_bytes.size();
+        m_bytes.insert(m_bytes.end(), s.begin(), s.end());
+        m_bytes.push_back('\0');
+        return off;
+    }
+
+    auto& bytes() {
+        return m_bytes;
+    }
+
+private:
+    std::vector<char> m_bytes;
+};
+
+template<class T>
+void append(std::vector<char>& out, const T& v)
+{
+    out.insert(out.end(), (const char*)&v, (const char*)&v + sizeof(v));
+}
+
+Elf64_Ehdr elfHeader(Elf64_Half type)
+{
+    Elf64_Ehdr hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.e_ident, ELFMAG, SELFMAG);
+    hdr.e_ident[EI_CLASS] = ELFCLASS64;
+    hdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    hdr.e_ident[EI_VERSION] = EV_CURRENT;
+    hdr.e_ident[EI_OSABI] = ELFOSABI_FREEBSD;
+    hdr.e_type = type;
+    hdr.e_machine = EM_X86_64;
+    hdr.e_version = EV_CURRENT;
+    hdr.e_ehsize = sizeof(Elf64_Ehdr);
+    hdr.e_shentsize = sizeof(Elf64_Shdr);
+    return hdr;
+}
+
+section makeSection(std::string name, Elf64_Word type, Elf64_Xword flags, Elf64_Xword align)
+{
+    section s;
+    s.name = std::move(name);
+    std::memset(&s.shdr, 0, sizeof(s.shdr));
+    s.shdr.sh_type = type;
+    s.shdr.sh_flags = flags;
+    s.shdr.sh_addralign = align;
+    return s;
+}
+
+/*
+ * Write the sections that have no file offset yet after out, then the
+ * section headers, and finish the ELF header. Section 0 must be the
+ * null section and the last one .shstrtab.
+ */
+void finishElf(std::vector<char>& out, Elf64_Ehdr& hdr, std::vector<section>& sections)
+{
+    strtab names;
+    for (auto& s : sections)
+        s.shdr.sh_name = s.name.empty() ? 0 : names.add(s.name);
+    sections.back().bytes = names.bytes();
+
+    for (size_t i = 1; i < sections.size(); ++i) {
+        auto& s = sections[i];
+        if (s.shdr.sh_type == SHT_NOBITS || s.shdr.sh_offset != 0) {
+            if (s.shdr.sh_type != SHT_NOBITS)
+                s.shdr.sh_size = s.bytes.size();
+            continue;
+        }
+        size_t align = std::max<size_t>(s.shdr.sh_addralign, 1);
+        out.resize(howmany(out.size(), align) * align, 0);
+        s.shdr.sh_offset = out.size();
+        s.shdr.sh_size = s.bytes.size();
+        out.insert(out.end(), s.bytes.begin(), s.bytes.end());
+    }
+
+    out.resize(howmany(out.size(), 8) * 8, 0);
+    hdr.e_shoff = out.size();
+    hdr.e_shnum = sections.size();
+    hdr.e_shstrndx = sections.size() - 1;
+    for (auto& s : sections)
+        append(out, s.shdr);
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+}
+
+} // namespace
+
+beastie::CCorpus::CCorpus(std::filesystem::path root, corpusconfig config)
+    : m_root(root)
+    , m_config(config)
+{
+}
+
+void beastie::CCorpus::generate()
+{
+    std::filesystem::create_directories(m_root/"boot/kernel");
+    std::filesystem::create_directories(m_root/"boot/fonts");
+
+    auto kernel = kernelImage();
+    writeFile(kernelPath(), kernel);
+    writeCompressed(compressedKernelPath(), kernel);
+
+    for (unsigned i = 0; i < m_config.modules; ++i)
+        writeFile(m_root/"boot/kernel"/(moduleName(i) + ".ko"), moduleImage(i));
+    writeFile(m_root/"boot/kernel/linker.hints", linkerHints());
+
+    writeCompressed(fontPath(), fontImage());
+}
+
+std::string beastie::CCorpus::moduleName(unsigned index)
+{
+    return std::format("benchmod{}", index);
+}
+
+std::string beastie::CCorpus::topModule()
+{
+    return m_config.modules ? moduleName(m_config.modules - 1) : std::string();
+}
+
+platforminfo beastie::CCorpus::fakePlatform()
+{
+    platforminfo pi;
+    pi.efi = false;
+    pi.fb.id = "EFI VGA";
+    pi.fb.phys = 0xc000'0000;
+    pi.fb.size = 1024 * 768 * 4;
+    pi.fb.width = 1024;
+    pi.fb.height = 768;
+    pi.fb.mask_red = 0xff0000;
+    pi.fb.mask_green = 0x00ff00;
+    pi.fb.mask_blue = 0x0000ff;
+    pi.fb.mask_reserved = 0xff000000;
+    pi.fb.extra1 = 0;
+
+    pi.smap = buildSMAP({
+        {0x0, 0x9'f000, SMAP_TYPE_MEMORY},
+        {0x9'f000, 0x6'1000, SMAP_TYPE_RESERVED},
+        {0x10'0000, 0xbff0'0000, SMAP_TYPE_MEMORY},
+        {0x1'0000'0000, 0x4000'0000, SMAP_TYPE_MEMORY},
+    });
+    pi.efimap = fetchEFIMAP(pi.smap);
+
+    pi.rsdp = 0xf'0000;
+    pi.rsdt = 0xbfff'0000;
+    pi.gbpages = true;
+    return pi;
+}
+
+/*
+ * Shaped like a FreeBSD amd64 kernel: two PT_LOADs linked at
+ * KERNBASE + 2 MiB, the first one starting with the ELF headers, and
+ * .shstrtab ahead of .strtab so the string table has to be found
+ * through sh_link.
+ */
+std::vector<char> beastie::CCorpus::kernelImage()
+{
+    filler fill(0x6b65726e);
+    auto hdr = elfHeader(ET_EXEC);
+    uint64_t base = KERNBASE + 0x20'0000;
+
+    size_t textoff = PAGE;
+    size_t dataoff = howmany(textoff + m_config.text, PAGE) * PAGE;
+    std::vector<char> out(dataoff + m_config.data, 0);
+    fill.fill(out.data() + textoff, m_config.text);
+    fill.fill(out.data() + dataoff, m_config.data);
+
+    Elf64_Phdr phdr[2];
+    std::memset(phdr, 0, sizeof(phdr));
+    phdr[0].p_type = PT_LOAD;
+    phdr[0].p_flags = PF_R | PF_X;
+    phdr[0].p_offset = 0;
+    phdr[0].p_vaddr = base;
+    phdr[0].p_paddr = base;
+    phdr[0].p_filesz = textoff + m_config.text;
+    phdr[0].p_memsz = phdr[0].p_filesz;
+    phdr[0].p_align = 0x20'0000;
+    phdr[1].p_type = PT_LOAD;
+    phdr[1].p_flags = PF_R | PF_W;
+    phdr[1].p_offset = dataoff;
+    phdr[1].p_vaddr = base + dataoff;
+    phdr[1].p_paddr = base + dataoff;
+    phdr[1].p_filesz = m_config.data;
+    phdr[1].p_memsz = m_config.data + m_config.bss;
+    phdr[1].p_align = 0x20'0000;
+
+    hdr.e_entry = base + textoff;
+    hdr.e_phoff = sizeof(hdr);
+    hdr.e_phentsize = sizeof(Elf64_Phdr);
+    hdr.e_phnum = 2;
+    std::memcpy(out.data() + hdr.e_phoff, phdr, sizeof(phdr));
+
+    std::vector<section> sections;
+    sections.push_back(makeSection("", SHT_NULL, 0, 0));
+    auto text = makeSection(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16);
+    text.shdr.sh_addr = base + textoff;
+    text.shdr.sh_offset = textoff;
+    text.shdr.sh_size = m_config.text;
+    sections.push_back(text);
+    auto data = makeSection(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 16);
+    data.shdr.sh_addr = base + dataoff;
+    data.shdr.sh_offset = dataoff;
+    data.shdr.sh_size = m_config.data;
+    sections.push_back(data);
+    auto bss = makeSection(".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 16);
+    bss.shdr.sh_addr = base + dataoff + m_config.data;
+    bss.shdr.sh_offset = dataoff + m_config.data;
+    bss.shdr.sh_size = m_config.bss;
+    sections.push_back(bss);
+
+    // locals (with a source file now and then) first, then globals
+    strtab names;
+    std::vector<char> syms;
+    Elf64_Sym sym;
+    std::memset(&sym, 0, sizeof(sym));
+    append(syms, sym);
+
+    unsigned locals = m_config.symbols / 3;
+    for (unsigned i = 0; i < m_config.symbols; ++i) {
+        bool local = i < locals;
+        if (local && i % 200 == 0) {
+            sym.st_name = names.add(std::format("src_{}.c", i / 200));
+            sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+            sym.st_shndx = SHN_ABS;
+            sym.st_value = 0;
+            sym.st_size = 0;
+            append(syms, sym);
+        }
+        sym.st_name = names.add(local ? std::format("static_fn_{}", i) : std::format("kern_func_{}", i));
+        sym.st_info = ELF64_ST_INFO(local ? STB_LOCAL : STB_GLOBAL, STT_FUNC);
+        sym.st_shndx = 1;
+        sym.st_value = base + textoff + (uint64_t(i) * 64) % std::max<size_t>(m_config.text, 64);
+        sym.st_size = 64;
+        append(syms, sym);
+    }
+
+    sections.push_back(makeSection(".shstrtab", SHT_STRTAB, 0, 1));
+    auto symtab = makeSection(".symtab", SHT_SYMTAB, 0, 8);
+    symtab.shdr.sh_entsize = sizeof(Elf64_Sym);
+    symtab.shdr.sh_link = sections.size() + 1;
+    symtab.shdr.sh_info = 1 + locals + howmany(locals, 200);
+    symtab.bytes = std::move(syms);
+    sections.push_back(symtab);
+    auto strings = makeSection(".strtab", SHT_STRTAB, 0, 1);
+    strings.bytes = names.bytes();
+    sections.push_back(strings);
+
+    // finishElf() wants .shstrtab last, swap it there and fix the link
+    std::swap(sections[4], sections.back());
+    sections[5].shdr.sh_link = 4;
+
+    finishElf(out, hdr, sections);
+    return out;
+}
+
+/*
+ * A relocatable module with MODULE_VERSION(name, 1) and, but for the
+ * first, MODULE_DEPEND on the previous one, laid out in .data and
+ * reached through relocations like the output of the compiler.
+ */
+std::vector<char> beastie::CCorpus::moduleImage(unsigned index)
+{
+    filler fill(0x6d6f64 + index);
+    auto hdr = elfHeader(ET_REL);
+    std::vector<char> out(sizeof(hdr), 0);
+
+    struct metadata {
+        int type;
+        std::string name;
+    };
+    std::vector<metadata> entries;
+    entries.push_back({MDT_VERSION, moduleName(index)});
+    if (index > 0)
+        entries.push_back({MDT_DEPEND, moduleName(index - 1)});
+
+    // .data: struct mod_metadata[], then what they point at
+    std::vector<char> data(entries.size() * 24, 0);
+    std::vector<Elf64_Rela> datarelocs;
+    std::vector<Elf64_Rela> setrelocs;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        int version = 1;
+        int type = entries[i].type;
+        std::memcpy(data.data() + i * 24, &version, sizeof(version));
+        std::memcpy(data.data() + i * 24 + 4, &type, sizeof(type));
+
+        size_t payload = data.size();
+        if (type == MDT_VERSION) {
+            append(data, int(1));
+        } else {
+            int depend[3] = {1, 1, 1};
+            append(data, depend);
+        }
+        size_t name = data.size();
+        data.insert(data.end(), entries[i].name.begin(), entries[i].name.end());
+        data.push_back('\0');
+        data.resize(howmany(data.size(), 8) * 8, 0);
+
+        // symbol 1 is the section symbol of .data
+        datarelocs.push_back({i * 24 + 8, ELF64_R_INFO(1, R_X86_64_64), Elf64_Sxword(payload)});
+        datarelocs.push_back({i * 24 + 16, ELF64_R_INFO(1, R_X86_64_64), Elf64_Sxword(name)});
+        setrelocs.push_back({i * 8, ELF64_R_INFO(1, R_X86_64_64), Elf64_Sxword(i * 24)});
+    }
+
+    std::vector<section> sections;
+    sections.push_back(makeSection("", SHT_NULL, 0, 0));
+    auto text = makeSection(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16);
+    text.bytes.resize(m_config.moduleText);
+    fill.fill(text.bytes.data(), text.bytes.size());
+    sections.push_back(text);
+    auto datasec = makeSection(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8);
+    datasec.bytes = data;
+    sections.push_back(datasec);
+    auto set = makeSection("set_modmetadata_set", SHT_PROGBITS, SHF_ALLOC, 8);
+    set.bytes.resize(entries.size() * 8, 0);
+    sections.push_back(set);
+
+    auto relaset = makeSection(".rela.set_modmetadata_set", SHT_RELA, SHF_INFO_LINK, 8);
+    relaset.shdr.sh_entsize = sizeof(Elf64_Rela);
+    relaset.shdr.sh_info = 3;
+    relaset.shdr.sh_link = 6;
+    for (auto& r : setrelocs)
+        append(relaset.bytes, r);
+    sections.push_back(relaset);
+    auto reladata = makeSection(".rela.data", SHT_RELA, SHF_INFO_LINK, 8);
+    reladata.shdr.sh_entsize = sizeof(Elf64_Rela);
+    reladata.shdr.sh_info = 2;
+    reladata.shdr.sh_link = 6;
+    for (auto& r : datarelocs)
+        append(reladata.bytes, r);
+    sections.push_back(reladata);
+
+    strtab names;
+    auto symtab = makeSection(".symtab", SHT_SYMTAB, 0, 8);
+    symtab.shdr.sh_entsize = sizeof(Elf64_Sym);
+    symtab.shdr.sh_link = 7;
+    symtab.shdr.sh_info = 2;
+    Elf64_Sym sym;
+    std::memset(&sym, 0, sizeof(sym));
+    append(symtab.bytes, sym);
+    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    sym.st_shndx = 2;
+    append(symtab.bytes, sym);
+    sym.st_name = names.add(std::format("{}_modevent", moduleName(index)));
+    sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    sym.st_shndx = 1;
+    append(symtab.bytes, sym);
+    sections.push_back(symtab);
+    auto strings = makeSection(".strtab", SHT_STRTAB, 0, 1);
+    strings.bytes = names.bytes();
+    sections.push_back(strings);
+    sections.push_back(makeSection(".shstrtab", SHT_STRTAB, 0, 1));
+
+    finishElf(out, hdr, sections);
+    return out;
+}
+
+// The linker.hints layout is documented in clinkerhints.cxx
+std::vector<char> beastie::CCorpus::linkerHints()
+{
+    std::vector<char> out;
+    append(out, int(1));
+
+    for (unsigned i = 0; i < m_config.modules; ++i) {
+        std::string name = moduleName(i);
+        std::string file = name + ".ko";
+
+        std::vector<char> rec;
+        append(rec, MDT_VERSION);
+        rec.push_back(char(name.size()));
+        rec.insert(rec.end(), name.begin(), name.end());
+        rec.resize(howmany(rec.size(), sizeof(int)) * sizeof(int), 0);
+        append(rec, int(1));
+        rec.push_back(char(file.size()));
+        rec.insert(rec.end(), file.begin(), file.end());
+
+        append(out, int(rec.size()));
+        out.insert(out.end(), rec.begin(), rec.end());
+    }
+    return out;
+}
+
+// VFNT0002, big endian header and maps, one map per 256 glyphs
+std::vector<char> beastie::CCorpus::fontImage()
+{
+    filler fill(0x666f6e74);
+    constexpr unsigned width = 12;
+    constexpr unsigned height = 24;
+    unsigned glyphs = m_config.glyphs;
+    unsigned maps = howmany(glyphs, 256u);
+
+    font_header hdr;
+    std::memcpy(hdr.fh_magic, "VFNT0002", 8);
+    hdr.fh_width = width;
+    hdr.fh_height = height;
+    hdr.fh_pad = 0;
+    hdr.fh_glyph_count = htobe32(glyphs);
+    hdr.fh_map_count[0] = htobe32(maps);
+    for (int i = 1; i < VFNT_MAPS; ++i)
+        hdr.fh_map_count[i] = 0;
+
+    std::vector<char> out(sizeof(hdr));
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+    size_t bitmap = out.size();
+    out.resize(bitmap + size_t(glyphs) * howmany(width, 8u) * height);
+    fill.fill(out.data() + bitmap, out.size() - bitmap);
+
+    for (unsigned i = 0; i < maps; ++i) {
+        vfnt_map map;
+        map.vfm_src = htobe32(0x20 + i * 256);
+        map.vfm_dst = htobe16(i * 256);
+        map.vfm_len = htobe16(std::min(256u, glyphs - i * 256) - 1);
+        append(out, map);
+    }
+    return out;
+}
+
+void beastie::CCorpus::writeFile(std::filesystem::path path, const std::vector<char>& bytes)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (file.is_open() == false)
+        throw std::runtime_error(std::format("{}: {}", path.string(), std::strerror(errno)));
+    file.write(bytes.data(), bytes.size());
+}
+
+void beastie::CCorpus::writeCompressed(std::filesystem::path path, const std::vector<char>& bytes)
+{
+    gzFile file = gzopen(path.c_str(), "wb6");
+    if (file == nullptr)
+        throw std::runtime_error(std::format("{}: {}", path.string(), std::strerror(errno)));
+
+    size_t done = 0;
+    while (done < bytes.size()) {
+        unsigned chunk = std::min<size_t>(bytes.size() - done, 1 << 20);
+        if (gzwrite(file, bytes.data() + done, chunk) != int(chunk)) {
+            gzclose(file);
+            throw std::runtime_error(std::format("{}: write failed", path.string()));
+        }
+        done += chunk;
+    }
+    gzclose(file);
+}
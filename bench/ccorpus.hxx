@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace beastie {
+
+// Sizes of a generated corpus
+struct corpusconfig {
+    size_t text = 16 << 20;         // kernel .text bytes
+    size_t data = 4 << 20;          // kernel .data bytes
+    size_t bss = 8 << 20;           // kernel .bss bytes
+    unsigned symbols = 60000;       // kernel symbols, a third of them local
+    unsigned modules = 8;           // modules, each depending on the previous one
+    size_t moduleText = 256 << 10;  // .text bytes of each module
+    unsigned glyphs = 6000;         // font glyphs (12x24)
+};
+
+// Writes a FreeBSD-like root: boot/kernel/{kernel,*.ko,linker.hints} and
+// boot/fonts/12x24.fnt.gz, plus kernel.gz for the decompression numbers.
+// The files are synthetic but parse like the real ones.
+class CCorpus
+{
+public:
+    CCorpus(std::filesystem::path root, corpusconfig config);
+
+    void generate();
+
+    auto& root() {
+        return m_root;
+    }
+    std::filesystem::path kernelPath() {
+        return m_root/"boot/kernel/kernel";
+    }
+    std::filesystem::path fontPath() {
+        return m_root/"boot/fonts/12x24.fnt.gz";
+    }
+    std::filesystem::path compressedKernelPath() {
+        return m_root/"kernel.gz";
+    }
+
+    // Name of the last module, which pulls in all the others
+    std::string topModule();
+
+    // A platform that looks like a 4 GiB BIOS machine with an EFI framebuffer
+    static platforminfo fakePlatform();
+
+private:
+    std::filesystem::path m_root;
+    corpusconfig m_config;
+
+    std::vector<char> kernelImage();
+    std::vector<char> moduleImage(unsigned index);
+    std::vector<char> fontImage();
+    std::vector<char> linkerHints();
+    std::string moduleName(unsigned index);
+
+    static void writeFile(std::filesystem::path path, const std::vector<char>& bytes);
+    static void writeCompressed(std::filesystem::path path, const std::vector<char>& bytes);
+};
+} // namespace beastie
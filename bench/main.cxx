@@ -0,0 +1,421 @@
+#include "ccorpus.hxx"
+#ifdef HAVE_ASMJIT
+#include "bootassembler.hxx"
+#endif
+#include "bootloader.hxx"
+#include "cenvironmentwriter.hxx"
+#include "cloadpipeline.hxx"
+#include "cmetawriter.hxx"
+#include "constants.hxx"
+#include "cprofiler.hxx"
+#include "csymbolswriter.hxx"
+#include "ctrampoline.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <elf.h>
+#include <getopt.h>
+
+struct {
+    std::filesystem::path dir;
+    unsigned iterations = 20;
+    std::string filter;
+    bool json;
+    corpusconfig corpus;
+} Options;
+
+// Timings of one benchmark, in nanoseconds
+struct result {
+    std::string name;
+    uint64_t bytes;
+    std::vector<uint64_t> ns;
+};
+
+static std::vector<result> Results;
+
+// Two results compared in the report, as median(baseline) / median(result)
+struct speedup {
+    std::string baseline;
+    std::string result;
+};
+
+static std::vector<speedup> Speedups;
+
+void usage()
+{
+    std::cout << std::format("Usage: {}_bench [OPTION]...\n", beastie::progname);
+    std::cout << std::format("Time the load paths of {} on a synthetic FreeBSD root,\n", beastie::progname);
+    std::cout << std::format("no root privileges or real hardware needed.\n");
+    std::cout << std::format("\n");
+    std::cout << std::format(" -h, --help          Print this help.\n");
+    std::cout << std::format(" -d, --dir DIR       Generate the corpus in DIR and keep it\n");
+    std::cout << std::format("                     (default: a temporary directory).\n");
+    std::cout << std::format(" -i, --iterations N  Runs per benchmark (default: {}).\n", Options.iterations);
+    std::cout << std::format(" -f, --filter TEXT   Only run benchmarks whose name contains TEXT.\n");
+    std::cout << std::format(" -j, --json          Print the results as JSON.\n");
+    std::cout << std::format(" -t, --text MIB      Kernel .text size (default: {}).\n", Options.corpus.text >> 20);
+    std::cout << std::format(" -S, --symbols N     Kernel symbols (default: {}).\n", Options.corpus.symbols);
+    std::cout << std::format(" -m, --modules N     Modules in the dependency chain (default: {}).\n", Options.corpus.modules);
+    std::cout << std::format(" -g, --glyphs N      Font glyphs (default: {}).\n", Options.corpus.glyphs);
+}
+
+static uint64_t nanoseconds()
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+}
+
+static bool selected(std::string_view name)
+{
+    return name.find(Options.filter) != std::string_view::npos;
+}
+
+// Run f once to warm up, then time Options.iterations runs of it
+template<class F>
+static void bench(std::string_view name, uint64_t bytes, F f)
+{
+    if (selected(name) == false)
+        return;
+
+    f();
+    result r{std::string(name), bytes, {}};
+    for (unsigned i = 0; i < Options.iterations; ++i) {
+        uint64_t start = nanoseconds();
+        f();
+        r.ns.push_back(nanoseconds() - start);
+    }
+    Results.push_back(std::move(r));
+}
+
+// The symbol and string tables of an ELF file, as CSymbolsWriter takes them
+static std::pair<std::span<const char>,std::span<const char>> symbolTables(std::span<char> elf)
+{
+    auto hdr = (const Elf64_Ehdr*)elf.data();
+    auto shdr = (const Elf64_Shdr*)(elf.data() + hdr->e_shoff);
+    for (unsigned i = 0; i < hdr->e_shnum; ++i) {
+        if (shdr[i].sh_type != SHT_SYMTAB)
+            continue;
+        auto& str = shdr[shdr[i].sh_link];
+        return {elf.subspan(shdr[i].sh_offset, shdr[i].sh_size),
+                elf.subspan(str.sh_offset, str.sh_size)};
+    }
+    return {};
+}
+
+static void benchFiles(CCorpus& corpus)
+{
+    uint64_t size = std::filesystem::file_size(corpus.kernelPath());
+
+    bench("slurp kernel", size, [&]() {
+        auto buffer = slurp<std::vector<char>>(corpus.kernelPath());
+    });
+    bench("zslurp kernel.gz", size, [&]() {
+        auto buffer = zslurp(corpus.compressedKernelPath());
+    });
+    bench("zmap kernel.gz", size, [&]() {
+        auto file = zmap(corpus.compressedKernelPath());
+    });
+    bench("zmap kernel", size, [&]() {
+        auto file = zmap(corpus.kernelPath());
+    });
+}
+
+static void benchWriters(CCorpus& corpus)
+{
+    CMappedFile kernel(corpus.kernelPath());
+    auto [symtab, strtab] = symbolTables(kernel.span());
+    std::span<char> ehdr(kernel.data(), sizeof(Elf64_Ehdr));
+    std::vector<char> out;
+
+    bench("CSymbolsWriter all", symtab.size() + strtab.size(), [&]() {
+        CSymbolsWriter sym;
+        sym.addSymbols(symtab, strtab, CSymbolsWriter::KeepAll);
+        out.resize(sym.size());
+        sym.builder().gather(out);
+    });
+    bench("CSymbolsWriter global", symtab.size() + strtab.size(), [&]() {
+        CSymbolsWriter sym;
+        sym.addSymbols(symtab, strtab, CSymbolsWriter::DropDebug | CSymbolsWriter::DropLocal);
+        out.resize(sym.size());
+        sym.builder().gather(out);
+    });
+
+    // a kernel and the modules as writeMetadata() describes them
+    bench("CMetaWriter", 0, [&]() {
+        CMetaWriter meta;
+        for (unsigned i = 0; i <= Options.corpus.modules; ++i) {
+            meta.addName(i ? std::format("/boot/kernel/benchmod{}.ko", i - 1) : "/boot/kernel/kernel");
+            meta.addType(i ? "elf obj module" : "elf kernel");
+            meta.addAddr(0xffff'ffff'8020'0000 + i * 0x10'0000);
+            meta.addSize(0x10'0000);
+            meta.addMetadata(MODINFOMD_ELFHDR, ehdr);
+            meta.addMetadata(MODINFOMD_HOWTO, uint32_t(0));
+        }
+        meta.addEnd();
+        out.resize(meta.size());
+        meta.builder().gather(out);
+    });
+
+    // about the size of a loader.conf plus device.hints
+    bench("CEnvironmentWriter", 0, [&]() {
+        CEnvironmentWriter env;
+        for (unsigned i = 0; i < 500; ++i)
+            env += std::format("hint.bench.{}.at=\"isa\"", i);
+        out.resize(env.size());
+        env.builder().gather(out);
+    });
+}
+
+static void benchAssembler()
+{
+    auto platform = CCorpus::fakePlatform();
+
+    bench("CTrampoline", 0, [&]() {
+        CTrampoline tramp(0xffff'ffff'8020'1000, 0x400'0000, 0x480'0000, platform.fb, platform.gbpages);
+        auto data = tramp.data();
+    });
+
+#ifdef HAVE_ASMJIT
+    bench("BootAssembler", 0, [&]() {
+        BootAssembler ba(0xffff'ffff'8020'1000, 0x400'0000, 0x480'0000, platform.fb, platform.gbpages);
+        ba.assemble();
+        auto data = ba.data();
+    });
+#endif
+}
+
+// A prepare() of the corpus root with the cache off
+static void prepareCorpus(CCorpus& corpus, const platforminfo& platform)
+{
+    Bootloader loader(platform);
+    loader.fontLoad(corpus.fontPath());
+    loader.fileLoad(corpus.kernelPath());
+    if (corpus.topModule().empty() == false)
+        loader.moduleLoad(corpus.topModule());
+    loader.prepare();
+}
+
+/*
+ * prepare() with the load pipeline and without its workers, which is
+ * the serial load path: every read and decompression in request order.
+ */
+static void benchPipeline(CCorpus& corpus)
+{
+    auto platform = CCorpus::fakePlatform();
+    auto& pipeline = CLoadPipeline::instance();
+    unsigned workers = pipeline.workers();
+    uint64_t size = std::filesystem::file_size(corpus.kernelPath());
+    std::string name = std::format("Bootloader prepare {} workers", workers);
+
+    pipeline.setWorkers(0);
+    bench("Bootloader prepare serial", size, [&]() {
+        prepareCorpus(corpus, platform);
+    });
+    pipeline.setWorkers(workers);
+    bench(name, size, [&]() {
+        prepareCorpus(corpus, platform);
+    });
+    Speedups.push_back({"Bootloader prepare serial", name});
+}
+
+/*
+ * The whole prepare() of a kernel, its modules and a font, then each
+ * of its phases (elf load, symbol extraction, font decode, ...) as the
+ * profiler saw them. The phases run once per iteration here, their
+ * timings are per iteration sums of the phases with the same name.
+ */
+static void benchBootloader(CCorpus& corpus)
+{
+    auto platform = CCorpus::fakePlatform();
+    std::map<std::string,result> phases;
+    auto& profiler = CProfiler::instance();
+    profiler.enable({});
+
+    bench("Bootloader prepare", std::filesystem::file_size(corpus.kernelPath()), [&]() {
+        profiler.clear();
+        prepareCorpus(corpus, platform);
+
+        std::map<std::string,std::pair<uint64_t,uint64_t>> sums;
+        for (auto& rec : profiler.records()) {
+            if (rec.mark)
+                continue;
+            sums[rec.name].first += rec.duration * 1000;
+            sums[rec.name].second += rec.bytes;
+        }
+        for (auto& [name, sum] : sums) {
+            auto& r = phases[name];
+            r.name = std::format("Bootloader {}", name);
+            r.bytes = sum.second;
+            r.ns.push_back(sum.first);
+        }
+    });
+
+    // drop the warm up run
+    for (auto& [name, r] : phases) {
+        if (r.ns.size() > Options.iterations)
+            r.ns.erase(r.ns.begin());
+        Results.push_back(std::move(r));
+    }
+    profiler.clear();
+}
+
+static double median(std::string_view name)
+{
+    for (auto& r : Results) {
+        if (r.name == name)
+            return r.ns[r.ns.size() / 2];
+    }
+    return 0;
+}
+
+static void report()
+{
+    std::string json;
+    if (Options.json == false)
+        std::cout << std::format("{:<32} {:>6} {:>12} {:>12} {:>10}\n", "benchmark", "runs", "min us", "median us", "MB/s");
+
+    for (auto& r : Results) {
+        std::sort(r.ns.begin(), r.ns.end());
+        double min = r.ns.front() / 1000.0;
+        double median = r.ns[r.ns.size() / 2] / 1000.0;
+        double rate = r.bytes && median > 0 ? r.bytes / median : 0;
+
+        if (Options.json) {
+            if (json.empty() == false)
+                json += ",\n";
+            json += std::format("    {{\"name\": \"{}\", \"runs\": {}, \"min_us\": {:.1f}, \"median_us\": {:.1f}, "
+                                "\"bytes\": {}, \"mb_per_s\": {:.1f}}}",
+                                r.name, r.ns.size(), min, median, r.bytes, rate);
+            continue;
+        }
+        std::cout << std::format("{:<32} {:>6} {:>12.1f} {:>12.1f} {:>10}\n", r.name, r.ns.size(), min, median,
+                                 rate ? std::format("{:.1f}", rate) : std::string("-"));
+    }
+
+    std::string speedups;
+    for (auto& s : Speedups) {
+        double baseline = median(s.baseline);
+        double result = median(s.result);
+        if (baseline == 0 || result == 0)
+            continue;
+        if (Options.json) {
+            if (speedups.empty() == false)
+                speedups += ",\n";
+            speedups += std::format("    {{\"baseline\": \"{}\", \"name\": \"{}\", \"speedup\": {:.2f}}}",
+                                    s.baseline, s.result, baseline / result);
+            continue;
+        }
+        std::cout << std::format("{} vs {}: {:.2f}x\n", s.result, s.baseline, baseline / result);
+    }
+
+    if (Options.json)
+        std::cout << std::format("{{\n  \"program\": \"{}\", \"version\": \"{}\",\n  \"results\": [\n{}\n  ],\n"
+                                 "  \"speedups\": [\n{}\n  ]\n}}\n",
+                                 beastie::progname, beastie::progvers, json, speedups);
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        int c;
+        int option_index = 0;
+
+        while (1)
+        {
+            static struct option long_options[] =
+            {
+                {"help",        no_argument,       0, 'h'},
+                {"dir",         required_argument, 0, 'd'},
+                {"iterations",  required_argument, 0, 'i'},
+                {"filter",      required_argument, 0, 'f'},
+                {"json",        no_argument,       0, 'j'},
+                {"text",        required_argument, 0, 't'},
+                {"symbols",     required_argument, 0, 'S'},
+                {"modules",     required_argument, 0, 'm'},
+                {"glyphs",      required_argument, 0, 'g'},
+                {0, 0, 0, 0}
+            };
+
+            c = getopt_long(argc, argv, "hd:i:f:jt:S:m:g:", long_options, &option_index);
+            if (c == -1)
+                break;
+
+            switch (c)
+            {
+            case 'h':
+                usage();
+                return 0;
+            case 'd':
+                Options.dir = std::filesystem::path(optarg);
+                break;
+            case 'i':
+                Options.iterations = std::max(1ul, std::strtoul(optarg, nullptr, 0));
+                break;
+            case 'f':
+                Options.filter = optarg;
+                break;
+            case 'j':
+                Options.json = true;
+                break;
+            case 't':
+                Options.corpus.text = std::strtoul(optarg, nullptr, 0) << 20;
+                break;
+            case 'S':
+                Options.corpus.symbols = std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'm':
+                Options.corpus.modules = std::strtoul(optarg, nullptr, 0);
+                break;
+            case 'g':
+                Options.corpus.glyphs = std::strtoul(optarg, nullptr, 0);
+                break;
+            case '?':
+                usage();
+                return -1;
+            }
+        }
+
+        bool temporary = Options.dir.empty();
+        if (temporary) {
+            std::string dir = (std::filesystem::temp_directory_path()/"beastie_bench.XXXXXX").string();
+            if (mkdtemp(dir.data()) == nullptr)
+                throw std::runtime_error(std::format("{}: {}", dir, std::strerror(errno)));
+            Options.dir = dir;
+        }
+
+        CCorpus corpus(Options.dir, Options.corpus);
+        corpus.generate();
+
+        try {
+            benchFiles(corpus);
+            benchWriters(corpus);
+            benchAssembler();
+            benchPipeline(corpus);
+            benchBootloader(corpus);
+        } catch (...) {
+            if (temporary)
+                std::filesystem::remove_all(Options.dir);
+            throw;
+        }
+        if (temporary)
+            std::filesystem::remove_all(Options.dir);
+
+        report();
+    } catch (const std::exception& e) {
+        std::cerr << std::format("error: {}\n", e.what());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * libbeastie, beastie as a library for boot menus that load FreeBSD more
+ * than once per run (retries, menu refreshes): the platform is probed
+ * once per context, and prepared images stay in the image cache.
+ *
+ * Calls return BEASTIE_OK or BEASTIE_ERROR, beastie_error() tells why.
+ * A context is used by one thread at a time.
+ *
+ ****/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BEASTIE_OK 0
+#define BEASTIE_ERROR (-1)
+
+typedef struct beastie_context beastie_context;
+
+// The kernel of a root, see beastie_index()
+typedef struct beastie_kernel {
+    int bootable;           // a FreeBSD amd64 kernel
+    uint32_t version;       // __FreeBSD_version, 0 if unknown
+    uint64_t loadsize;      // memory it takes once loaded
+} beastie_kernel;
+
+// A context with the defaults of the command line, NULL without memory
+beastie_context* beastie_create(void);
+void beastie_destroy(beastie_context* ctx);
+
+// What the last call that failed failed with, valid until the next call
+const char* beastie_error(beastie_context* ctx);
+
+// Probe the platform (framebuffer, ACPI, memory map), kept for every load
+// after. The first load probes if this wasn't called.
+int beastie_probe(beastie_context* ctx);
+
+// Settings for the loads after, like the options of the same names
+int beastie_set_howto(beastie_context* ctx, uint32_t howto);
+int beastie_set_debug(beastie_context* ctx, int debug);
+int beastie_set_force(beastie_context* ctx, int force);
+int beastie_set_cache(beastie_context* ctx, const char* dir);       // NULL disables it
+int beastie_set_console(beastie_context* ctx, unsigned cols, unsigned rows);
+int beastie_set_font_subset(beastie_context* ctx, const char* sets);
+int beastie_set_manifest(beastie_context* ctx, const char* manifest); // NULL for none
+int beastie_set_mdroot(beastie_context* ctx, const char* image);      // NULL for none
+int beastie_add_module(beastie_context* ctx, const char* name);
+int beastie_clear_modules(beastie_context* ctx);
+int beastie_add_env(beastie_context* ctx, const char* assignment);  // name=value, over loader.conf
+int beastie_clear_env(beastie_context* ctx);
+
+// The kernels of count roots into kernels, from their headers alone
+int beastie_index(beastie_context* ctx, const char* const* roots, size_t count,
+                  beastie_kernel* kernels);
+
+// Load and prepare the kernel, modules and font of root, replacing the
+// image loaded before
+int beastie_load_root(beastie_context* ctx, const char* root);
+
+// The prepared image as a sealed memfd (see libbeastie.cxx for the
+// format), for other processes to inspect. The caller closes it.
+int beastie_image_fd(beastie_context* ctx, int* fd);
+
+// kexec_load the prepared image and record it for beastie --commit
+int beastie_stage(beastie_context* ctx);
+
+// kexec_load the prepared image and reboot into it, through a clean
+// shutdown unless forced
+int beastie_boot(beastie_context* ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,6 @@
 #include "bootassembler.hxx"
 #include "types.hxx"
-#include "cgfx.hxx"
-#include "cvmwaregfx.hxx"
+#include "ctrampoline.hxx"
 using namespace beastie;
 
 #include <cassert>
@@ -17,7 +16,8 @@ namespace beastie {
 constexpr int PAGE_SIZE = 4096;
 #endif
 constexpr int STACK_SIZE = 1 * PAGE_SIZE;
-constexpr int LOWBASE = 0x10'0000;
+constexpr int LOWBASE = CTrampoline::BASE;
+constexpr int DATAOFFSET = CTrampoline::TABLES - CTrampoline::BASE;
 
 class MyErrorHandler : public asmjit::ErrorHandler {
 public:
@@ -30,7 +30,8 @@ public:
 BootAssembler::BootAssembler(uintptr_t btext,
                              uintptr_t modulep,
                              uintptr_t kernend,
-                             fbinfo fb)
+                             fbinfo fb,
+                             bool gbpages)
     : m_asm()
     , m_code()
     , m_environment()
@@ -40,20 +41,13 @@ BootAssembler::BootAssembler(uintptr_t btext,
     , m_modulep(modulep)
     , m_kernend(kernend)
     , m_fb(fb)
-    , m_gfxcode()
+    , m_gfxreset(CTrampoline::gfxReset(fb))
+    , m_tables(CTrampoline::pageTables(kernend, fb, gbpages))
 {
     assert(modulep < kernend);
     initAsmJit();
     createLayout();
     createGlobalLabels();
-
-    // generate VGA reset code if needed
-    if (m_fb.id == "vmwgfxdrmfb") {
-        CGfx* gfx = new CVmwaregfx();
-        m_gfxcode = gfx->assembleReset(m_fb.width,
-                                       m_fb.height);
-        delete gfx;
-    }
 }
 
 void BootAssembler::initAsmJit()
@@ -72,7 +66,7 @@ void BootAssembler::createLayout()
     m_code.newSection(&m_data, ".data", SIZE_MAX, asmjit::SectionFlags::kReadOnly, 0, 1);
 
     m_text->setOffset(0x0'000);
-    m_data->setOffset(0x1'000);
+    m_data->setOffset(DATAOFFSET);
     m_text->setVirtualSize(0x1'000);
     m_data->setVirtualSize(0xf'000);
 }
@@ -84,10 +78,6 @@ void BootAssembler::createGlobalLabels()
     m_labels.GDTP = m_asm.newNamedLabel("GDTP", SIZE_MAX, asmjit::LabelType::kGlobal);
     m_labels.stackTop = m_asm.newNamedLabel("stackTop", SIZE_MAX, asmjit::LabelType::kGlobal);
     m_labels.PML4T = m_asm.newNamedLabel("PML4T", SIZE_MAX, asmjit::LabelType::kGlobal);
-    m_labels.PDPT[0] = m_asm.newNamedLabel("PDPT[0]", SIZE_MAX, asmjit::LabelType::kGlobal);
-    m_labels.PDPT[1] = m_asm.newNamedLabel("PDPT[1]", SIZE_MAX, asmjit::LabelType::kGlobal);
-    m_labels.PDT[0] = m_asm.newNamedLabel("PDT[0]", SIZE_MAX, asmjit::LabelType::kGlobal);
-    m_labels.PDT[1] = m_asm.newNamedLabel("PDT[1]", SIZE_MAX, asmjit::LabelType::kGlobal);
 }
 
 void BootAssembler::assemble()
@@ -238,12 +228,10 @@ void BootAssembler::assembleText()
     using namespace asmjit::x86;
     using namespace asmjit::x86::regs;
 
-    Label L1, L2, lp_pd0, lp_pd1;
+    Label L1, L2;
     Label lp_hlt;
     L1 = m_asm.newLabel();
     L2 = m_asm.newLabel();
-    lp_pd0 = m_asm.newLabel();
-    lp_pd1 = m_asm.newLabel();
     lp_hlt = m_asm.newLabel();
 
     m_asm.section(m_text);
@@ -277,67 +265,9 @@ void BootAssembler::assembleText()
     m_asm.lea(rsp, ptr(m_labels.stackTop));
 
     /*
-     * PAGING
+     * PAGING, the tables come filled in
      */
 
-    // Level 4 (low mapping)
-    m_asm.lea(rax, qword_ptr(m_labels.PDPT[0]));      // rax = &PDPT[0][0]
-    m_asm.or_(rax, 3);                                // flags = RW|P
-    m_asm.mov(qword_ptr(m_labels.PML4T), rax);        // PML4T[0] = rax
-
-    // Level 3 (low mapping)
-    m_asm.lea(rax, qword_ptr(m_labels.PDT[0]));       // rax = &PDT[0][0]
-    m_asm.or_(rax, 3);                                // flags = RW|P
-    m_asm.mov(qword_ptr(m_labels.PDPT[0], 8*0), rax); // PDPT[0][0] = rax
-    m_asm.add(rax, 0x1000);                           // rax += 4096
-    m_asm.mov(qword_ptr(m_labels.PDPT[0], 8*1), rax); // PDPT[0][1] = rax
-    m_asm.add(rax, 0x1000);                           // rax += 4096
-    m_asm.mov(qword_ptr(m_labels.PDPT[0], 8*2), rax); // PDPT[0][2] = rax
-    m_asm.add(rax, 0x1000);                           // rax += 4096
-    m_asm.mov(qword_ptr(m_labels.PDPT[0], 8*3), rax); // PDPT[0][3] = rax
-
-    // Level 2 (low mapping)
-    m_asm.xor_(rax, rax);                    // rax = 0
-    m_asm.xor_(rcx, rcx);                    // loop counter
-    m_asm.or_(rax, 0x83);                    // flags = PS|RW|P
-    m_asm.bind(lp_pd0);                      // lp_pd:
-    m_asm.lea(r11, ptr(m_labels.PDT[0]));    // r11 = &PDT[0][0]
-    m_asm.mov(qword_ptr(r11, rcx, 3), rax);  // PDT[0][rcx * 8] = rax
-    m_asm.add(rax, 0x200000);                // rax += 2 MiB
-    m_asm.inc(ecx);                          // loop counter ++
-    m_asm.cmp(ecx, 512 * 4);
-    m_asm.jl(lp_pd0);                        // loop to lp_pd
-
-    // Level 4 (high mapping)
-    m_asm.lea(rax, qword_ptr(m_labels.PDPT[1]));      // rax = &PDPT[1][0]
-    m_asm.or_(rax, 3);                                // flags = RW|P
-    m_asm.mov(ptr(m_labels.PML4T, 8*511), rax);       // PML4T[511] = rax
-
-    // Level 3 (high mapping)
-    m_asm.lea(rax, qword_ptr(m_labels.PDT[1]));         // rax = &PDT[1][0]
-    m_asm.or_(rax, 3);                                  // flags = RW|P
-    m_asm.mov(qword_ptr(m_labels.PDPT[1], 8*510), rax); // PDPT[1][510] = rax
-    m_asm.add(rax, 0x1000);                             // rax = &PDT[1][512]
-    m_asm.mov(qword_ptr(m_labels.PDPT[1], 8*511), rax); // PDPT[1][511] = rax
-
-    // Level 2 (high mapping) -- "zero page" compatibility ---> physical 0
-    m_asm.mov(rax, 0);                                  // rax = 0
-    m_asm.or_(rax, 0x83);                               // flags = PS|RW|P
-    m_asm.mov(qword_ptr(m_labels.PDT[1]), rax);         // PDT[1][0] = rax
-
-    // Level 2 (high mapping)
-    m_asm.mov(rax, 0x200000);                // rax = 2 MiB
-    m_asm.or_(rax, 0x83);                    // flags = PS|RW|P
-    m_asm.mov(rcx, 1);                       // loop counter, start at 1
-    m_asm.or_(rax, 0x83);                    // flags = PS|RW|P
-    m_asm.bind(lp_pd1);                      // lp_pd:
-    m_asm.lea(r12, ptr(m_labels.PDT[1]));    // r12 = &PDT[1][0]
-    m_asm.mov(qword_ptr(r12, rcx, 3), rax);  // PDT[1][rcx * 8] = rax
-    m_asm.add(rax, 0x200000);                // rax += 2 MiB
-    m_asm.inc(ecx);                          // loop counter ++
-    m_asm.cmp(ecx, 512 * 2);
-    m_asm.jl(lp_pd1);                        // loop to lp_pd
-
     // CR3
     m_asm.lea(rax, qword_ptr(m_labels.PML4T));        // rax = &PML4T[0]
     m_asm.mov(cr3, rax);                              // cr3 = rax
@@ -345,7 +275,11 @@ void BootAssembler::assembleText()
     /*** BOOT ***/
 
     // Reset VGA Card
-    m_asm.embed(m_gfxcode.data(), m_gfxcode.size());
+    for (auto& w : m_gfxreset) {
+        m_asm.mov(eax, w.value);
+        m_asm.mov(edx, w.port);
+        m_asm.out(dx, eax);
+    }
 
     // Long-mode boot code:
     //      (*btext)(void)
@@ -383,6 +317,14 @@ void BootAssembler::assembleData()
 
     m_asm.section(m_data);
 
+    /*
+     * Paging, at CTrampoline::TABLES where m_tables expects it. Each
+     * table is page aligned and one page in size.
+     */
+    assert(m_asm.offset() == 0);
+    m_asm.bind(m_labels.PML4T);
+    m_asm.embed(m_tables.data().data(), m_tables.data().size());
+
     // GDT
     m_asm.align(AlignMode::kZero, 16);
     m_asm.bind(m_labels.GDT);
@@ -397,30 +339,6 @@ void BootAssembler::assembleData()
     m_asm.dw(0);                    // For limit storage
     m_asm.dq(0);                    // For base storage
 
-    /*
-     * Memory for paging. Each table must be page aligned,
-     * and is one page in size.
-     */
-    align(PAGE_SIZE);
-    m_asm.bind(m_labels.PML4T);
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.bind(m_labels.PDPT[0]); // low
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.bind(m_labels.PDPT[1]); // high
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.bind(m_labels.PDT[0]); // low
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.bind(m_labels.PDT[1]); // high
-    m_asm.db(0x00, PAGE_SIZE);
-    m_asm.db(0x00, PAGE_SIZE);
-    /*
-     * Because i'm using 2MiB pages, this is where paging
-     * ends. There is no need for PTE's.
-     */
-
     /* insert space for a stack */
     align(PAGE_SIZE);
     m_asm.db(0x00, STACK_SIZE);
@@ -443,6 +361,8 @@ void BootAssembler::debug()
 
     std::cout << std::format("=========================================\n");
     std::cout << std::format("btext       | {:016x}\n", m_btext);
+    std::cout << std::format("page tables | {} x 4 KiB, {} MiB pages\n",
+                             m_tables.tables(), m_tables.pageSize() >> 20);
 
     /* let's list all the named labels, and their section */
     for (auto& l : m_code.labelEntries()) {
@@ -466,6 +386,8 @@ void BootAssembler::debug()
 std::vector<char> BootAssembler::data()
 {
     m_code.flatten();
+    // the page tables hold their own addresses
+    assert(m_data->offset() == DATAOFFSET);
     std::vector<char> buffer(m_code.codeSize());
     m_code.copyFlattenedData(buffer.data(), buffer.size(), asmjit::CopySectionFlags::kPadTargetBuffer);
     return buffer;
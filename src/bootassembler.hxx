@@ -1,6 +1,8 @@
 #pragma once
 
 #include "types.hxx"
+#include "cgfx.hxx"
+#include "cpagetables.hxx"
 using namespace beastie;
 
 #include <cstdint>
@@ -15,7 +17,8 @@ public:
     BootAssembler(uintptr_t btext,
                   uintptr_t modulep,
                   uintptr_t kernend,
-                  fbinfo fb);
+                  fbinfo fb,
+                  bool gbpages);
     void assemble();
     void debug();
 
@@ -30,7 +33,8 @@ private:
     uintptr_t m_modulep;
     uintptr_t m_kernend;
     fbinfo m_fb;
-    std::vector<char> m_gfxcode;
+    std::vector<portwrite> m_gfxreset;
+    CPageTables m_tables;
 
     struct {
         asmjit::Label entry;
@@ -38,8 +42,6 @@ private:
         asmjit::Label GDTP;
         asmjit::Label stackTop;
         asmjit::Label PML4T;
-        asmjit::Label PDPT[2];
-        asmjit::Label PDT[2];
     } m_labels;
 
     void initAsmJit();
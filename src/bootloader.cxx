@@ -3,7 +3,17 @@
 #include "cmetawriter.hxx"
 #include "cenvironmentwriter.hxx"
 #include "constants.hxx"
+#ifdef HAVE_ASMJIT
 #include "bootassembler.hxx"
+#endif
+#include "cbootbundle.hxx"
+#include "clayoutplanner.hxx"
+#include "cfontindex.hxx"
+#include "ckernelindex.hxx"
+#include "cloadpipeline.hxx"
+#include "cprofiler.hxx"
+#include "cstagemanifest.hxx"
+#include "ctrampoline.hxx"
 using namespace beastie;
 
 #include <cassert>
@@ -12,6 +22,7 @@ using namespace beastie;
 #include <stdexcept>
 #include <format>
 #include <tuple>
+#include <algorithm>
 #include <span>
 
 #include <elf.h>
@@ -21,17 +32,26 @@ using namespace beastie;
 #include <endian.h>
 
 beastie::Bootloader::Bootloader()
+    : Bootloader(fetchPlatform())
+{
+}
+
+beastie::Bootloader::Bootloader(const platforminfo& platform)
     : m_debug(false)
-    , m_efi(isEFI())
+    , m_efi(platform.efi)
     , m_howto(0)
     , m_btext(0)
+    , m_kernfile()
+    , m_kernsegs()
     , m_kernblock()
+    , m_kernsize(0)
     , m_bootblock()
     , m_metaphys(0)
     , m_kernend(0)
-    , m_fb(fetchFB())
-    , m_rsdp(0)
-    , m_rsdt(0)
+    , m_fb(platform.fb)
+    , m_rsdp(platform.rsdp)
+    , m_rsdt(platform.rsdt)
+    , m_gbpages(platform.gbpages)
     , m_segments()
     , m_nr_segments(0)
     , m_env()
@@ -41,18 +61,56 @@ beastie::Bootloader::Bootloader()
     , m_envphys(0)
     , m_bootphys(0)
     , m_sym()
-    , m_smap(fetchSMAP())
-    , m_efimap(fetchEFIMAP())
+    , m_symfilter(CSymbolsWriter::KeepAll)
+    , m_smap(platform.smap)
+    , m_efimap(platform.efimap)
     , m_force(false)
+    , m_fontblob()
+    , m_fontsubset()
+    , m_cols(80)
+    , m_rows(25)
+    , m_fontphys(0)
+    , m_mdfile()
+    , m_mdname()
+    , m_mdseg()
+    , m_kernpath()
+    , m_hints()
+    , m_modules()
+    , m_modrecords()
+    , m_modfiles()
+    , m_provided()
+    , m_modblock()
+    , m_modphys(0)
+    , m_symsize(0)
+    , m_hostphys(0)
+    , m_hostslot(0)
+    , m_imageseg()
+    , m_imageblock()
+    , m_hostblock()
+    , m_requests()
+    , m_inputs()
+    , m_manifest()
+    , m_digests()
+    , m_envvars()
+    , m_cache()
+    , m_image()
+    , m_warm(false)
+    , m_bundled(false)
+    , m_slack(0)
+    , m_loaded(false)
+    , m_staged(false)
+    , m_bundlepath()
 {
-    std::tie(m_rsdp, m_rsdt) = fetchACPI20(m_efi);
     writeDefaultEnv();
     setDefaultResolution();
 }
 
 beastie::Bootloader::~Bootloader()
 {
-    unload();
+    // nothing to undo (or no permission to) unless load() went through,
+    // and a staged image is meant to outlive us
+    if (m_loaded && m_staged == false)
+        unload();
 }
 
 void beastie::Bootloader::setDebug(bool debug)
@@ -70,6 +128,44 @@ void beastie::Bootloader::setForce(bool force)
     m_force = force;
 }
 
+void beastie::Bootloader::setSymbolFilter(unsigned filter)
+{
+    m_symfilter = filter;
+}
+
+void beastie::Bootloader::setConsole(unsigned cols, unsigned rows)
+{
+    m_cols = cols;
+    m_rows = rows;
+}
+
+void beastie::Bootloader::setFontSubset(std::string_view spec)
+{
+    m_fontsubset = CFontBlob::parseSubset(spec);
+}
+
+void beastie::Bootloader::setCache(std::filesystem::path dir)
+{
+    m_cache.setDirectory(dir);
+}
+
+void beastie::Bootloader::setManifest(std::filesystem::path manifest)
+{
+    m_manifest = CManifest::read(manifest);
+}
+
+void beastie::Bootloader::loaderConfLoad(std::filesystem::path root)
+{
+    CProfiler::Phase phase("loader.conf");
+    auto vars = CLoaderConf::read(root);
+    std::move(vars.begin(), vars.end(), std::back_inserter(m_envvars));
+}
+
+void beastie::Bootloader::setEnv(std::string_view assignment)
+{
+    m_envvars.push_back(CLoaderConf::assignment(assignment));
+}
+
 void beastie::Bootloader::setDefaultResolution()
 {
     m_fb.width = 1024;
@@ -78,8 +174,113 @@ void beastie::Bootloader::setDefaultResolution()
 
 void beastie::Bootloader::fileLoad(std::filesystem::path path)
 {
-    auto kernel = slurp<std::vector<char>>(path);
-    return elfLoad(std::move(kernel));
+    m_requests.push_back({request::File, path.string()});
+}
+
+void beastie::Bootloader::fontLoad(std::filesystem::path path)
+{
+    m_requests.push_back({request::Font, path.string()});
+}
+
+void beastie::Bootloader::moduleLoad(std::string_view name)
+{
+    m_requests.push_back({request::Module, std::string(name)});
+}
+
+void beastie::Bootloader::mdrootLoad(std::filesystem::path path)
+{
+    m_requests.push_back({request::MdImage, path.string()});
+}
+
+void beastie::Bootloader::addInput(std::filesystem::path path)
+{
+    auto id = CImageCache::identify(path);
+    if (id.has_value())
+        m_inputs.push_back(*id);
+}
+
+// Checked against the manifest, recorded under its boot name once the
+// kernel it is relative to is in
+void beastie::Bootloader::addDigest(std::filesystem::path path, const CSha256::digest& sha256)
+{
+    for (auto& d : m_digests) {
+        if (d.path == path.string())
+            return;
+    }
+    m_digests.push_back({path.string(), bootName(path), sha256});
+}
+
+void beastie::Bootloader::fileLoadNow(std::filesystem::path path)
+{
+    CProfiler::Phase phase("elf load", path.string());
+    addInput(path);
+    CSha256::digest sha256;
+    auto file = CLoadPipeline::instance().take(path, m_manifest ? &sha256 : nullptr);
+    phase.addBytes(file.size());
+
+    // before anything in it is looked at
+    if (m_manifest)
+        m_manifest->verify(path, sha256);
+    elfLoad(path, std::move(file));
+    if (m_manifest)
+        addDigest(path, sha256);
+}
+
+void beastie::Bootloader::moduleLoadNow(std::string_view name)
+{
+    std::string modname(name);
+    if (modname.ends_with(".ko"))
+        modname.resize(modname.size() - 3);
+
+    for (auto& p : m_provided) {
+        if (p.name == modname)
+            return;
+    }
+
+    auto found = m_hints.lookup(modname);
+    if (found.has_value() == false)
+        throw std::runtime_error(std::format("{}: module not found", name));
+    if (m_kernpath.empty() == false && std::filesystem::equivalent(*found, m_kernpath))
+        return;
+    fileLoadNow(*found);
+}
+
+// Module names resolve once the kernel is in (linker.hints), read them
+// all ahead from there
+void beastie::Bootloader::prefetchModules(size_t first)
+{
+    for (size_t i = first; i < m_requests.size(); ++i) {
+        if (m_requests[i].kind != request::Module)
+            continue;
+
+        std::string modname(m_requests[i].arg);
+        if (modname.ends_with(".ko"))
+            modname.resize(modname.size() - 3);
+        auto found = m_hints.lookup(modname);
+        if (found.has_value() && isLoaded(*found) == false)
+            CLoadPipeline::instance().prefetch(*found, m_manifest.has_value());
+    }
+}
+
+// Uncompressed images are handed to kexec as mapped, others are
+// decompressed chunk by chunk into anonymous memory
+void beastie::Bootloader::mdrootLoadNow(std::filesystem::path path)
+{
+    CProfiler::Phase phase("md image", path.string());
+    addInput(path);
+    CSha256::digest sha256;
+    m_mdfile = CLoadPipeline::instance().take(path, m_manifest ? &sha256 : nullptr);
+    m_mdname = bootName(path);
+    if (m_mdfile.size() == 0)
+        throw std::runtime_error(std::format("{}: empty md image", path.string()));
+    phase.addBytes(m_mdfile.size());
+    if (m_manifest) {
+        m_manifest->verify(path, sha256);
+        addDigest(path, sha256);
+    }
+
+    if (m_debug)
+        std::cout << std::format("[MDROOT]   {} ({} bytes)\n", m_mdname, m_mdfile.size());
 }
 
 /*
@@ -132,202 +333,780 @@ void beastie::Bootloader::fileLoad(std::filesystem::path path)
  *   - See the file format .fnt for mappings.
  *
  ****/
-void beastie::Bootloader::fontLoad(std::filesystem::path path)
+static std::filesystem::path chooseFont(std::filesystem::path path,
+                                        std::filesystem::path cachedir,
+                                        unsigned width, unsigned height,
+                                        unsigned cols, unsigned rows)
 {
-    unsigned index = 0;
-    auto buffer = zslurp(path);
-    font_header hdr;
-    std::memcpy(&hdr, buffer.data(), sizeof(hdr));
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec) == false)
+        return path;
+
+    auto fonts = CFontIndex::scan(path, cachedir);
+    auto font = CFontIndex::choose(fonts, width, height, cols, rows);
+    if (font.has_value() == false)
+        return {};
+    return font->id.path;
+}
 
-    if (std::string((char*)&hdr.fh_magic[0], 8) != "VFNT0002")
-        throw std::runtime_error(std::format("{}: format error", path.string()));
-
-    // The header is stored big endian (!!)
-    hdr.fh_glyph_count = be32toh(hdr.fh_glyph_count);
-    for (int i = 0; i < VFNT_MAPS; ++i)
-        hdr.fh_map_count[i] = be32toh(hdr.fh_map_count[i]);
-    index += sizeof(hdr);
-
-    unsigned gbytes = howmany(hdr.fh_width, 8) * hdr.fh_height;
-    unsigned glyphCount = hdr.fh_glyph_count;
-    unsigned total = glyphCount * gbytes;
-
-    font_info fi;
-    fi.fi_width = hdr.fh_width;
-    fi.fi_height = hdr.fh_height;
-    fi.fi_bitmap_size = total;
-    for (int i = 0; i < VFNT_MAPS; ++i)
-        fi.fi_map_count[i] = hdr.fh_map_count[i];
-
-    uint32_t checksum;
-    checksum = fi.fi_width;
-    checksum += fi.fi_height;
-    checksum += fi.fi_bitmap_size;
-    for (int i = 0; i < VFNT_MAPS; ++i)
-        checksum += fi.fi_map_count[i];
-
-    fi.fi_checksum = -checksum;
-
-    uint8_t fontBytes[total];
-    std::memcpy(fontBytes, buffer.data() + index, sizeof(fontBytes));
-    index += sizeof(fontBytes);
-
-    std::vector<vfnt_map> maps[VFNT_MAPS];
-    for (int i = 0; i < VFNT_MAPS; ++i) {
-        for (unsigned j = 0; j < hdr.fh_map_count[i]; ++j) {
-            vfnt_map map;
-            std::memcpy(&map, buffer.data() + index, sizeof(map));
-            map.vfm_src = be32toh(map.vfm_src);
-            map.vfm_dst = be16toh(map.vfm_dst);
-            map.vfm_len = be16toh(map.vfm_len);
-            maps[i].push_back(map);
-            index += sizeof(map);
-        }
-    }
+// The font to load for a fontLoad() request, empty if there is none
+std::filesystem::path beastie::Bootloader::fontFor(std::filesystem::path path)
+{
+    return chooseFont(path, m_cache.directory(), m_fb.width, m_fb.height, m_cols, m_rows);
+}
 
-    m_fontblock.clear();
+// The task only gets copies, it may outlive us when a load throws
+CLoadPipeline::Task<Bootloader::fontload> beastie::Bootloader::fontDecode(std::filesystem::path path)
+{
+    return CLoadPipeline::instance().async([path,
+                                            cachedir = m_cache.directory(),
+                                            subset = m_fontsubset,
+                                            width = m_fb.width,
+                                            height = m_fb.height,
+                                            cols = m_cols,
+                                            rows = m_rows,
+                                            hash = m_manifest.has_value()]() {
+        fontload font;
+        font.path = chooseFont(path, cachedir, width, height, cols, rows);
+        if (font.path.empty())
+            return font;
+
+        // converted fonts are kept next to the prepared images, except
+        // with a manifest: then the font is hashed as it is converted
+        CProfiler::Phase phase("font decode", font.path.string());
+        if (hash) {
+            CSha256 sha256;
+            font.blob = CFontBlob::convert(font.path, subset, &sha256);
+            font.sha256 = sha256.final();
+        } else {
+            font.blob = CFontBlob::load(font.path, subset, cachedir);
+        }
+        phase.addBytes(font.blob.size());
+        return font;
+    });
+}
 
-    // 1. insert the header
-    std::span<char> spanFontHdr((char*)&fi, sizeof(fi));
-    m_fontblock.insert(m_fontblock.end(), spanFontHdr.begin(), spanFontHdr.end());
+void beastie::Bootloader::fontLoadNow(CLoadPipeline::Task<fontload> task)
+{
+    auto font = task.get();
+    if (font.path.empty()) {
+        if (m_debug)
+            std::cout << std::format("[FONT]     none found, using the kernel's\n");
+        return;
+    }
 
-    // 2. insert the maps
-    for (int i = 0; i < VFNT_MAPS; ++i) {
-        for (vfnt_map map : maps[i]) {
-            std::span<char> spanFontMap((char*)&map, sizeof(map));
-            m_fontblock.insert(m_fontblock.end(), spanFontMap.begin(), spanFontMap.end());
-        }
+    addInput(font.path);
+    if (m_manifest) {
+        m_manifest->verify(font.path, *font.sha256);
+        addDigest(font.path, *font.sha256);
     }
+    m_fontblob = std::move(font.blob);
 
-    // 3. insert glyph data
-    std::span<char> spanFontGlyph((char*)fontBytes, total);
-    m_fontblock.insert(m_fontblock.end(), spanFontGlyph.begin(), spanFontGlyph.end());
-    assert(index == buffer.size());
+    if (m_debug) {
+        font_info fi;
+        std::memcpy(&fi, m_fontblob.data(), sizeof(fi));
+        std::cout << std::format("[FONT]     {} ({}x{}) for {}x{}\n", font.path.string(),
+                                 fi.fi_width, fi.fi_height, m_fb.width, m_fb.height);
+    }
 }
 
-void beastie::Bootloader::elfLoad(std::vector<char>&& buffer)
+void beastie::Bootloader::elfLoad(std::filesystem::path path, CMappedFile&& file)
 {
+    auto buffer = file.span();
     Elf64_Ehdr hdr;
     bool isKernel;
     bool isModule;
 
+    if (buffer.size() < sizeof(hdr))
+        throw std::runtime_error("ELF header truncated");
+
     std::memcpy(&hdr, buffer.data(), sizeof(hdr));
-    assert(hdr.e_ident[EI_MAG0] == 0x7f);
-    assert(hdr.e_ident[EI_MAG1] == 0x45);
-    assert(hdr.e_ident[EI_MAG2] == 0x4c);
-    assert(hdr.e_ident[EI_MAG3] == 0x46);
-    assert(hdr.e_ident[EI_CLASS] == 0x02);
-    assert(hdr.e_ident[EI_DATA] == 0x01);
-    assert(hdr.e_ident[EI_VERSION] == 0x01);
-    assert(hdr.e_ident[EI_OSABI] == 0x09);
-    assert(hdr.e_machine == 0x3e); // amd64
-    assert(hdr.e_version == 0x01);
+    if (CKernelIndex::valid(hdr) == false)
+        throw std::runtime_error(std::format("{}: not a FreeBSD amd64 kernel or module", path.string()));
 
     isKernel = (hdr.e_type == ET_EXEC);
     isModule = (hdr.e_type == ET_REL);
-    assert(isKernel || isModule);
 
     if (isKernel) {
-        elfLoadExec(hdr, std::move(buffer));
+        m_kernpath = path;
+        m_kernfile = std::move(file);
+        elfLoadExec(hdr, m_kernfile.span());
+
+        // same module_path as the loader: kernel directory, then modules
+        m_hints.addDirectory(path.parent_path());
+        m_hints.addDirectory(path.parent_path().parent_path()/"modules");
+        addInput(path.parent_path()/"linker.hints");
+        addInput(path.parent_path().parent_path()/"modules"/"linker.hints");
     }
 
     if (isModule) {
-        elfLoadRel(hdr, std::move(buffer));
+        elfLoadRel(hdr, path, std::move(file));
     }
 }
 
-void beastie::Bootloader::elfLoadExec(Elf64_Ehdr hdr, std::vector<char>&& buffer)
+void beastie::Bootloader::elfLoadExec(Elf64_Ehdr hdr, std::span<char> buffer)
 {
-    Elf64_Phdr phdr[hdr.e_phnum];
-    Elf64_Shdr shdr[hdr.e_shnum];
+    // the counts come from the file, the tables go on the heap
+    std::vector<Elf64_Phdr> phdr(hdr.e_phnum);
+    std::vector<Elf64_Shdr> shdr(hdr.e_shnum);
+    size_t phbytes = phdr.size() * sizeof(Elf64_Phdr);
+    size_t shbytes = shdr.size() * sizeof(Elf64_Shdr);
+
+    if (hdr.e_phoff > buffer.size() || phbytes > buffer.size() - hdr.e_phoff ||
+        hdr.e_shoff > buffer.size() || shbytes > buffer.size() - hdr.e_shoff)
+        throw std::runtime_error("ELF headers truncated");
 
-    std::memcpy(phdr, buffer.data() + hdr.e_phoff, sizeof(phdr));
-    std::memcpy(shdr, buffer.data() + hdr.e_shoff, sizeof(shdr));
+    std::memcpy(phdr.data(), buffer.data() + hdr.e_phoff, phbytes);
+    std::memcpy(shdr.data(), buffer.data() + hdr.e_shoff, shbytes);
 
     this->m_btext = hdr.e_entry;
-    assert(this->m_btext);
+    if (this->m_btext == 0)
+        throw std::runtime_error("ELF kernel without an entry point");
 
-    for (int i = 0; i < hdr.e_phnum; ++i) {
-        if (phdr[i].p_type != PT_LOAD)
+    m_kernphys = 0x20'0000;
+    m_kernsegs.clear();
+    m_kernblock.clear();
+    m_kernsize = 0;
+
+    // prefer handing kexec the mapped file, fall back to a private copy
+    if (elfMapExec(phdr, buffer) == false)
+        elfCopyExec(phdr, buffer);
+
+    // the string table is the one the symbol table links to, the first
+    // SHT_STRTAB may well be .shstrtab. A stripped kernel has neither and
+    // boots without symbols
+    m_sym.clear();
+    for (int i = 0; i < hdr.e_shnum; ++i) {
+        if (shdr[i].sh_type != SHT_SYMTAB)
+            continue;
+
+        Elf64_Word link = shdr[i].sh_link;
+        if (link == SHN_UNDEF || link >= hdr.e_shnum || shdr[link].sh_type != SHT_STRTAB)
+            throw std::runtime_error("ELF symbol table without a string table");
+
+        if (shdr[i].sh_offset > buffer.size() || shdr[i].sh_size > buffer.size() - shdr[i].sh_offset)
+            throw std::runtime_error("ELF symbol table truncated");
+        if (shdr[link].sh_offset > buffer.size() || shdr[link].sh_size > buffer.size() - shdr[link].sh_offset)
+            throw std::runtime_error("ELF string table truncated");
+
+        CProfiler::Phase phase("symbol extraction");
+        phase.addBytes(shdr[i].sh_size + shdr[link].sh_size);
+        m_sym.addSymbols(buffer.subspan(shdr[i].sh_offset, shdr[i].sh_size),
+                         buffer.subspan(shdr[link].sh_offset, shdr[link].sh_size),
+                         m_symfilter);
+        if (m_debug)
+            std::cout << std::format("[SYMBOLS]  {} of {} bytes kept\n", m_sym.size(),
+                                     shdr[i].sh_size + shdr[link].sh_size);
+        break;
+    }
+}
+
+/*
+ * Point the kexec segments straight at the PT_LOAD ranges of the mapped
+ * file. Only p_filesz bytes are handed over, kexec zero-fills the rest of
+ * each segment (the BSS), and the debug sections are never touched.
+ *
+ * kexec wants page aligned segments that don't overlap, so this fails
+ * when two PT_LOADs share a page or an offset isn't congruent to its
+ * address.
+ */
+bool beastie::Bootloader::elfMapExec(std::span<Elf64_Phdr> phdr, std::span<char> buffer)
+{
+    constexpr uintptr_t PAGE = 4096;
+    std::vector<loadsegment> segs;
+
+    for (auto& ph : phdr) {
+        if (ph.p_type != PT_LOAD)
             continue;
 
         // the entries are sorted by vaddr, and there's always a 2 MiB hole
         // in front of the kernel that must be removed
-        uintptr_t paddr = phdr[i].p_vaddr - KERNBASE - 0x200000;
-        Elf64_Off offset = phdr[i].p_offset;
-        Elf64_Xword memsz = phdr[i].p_memsz;
+        uintptr_t paddr = ph.p_vaddr - KERNBASE - 0x200000;
+        uintptr_t delta = paddr % PAGE;
+
+        if (ph.p_offset > buffer.size() || ph.p_filesz > buffer.size() - ph.p_offset)
+            throw std::runtime_error("ELF segment truncated");
+        if (ph.p_filesz > ph.p_memsz)
+            throw std::runtime_error("ELF segment larger in the file than in memory");
+        if (ph.p_offset % PAGE != delta)
+            return false;
+
+        loadsegment seg;
+        seg.buf = buffer.data() + ph.p_offset - delta;
+        seg.bufsz = ph.p_filesz + delta;
+        seg.phys = m_kernphys + paddr - delta;
+        seg.memsz = howmany(ph.p_memsz + delta, PAGE) * PAGE;
+
+        if (segs.size() && seg.phys < segs.back().phys + segs.back().memsz)
+            return false;
+
+        segs.push_back(seg);
+    }
+
+    for (auto& seg : segs) {
+        if (m_debug)
+            std::cout << std::format("[PT_LOAD]  phys=0x{:x} size=0x{:x} file=0x{:x}\n",
+                                     seg.phys - m_kernphys,
+                                     seg.memsz,
+                                     seg.bufsz);
+
+        m_kernfile.willNeed(seg.buf - buffer.data(), seg.bufsz);
+        m_kernsize = std::max(m_kernsize, seg.phys - m_kernphys + seg.memsz);
+    }
+
+    m_kernsegs = std::move(segs);
+    return true;
+}
 
-        m_kernblock.resize(paddr + memsz);
+void beastie::Bootloader::elfCopyExec(std::span<Elf64_Phdr> phdr, std::span<char> buffer)
+{
+    for (auto& ph : phdr) {
+        if (ph.p_type != PT_LOAD)
+            continue;
+
+        uintptr_t paddr = ph.p_vaddr - KERNBASE - 0x200000;
+        Elf64_Off offset = ph.p_offset;
+        Elf64_Xword memsz = ph.p_memsz;
+
+        if (offset > buffer.size() || ph.p_filesz > buffer.size() - offset)
+            throw std::runtime_error("ELF segment truncated");
+        if (ph.p_filesz > memsz)
+            throw std::runtime_error("ELF segment larger in the file than in memory");
+
+        m_kernblock.resize(std::max(m_kernblock.size(), paddr + memsz));
 
         if (m_debug)
-            std::cout << std::format("[PT_LOAD]  phys=0x{:x} size=0x{:x} off=0x{:x}\n",
+            std::cout << std::format("[PT_LOAD]  phys=0x{:x} size=0x{:x} off=0x{:x} (copied)\n",
                                      paddr,
-                                     phdr[i].p_memsz,
+                                     ph.p_memsz,
                                      offset);
 
         char* dst = &m_kernblock.data()[paddr];
         char* src = &buffer.data()[offset];
-        std::memcpy(dst, src, phdr[i].p_filesz);
+        std::memcpy(dst, src, ph.p_filesz);
     }
 
-    for (int i = 0; i < hdr.e_shnum; ++i) {
-        if (shdr[i].sh_type != SHT_SYMTAB)
-            continue;
+    m_kernsize = m_kernblock.size();
+    m_kernsegs.push_back(loadsegment{
+        m_kernblock.data(),
+        m_kernblock.size(),
+        m_kernphys,
+        howmany(m_kernblock.size(), 4096) * 4096,
+    });
+}
+
+void beastie::Bootloader::elfLoadRel(Elf64_Ehdr hdr,
+                                     std::filesystem::path path,
+                                     CMappedFile&& file)
+{
+    if (hdr.e_phnum != 0 || hdr.e_entry != 0)
+        throw std::runtime_error(std::format("{}: ELF module with program headers", path.string()));
 
-        std::vector<char> symtab(shdr[i].sh_size);
-        Elf64_Off offset = shdr[i].sh_offset;
+    // each file is loaded once, this also breaks dependency cycles
+    for (auto& f : m_modfiles) {
+        if (std::filesystem::equivalent(f, path))
+            return;
+    }
+    m_modfiles.push_back(path);
 
-        char* dst = symtab.data();
-        char* src = &buffer.data()[offset];
-        std::memcpy(dst, src, shdr[i].sh_size);
+    CElfModule mod(bootName(path), std::move(file));
 
-        m_sym.addSymTab(symtab);
-        break;
+    // a module satisfies its own dependencies
+    m_provided.insert(m_provided.end(), mod.provides().begin(), mod.provides().end());
+
+    // read all the dependencies ahead, they are loaded one by one below
+    for (auto& dep : mod.depends()) {
+        if (isProvided(dep))
+            continue;
+        auto found = m_hints.lookup(dep.name, &dep);
+        if (found.has_value() && isLoaded(*found) == false)
+            CLoadPipeline::instance().prefetch(*found, m_manifest.has_value());
     }
 
-    for (int i = 0; i < hdr.e_shnum; ++i) {
-        if (shdr[i].sh_type != SHT_STRTAB)
+    for (auto& dep : mod.depends()) {
+        if (isProvided(dep))
             continue;
 
-        std::vector<char> strtab(shdr[i].sh_size);
-        Elf64_Off offset = shdr[i].sh_offset;
+        auto found = m_hints.lookup(dep.name, &dep);
+        if (found.has_value() == false)
+            throw std::runtime_error(std::format("{}: depends on {} which was not found",
+                                                 mod.name(), dep.name));
 
-        char* dst = strtab.data();
-        char* src = &buffer.data()[offset];
-        std::memcpy(dst, src, shdr[i].sh_size);
+        // the kernel's own modules are listed in linker.hints too
+        if (m_kernpath.empty() == false && std::filesystem::equivalent(*found, m_kernpath))
+            continue;
 
-        m_sym.addStrTab(strtab);
-        break;
+        fileLoadNow(*found);
     }
 
-    // XXX move to boot()
-    m_kernphys = 0x20'0000;
-    m_symphys = m_kernphys + roundup(m_kernblock.size(), 4096);
-    m_envphys = m_symphys + roundup(m_sym.size(), 4096);
-    m_fontphys = m_envphys + roundup(m_env.size(), 4096);
-    m_metaphys = m_fontphys + roundup(m_fontblock.size(), 4096);
+    if (m_debug)
+        std::cout << std::format("[MODULE]   {} ({} dependencies)\n",
+                                 mod.name(),
+                                 mod.depends().size());
 
-    writeMetadata();
-    m_kernend = m_metaphys + roundup(m_meta.size(), 4096);
+    // dependencies were pushed first, so this list is in load order
+    m_modules.push_back(std::move(mod));
+}
+
+// The kernel or a module already in, nothing to read
+bool beastie::Bootloader::isLoaded(std::filesystem::path path)
+{
+    if (m_kernpath.empty() == false && std::filesystem::equivalent(path, m_kernpath))
+        return true;
+    for (auto& f : m_modfiles) {
+        if (std::filesystem::equivalent(f, path))
+            return true;
+    }
+    return false;
+}
+
+bool beastie::Bootloader::isProvided(const moddepend& dep)
+{
+    for (auto& p : m_provided) {
+        if (p.name == dep.name &&
+            p.version >= dep.minimum &&
+            p.version <= dep.maximum)
+            return true;
+    }
+    return false;
+}
+
+std::string beastie::Bootloader::bootName(std::filesystem::path path)
+{
+    // <root>/boot/kernel/kernel -> <root>
+    if (m_kernpath.empty())
+        return path.string();
+    auto root = m_kernpath.parent_path().parent_path().parent_path();
+    return "/" + path.lexically_relative(root).string();
+}
+
+/*
+ * Modules are laid out back to back after the kernel, each page aligned,
+ * and copied into a single block that starts the image segment.
+ */
+void beastie::Bootloader::layoutModules(uintptr_t phys)
+{
+    size_t total = 0;
+
+    m_modphys = phys;
+    m_modrecords.clear();
+    for (auto& mod : m_modules) {
+        // the kernel linker uses the section addresses as they are, so
+        // they are kernel virtual addresses
+        uintptr_t addr = phys + total;
+        total += howmany(mod.layout(KERNBASE + addr), 4096) * 4096;
+
+        auto ehdr = mod.ehdr();
+        auto shdr = mod.shdr();
+        m_modrecords.push_back({
+            mod.name(),
+            "elf obj module",
+            addr,
+            mod.size(),
+            std::vector<char>(ehdr.begin(), ehdr.end()),
+            std::vector<char>(shdr.begin(), shdr.end()),
+        });
+    }
+
+    m_modblock.assign(total, 0);
+    for (size_t i = 0; i < m_modules.size(); ++i) {
+        std::span<char> dst(m_modblock.data() + (m_modrecords[i].addr - phys), m_modules[i].size());
+        m_modules[i].copy(dst);
+    }
+}
+
+void beastie::Bootloader::bundleLoad(std::filesystem::path path)
+{
+    m_image = CBootBundle::read(path);
+    m_bundled = true;
+    m_bundlepath = path;
+
+    if (m_debug)
+        std::cout << std::format("[BUNDLE]   {} segments from {}\n", m_image.segments.size(), path.string());
+}
 
+void beastie::Bootloader::bundleCreate(std::filesystem::path path)
+{
+    // fonts are picked for the framebuffer, and this one isn't the
+    // framebuffer of the hosts the bundle boots on
+    for (auto& r : m_requests) {
+        std::error_code ec;
+        if (r.kind == request::Font && std::filesystem::is_directory(r.arg, ec))
+            throw std::runtime_error(std::format("{}: a bundle needs a font file, not a directory to pick from",
+                                                 r.arg));
+    }
+
+    // never from the cache, and with room for the metadata of other hosts
+    m_cache.setDirectory({});
+    m_slack = CBootBundle::SLACK;
+    prepare();
+
+    imagecache image;
+    image.layout = saveLayout();
+    image.modules = m_modrecords;
+    for (auto& seg : imageSegments()) {
+        if (seg.phys != m_bootphys)
+            image.segments.push_back(seg);
+    }
+    CBootBundle::write(path, image);
 
-    BootAssembler ba(m_btext, m_metaphys, m_kernend, m_fb);
-    ba.assemble();
     if (m_debug)
+        std::cout << std::format("[BUNDLE]   {} segments to {}\n", image.segments.size(), path.string());
+}
+
+void beastie::Bootloader::prepareBundle()
+{
+    if (adoptImage() == false)
+        throw std::runtime_error("host metadata doesn't fit in the bundle");
+
+    // the boot block depends on the framebuffer of this host
+    assembleBootBlock();
+    m_image.segments.push_back({m_bootblock.data(), m_bootblock.size(), m_bootphys,
+                                roundup(m_bootblock.size(), 4096)});
+}
+
+void beastie::Bootloader::prepare()
+{
+    uint64_t key = 0;
+    m_warm = false;
+
+    if (m_bundled)
+        return prepareBundle();
+
+    // a cached image holds what was read back then, with a manifest only
+    // what is read and checked now may boot
+    bool cached = m_cache.enabled() && m_manifest.has_value() == false;
+    if (cached) {
+        CProfiler::Phase phase("cache lookup");
+        key = cacheKey();
+        if (m_cache.read(key, m_image) && prepareCached()) {
+            if (m_debug)
+                std::cout << std::format("[CACHE]    using {:016x}\n", key);
+            m_requests.clear();
+            return;
+        }
+    }
+
+    // reading, decompressing and font decoding run ahead on the load
+    // pipeline, parsing stays in request order on this thread
+    auto& pipeline = CLoadPipeline::instance();
+    std::vector<CLoadPipeline::Task<fontload>> fonts;
+    m_digests.clear();
+    for (auto& r : m_requests) {
+        if (r.kind == request::File || r.kind == request::MdImage)
+            pipeline.prefetch(r.arg, m_manifest.has_value());
+        if (r.kind == request::Font)
+            fonts.push_back(fontDecode(r.arg));
+    }
+
+    size_t font = 0;
+    bool modules = false;
+    for (size_t i = 0; i < m_requests.size(); ++i) {
+        auto& r = m_requests[i];
+        switch (r.kind) {
+        case request::File:
+            fileLoadNow(r.arg);
+            break;
+        case request::Font:
+            fontLoadNow(std::move(fonts[font++]));
+            break;
+        case request::MdImage:
+            mdrootLoadNow(r.arg);
+            break;
+        case request::Module:
+            if (modules == false)
+                prefetchModules(i);
+            modules = true;
+            moduleLoadNow(r.arg);
+            break;
+        }
+    }
+    m_requests.clear();
+    pipeline.discard();
+
+    prepareImage();
+
+    // never fail the boot over the cache
+    if (cached) {
+        try {
+            storeCached(key);
+        }
+        catch (std::exception& e) {
+            if (m_debug)
+                std::cerr << std::format("[CACHE]    not stored: {}\n", e.what());
+        }
+    }
+}
+
+/*
+ * Physical layout, everything the kernel is handed lies between its
+ * image and kernend:
+ *
+ *   0x100000   boot block
+ *   kernphys   kernel (PT_LOAD segments)
+ *   modphys    modules, symbols, font   (image segment, cacheable)
+ *              md image                 (its own segment, cacheable)
+ *   hostphys   metadata, environment    (host segment, rebuilt)
+ *   kernend
+ *
+ * Small blobs are packed on 8 byte boundaries and each group becomes a
+ * single coalesced kexec segment.
+ */
+void beastie::Bootloader::prepareImage()
+{
+    if (m_btext == 0)
+        throw std::runtime_error("no kernel loaded");
+
+    CProfiler::Phase phase("layout");
+    CLayoutPlanner plan(m_smap);
+    plan.reserve("kernel", m_kernphys, m_kernsize);
+
+    layoutModules(howmany(m_kernphys + m_kernsize, 4096) * 4096);
+    plan.setCursor(m_modphys);
+    plan.place("modules", m_modblock.size(), 4096);
+    m_symsize = m_sym.size();
+    m_symphys = plan.place("symbols", m_symsize, sizeof(uint64_t));
+    m_fontphys = m_fontblob.size() ? plan.place("font", m_fontblob.size(), sizeof(uint64_t)) : 0;
+    size_t imagesize = howmany(plan.cursor() - m_modphys, 4096) * 4096;
+
+    // the md image is big, it is mapped rather than copied into the image
+    uintptr_t next = m_modphys + imagesize;
+    m_mdseg = {};
+    if (m_mdfile.size()) {
+        plan.setCursor(next);
+        uintptr_t mdphys = plan.place("md image", m_mdfile.size(), 4096);
+        m_mdseg = {m_mdfile.data(), m_mdfile.size(), mdphys, howmany(m_mdfile.size(), 4096) * 4096};
+        m_modrecords.push_back({m_mdname, "md_image", mdphys, m_mdfile.size(), {}, {}});
+        next = mdphys + m_mdseg.memsz;
+    }
+
+    m_hostphys = next;
+    writeEnv();
+    placeHostData();
+    m_hostslot = roundup(m_envphys + m_env.size() - m_hostphys + m_slack, 4096);
+    m_kernend = m_hostphys + m_hostslot;
+    plan.reserve("metadata", m_hostphys, m_hostslot);
+
+    assembleBootBlock();
+    plan.reserve("boot block", m_bootphys, m_bootblock.size());
+    plan.check();
+
+    // one copy of each blob into the image segment, the symbols may
+    // still point into the kernel file
+    CSegmentBuilder modules;
+    CSegmentBuilder font;
+    modules.reference(m_modblock);
+    font.reference(m_fontblob.span());
+    CLayoutPlanner::part parts[] = {
+        {m_modphys, &modules},
+        {m_symphys, &m_sym.builder()},
+        {m_fontphys, &font},
+    };
+    m_imageseg = CLayoutPlanner::coalesce(parts, imagesize, m_imageblock);
+    phase.addBytes(m_imageseg.bufsz);
+}
+
+// The metadata goes first so the boot block only depends on hostphys
+void beastie::Bootloader::placeHostData()
+{
+    m_metaphys = m_hostphys;
+
+    // the size of the metadata doesn't depend on the addresses in it
+    m_envphys = m_hostphys;
+    writeMetadata();
+    m_envphys = m_metaphys + howmany(m_meta.size(), sizeof(uint64_t)) * sizeof(uint64_t);
+    writeMetadata();
+}
+
+void beastie::Bootloader::assembleBootBlock()
+{
+    CProfiler::Phase phase("assemble");
+    CTrampoline tramp(m_btext, m_metaphys, m_kernend, m_fb, m_gbpages);
+    if (m_debug)
+        tramp.debug();
+#ifdef HAVE_ASMJIT
+    // the reference the stub template was built from, only for its listing,
+    // what boots is always the template
+    if (m_debug) {
+        BootAssembler ba(m_btext, m_metaphys, m_kernend, m_fb, m_gbpages);
+        ba.assemble();
         ba.debug();
-    m_bootblock = ba.data();
-    m_bootphys = 0x10'0000;
+        if (ba.data() != tramp.data())
+            std::cout << "[ASSEMBLE] reference differs from the stub template\n";
+    }
+#endif
+    m_bootblock = tramp.data();
+    m_bootphys = CTrampoline::BASE;
+    phase.addBytes(m_bootblock.size());
 }
 
-void beastie::Bootloader::elfLoadRel(Elf64_Ehdr hdr, std::vector<char>&& buffer)
+/*
+ * The key covers what was asked for and what the boot block depends on.
+ * The files pulled in along the way (dependencies, linker.hints) are
+ * recorded in the entry and checked by prepareCached(). With a manifest
+ * there is no cache lookup, the key only goes into the stage key, and
+ * the files it lists are keyed by their digest rather than by inode.
+ */
+uint64_t beastie::Bootloader::cacheKey()
 {
-    assert(hdr.e_phnum == 0);
-    Elf64_Shdr shdr[hdr.e_shnum];
+    uint64_t h = hash64(progvers);
+    auto mix = [&h](auto v) {
+        h = hash64(std::span<const char>((const char*)&v, sizeof(v)), h);
+    };
+    auto mixString = [&h, &mix](std::string_view s) {
+        mix(s.size());
+        h = hash64(s, h);
+    };
+
+    for (auto& r : m_requests) {
+        mix(int(r.kind));
+        mixString(r.arg);
+        if (r.kind == request::Module)
+            continue;
+        auto path = r.kind == request::Font ? fontFor(r.arg) : std::filesystem::path(r.arg);
+        auto sha256 = m_manifest ? m_manifest->lookup(path) : std::nullopt;
+        if (sha256.has_value()) {
+            h = hash64(std::span<const char>((const char*)sha256->data(), sha256->size()), h);
+            continue;
+        }
+        auto id = CImageCache::identify(path);
+        if (id.has_value()) {
+            mix(id->dev);
+            mix(id->ino);
+            mix(id->size);
+            mix(id->mtime);
+            mix(id->ctime);
+        }
+    }
 
-    // XXX TODO
+    mix(m_manifest.has_value());
+    mix(m_symfilter);
+    for (auto& r : m_fontsubset) {
+        mix(r.first);
+        mix(r.last);
+    }
 
-    std::memcpy(shdr, buffer.data() + hdr.e_shoff, sizeof(shdr));
-    assert(hdr.e_entry == 0);
+    // platform fingerprint
+    mixString(m_fb.id);
+    mix(m_fb.phys);
+    mix(m_fb.size);
+    mix(m_fb.width);
+    mix(m_fb.height);
+    mix(m_efi);
+    mix(m_rsdp);
+    mix(m_gbpages);
+    return h;
+}
+
+/*
+ * The cache key covers the image, the staged one also has the env and
+ * metadata baked in. Only what is known before prepare() goes in, so
+ * that --commit can compare without preparing anything.
+ */
+uint64_t beastie::Bootloader::stageKey()
+{
+    uint64_t h = cacheKey();
+    auto mix = [&h](auto v) {
+        h = hash64(std::span<const char>((const char*)&v, sizeof(v)), h);
+    };
+
+    mix(m_howto);
+    mix(m_rsdt);
+    for (auto& v : m_envvars) {
+        mix(v.name.size());
+        h = hash64(v.name, h);
+        mix(v.value.size());
+        h = hash64(v.value, h);
+    }
+    h = hash64(std::span<const char>((const char*)m_smap.e820_table.data(),
+                                     m_smap.e820_table.size() * sizeof(smapentry)), h);
+
+    if (m_bundled) {
+        auto id = CImageCache::identify(m_bundlepath);
+        h = hash64(m_bundlepath.string(), h);
+        if (id.has_value()) {
+            mix(id->dev);
+            mix(id->ino);
+            mix(id->size);
+            mix(id->mtime);
+            mix(id->ctime);
+        }
+    }
+    return h;
+}
+
+bool beastie::Bootloader::prepareCached()
+{
+    for (auto& id : m_image.inputs) {
+        auto now = CImageCache::identify(id.path);
+        if (now.has_value() == false || *now != id)
+            return false;
+    }
+
+    return adoptImage();
+}
+
+// Take over the layout of m_image, only the host specific parts are built
+bool beastie::Bootloader::adoptImage()
+{
+    restoreLayout(m_image.layout);
+    m_modrecords = m_image.modules;
+
+    // env and metadata are rebuilt, they must fit where they were
+    writeEnv();
+    placeHostData();
+    if (m_envphys + m_env.size() > m_hostphys + m_hostslot)
+        return false;
+
+    // the memory map may not be the one the image was built for
+    CLayoutPlanner plan(m_smap);
+    for (auto& seg : m_image.segments)
+        plan.reserve(std::format("segment 0x{:x}", seg.phys), seg.phys, seg.memsz);
+    plan.reserve("metadata", m_hostphys, m_hostslot);
+    plan.check();
+
+    m_warm = true;
+    return true;
+}
+
+imagelayout beastie::Bootloader::saveLayout()
+{
+    imagelayout l;
+    l.btext = m_btext;
+    l.kernphys = m_kernphys;
+    l.kernsize = m_kernsize;
+    l.symphys = m_symphys;
+    l.symsize = m_symsize;
+    l.fontphys = m_fontphys;
+    l.hostphys = m_hostphys;
+    l.hostslot = m_hostslot;
+    l.kernend = m_kernend;
+    l.bootphys = m_bootphys;
+    return l;
+}
+
+void beastie::Bootloader::restoreLayout(const imagelayout& l)
+{
+    m_btext = l.btext;
+    m_kernphys = l.kernphys;
+    m_kernsize = l.kernsize;
+    m_symphys = l.symphys;
+    m_symsize = l.symsize;
+    m_fontphys = l.fontphys;
+    m_hostphys = l.hostphys;
+    m_hostslot = l.hostslot;
+    m_kernend = l.kernend;
+    m_bootphys = l.bootphys;
+}
+
+void beastie::Bootloader::storeCached(uint64_t key)
+{
+    imagecache entry;
+    entry.layout = saveLayout();
+    entry.inputs = m_inputs;
+    entry.modules = m_modrecords;
+    entry.segments = imageSegments();
+    m_cache.write(key, entry);
 }
 
 void beastie::Bootloader::unload()
@@ -350,10 +1129,21 @@ void beastie::Bootloader::load()
         }
     }
 
+    CProfiler::Phase phase("kexec_load");
+    for (unsigned int i = 0; i < m_nr_segments; ++i)
+        phase.addBytes(m_segments[i].bufsz);
+
     if (syscall(SYS_kexec_load, getEntry(), m_nr_segments, m_segments, KEXEC_ARCH_X86_64))
     {
         throw std::runtime_error(std::strerror(errno));
     }
+    m_loaded = true;
+}
+
+std::span<const kexec_segment> beastie::Bootloader::segments()
+{
+    prepareSegments();
+    return {m_segments, m_nr_segments};
 }
 
 uintptr_t beastie::Bootloader::getEntry()
@@ -364,72 +1154,112 @@ uintptr_t beastie::Bootloader::getEntry()
 void beastie::Bootloader::boot()
 {
     load();
-    if (m_force)
+    commit(m_force);
+}
+
+void beastie::Bootloader::commit(bool force)
+{
+    // nothing comes back from the handoff, report before it
+    CProfiler::instance().mark("shutdown handoff");
+    CProfiler::instance().report();
+    if (force)
         forcedshutdown();
     else
         shutdown();
 }
 
+void beastie::Bootloader::stage(std::filesystem::path manifest)
+{
+    // the key is over the requests, prepare() consumes them
+    uint64_t key = stageKey();
+    prepare();
+    stagePrepared(manifest, key);
+}
+
+void beastie::Bootloader::stagePrepared(std::filesystem::path manifest, uint64_t key)
+{
+    // a failed load must not leave the previous manifest behind
+    CStageManifest::remove(manifest);
+    load();
+    m_staged = true;
+
+    CStageManifest::write(manifest, {key, m_warm ? m_image.inputs : m_inputs});
+    if (m_debug)
+        std::cout << std::format("[STAGE]    {} segments, key {:016x}\n", m_nr_segments, key);
+}
+
+bool beastie::Bootloader::isStaged(std::filesystem::path manifest)
+{
+    CProfiler::Phase phase("stage lookup");
+    auto staged = CStageManifest::read(manifest);
+    if (staged.has_value() == false || staged->key != stageKey())
+        return false;
+    return CStageManifest::valid(*staged);
+}
+
 void beastie::Bootloader::writeDefaultEnv()
 {
     m_env += std::format("acpi.rsdp=0x{:x}", m_rsdp);
-    m_env += std::format("acpi.rsdt=0x{:x}", m_rsdt);
+    if (m_rsdt)
+        m_env += std::format("acpi.rsdt=0x{:x}", m_rsdt);
     m_env += "hint.uart.0.at=acpi";
     m_env += "hint.uart.0.port=0x3f8";
     m_env += "hint.uart.0.flags=0x10";
 }
 
-void beastie::Bootloader::prepareSegments()
+// The env as of the files loaded, from scratch each time the host data
+// is placed. loader.conf and -e override the defaults, not the digests.
+void beastie::Bootloader::writeEnv()
 {
-    m_nr_segments = 0;
-
-    if (m_kernblock.size() > 0) {
-        m_segments[0].buf = m_kernblock.data();
-        m_segments[0].bufsz = m_kernblock.size();
-        m_segments[0].mem = reinterpret_cast<const void*>(m_kernphys);
-        m_segments[0].memsz = roundup(m_kernblock.size(), 4096);
-        m_nr_segments++;
-    }
+    m_env.clear();
+    writeDefaultEnv();
+    for (auto& v : m_envvars)
+        m_env.set(v.name, v.value);
+    for (auto& d : m_digests)
+        m_env += std::format("beastie.sha256.{}={}", d.name, CSha256::hex(d.sha256));
+}
 
-    if (m_sym.size() > 0) {
-        m_segments[1].buf = m_sym.data();
-        m_segments[1].bufsz = m_sym.size();
-        m_segments[1].mem = reinterpret_cast<const void*>(m_symphys);
-        m_segments[1].memsz = roundup(m_sym.size(), 4096);
-        m_nr_segments++;
-    }
+void beastie::Bootloader::addSegment(const void* buf, size_t bufsz, uintptr_t phys, size_t memsz)
+{
+    if (m_nr_segments >= KEXEC_SEGMENT_MAX)
+        throw std::runtime_error("too many kexec segments");
+
+    m_segments[m_nr_segments].buf = buf;
+    m_segments[m_nr_segments].bufsz = bufsz;
+    m_segments[m_nr_segments].mem = reinterpret_cast<const void*>(phys);
+    m_segments[m_nr_segments].memsz = memsz;
+    m_nr_segments++;
+}
 
-    if (m_env.size() > 0) {
-        m_segments[2].buf = m_env.data();
-        m_segments[2].bufsz = m_env.size();
-        m_segments[2].mem = reinterpret_cast<const void*>(m_envphys);
-        m_segments[2].memsz = roundup(m_env.size(), 4096);
-        m_nr_segments++;
-    }
+// Everything but the env and metadata, which depend on the host
+std::vector<loadsegment> beastie::Bootloader::imageSegments()
+{
+    std::vector<loadsegment> segs = m_kernsegs;
+
+    if (m_imageseg.bufsz > 0)
+        segs.push_back(m_imageseg);
+    if (m_mdseg.bufsz > 0)
+        segs.push_back(m_mdseg);
+    if (m_bootblock.size() > 0)
+        segs.push_back({m_bootblock.data(), m_bootblock.size(), m_bootphys, roundup(m_bootblock.size(), 4096)});
+    return segs;
+}
 
-    if (m_meta.size() > 0) {
-        m_segments[3].buf = m_meta.data();
-        m_segments[3].bufsz = m_meta.size();
-        m_segments[3].mem = reinterpret_cast<const void*>(m_metaphys);
-        m_segments[3].memsz = roundup(m_meta.size(), 4096);
-        m_nr_segments++;
-    }
+void beastie::Bootloader::prepareSegments()
+{
+    CProfiler::Phase phase("prepare segments");
+    m_nr_segments = 0;
 
-    if (m_bootblock.size() > 0) {
-        m_segments[4].buf = m_bootblock.data();
-        m_segments[4].bufsz = m_bootblock.size();
-        m_segments[4].mem = reinterpret_cast<const void*>(m_bootphys);
-        m_segments[4].memsz = roundup(m_bootblock.size(), 4096);
-        m_nr_segments++;
-    }
+    for (auto& seg : m_warm ? m_image.segments : imageSegments())
+        addSegment(seg.buf, seg.bufsz, seg.phys, seg.memsz);
 
-    if (m_fontblock.size() > 0) {
-        m_segments[5].buf = m_fontblock.data();
-        m_segments[5].bufsz = m_fontblock.size();
-        m_segments[5].mem = reinterpret_cast<const void*>(m_fontphys);
-        m_segments[5].memsz = roundup(m_fontblock.size(), 4096);
-        m_nr_segments++;
-    }
+    CLayoutPlanner::part parts[] = {
+        {m_metaphys, &m_meta.builder()},
+        {m_envphys, &m_env.builder()},
+    };
+    auto host = CLayoutPlanner::coalesce(parts, m_hostslot, m_hostblock);
+    addSegment(host.buf, host.bufsz, host.phys, host.memsz);
+    phase.addBytes(host.bufsz);
 }
 
 void beastie::Bootloader::writeMetadata()
@@ -439,25 +1269,29 @@ void beastie::Bootloader::writeMetadata()
     m_meta.addName("/boot/kernel/kernel");
     m_meta.addType("elf kernel");
     m_meta.addAddr(m_kernphys);
-    m_meta.addSize(m_kernblock.size());  // XXX may not be accurate
+    m_meta.addSize(m_kernsize);
 
-    /* extended types */
-    assert(m_symphys);
-    assert(m_sym.size());
-    m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_SSYM, uintptr_t(m_symphys));
-    m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_ESYM, uintptr_t(m_symphys + m_sym.size()));
+    /* extended types, no symbols for a stripped kernel, like loader(8) */
+    if (m_symsize) {
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_SSYM, uintptr_t(m_symphys));
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_ESYM, uintptr_t(m_symphys + m_symsize));
+    }
     assert(m_envphys);
     m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_ENVP, uintptr_t(m_envphys));
     m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_HOWTO, m_howto);
     m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_FW_HANDLE, uintptr_t(m_rsdp));
 
+    // packed, as many entries as there are
     if (m_efi == false) {
-        std::span<char> smapSpan((char*)m_smap.e820_table,
-                                 m_smap.e820_entries * sizeof(boot_e820_entry));
+        std::span<char> smapSpan((char*)m_smap.e820_table.data(),
+                                 m_smap.e820_table.size() * sizeof(smapentry));
         m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_SMAP, smapSpan);
     } else {
-        std::span<char> efimapSpan((char*)&m_efimap, sizeof(efimapinfo));
-        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_EFI_MAP, efimapSpan);
+        std::vector<char> efimap(sizeof(efimapheader) + m_efimap.header.memory_size);
+        std::memcpy(efimap.data(), &m_efimap.header, sizeof(efimapheader));
+        std::memcpy(efimap.data() + sizeof(efimapheader), m_efimap.efi_table.data(),
+                    m_efimap.header.memory_size);
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_EFI_MAP, std::span<char>(efimap));
     }
 
     efifbinfo efifb;
@@ -473,7 +1307,19 @@ void beastie::Bootloader::writeMetadata()
     std::span<char> efifbSpan((char*)&efifb, sizeof(efifb));
     m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_EFI_FB, efifbSpan);
 
-    m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_FONT, uintptr_t(m_fontphys));
+    if (m_fontphys)
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_FONT, uintptr_t(m_fontphys));
+
+    for (auto& mod : m_modrecords) {
+        m_meta.addName(mod.name);
+        m_meta.addType(mod.type);
+        m_meta.addAddr(mod.addr);
+        m_meta.addSize(mod.size);
+        if (mod.ehdr.empty())
+            continue;
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_ELFHDR, std::span<char>(mod.ehdr));
+        m_meta.addMetadata(MODINFO_METADATA | MODINFOMD_SHDR, std::span<char>(mod.shdr));
+    }
 
     m_meta.addEnd();
 }
@@ -4,9 +4,20 @@
 #include "cenvironmentwriter.hxx"
 #include "cmetawriter.hxx"
 #include "csymbolswriter.hxx"
+#include "cmappedfile.hxx"
+#include "celfmodule.hxx"
+#include "clinkerhints.hxx"
+#include "cimagecache.hxx"
+#include "cfontblob.hxx"
+#include "cloadpipeline.hxx"
+#include "cmanifest.hxx"
+#include "cloaderconf.hxx"
 using namespace beastie;
 
 #include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
 #include <vector>
 #include <cstdint>
 
@@ -18,6 +29,9 @@ class Bootloader
 {
 public:
     Bootloader();
+
+    // Use the given platform instead of probing the running host
+    Bootloader(const platforminfo& platform);
     ~Bootloader();
 
     // Set debug mode
@@ -29,24 +43,128 @@ public:
     // Set forceful kexec boot (!!)
     void setForce(bool force);
 
+    // Set the symbols left out of the preloaded symbol table (CSymbolsWriter::Filter)
+    void setSymbolFilter(unsigned filter);
+
+    // Keep only these glyphs of the font (CFontBlob::parseSubset)
+    void setFontSubset(std::string_view spec);
+
+    // Set the prepared image cache directory, an empty path disables it
+    void setCache(std::filesystem::path dir);
+
+    // Check the files loaded against the SHA-256 digests in manifest
+    // (CManifest), hashing them as they are read. A mismatch fails
+    // prepare(), the digests are passed on in the kernel env.
+    void setManifest(std::filesystem::path manifest);
+
+    // Pass the variables of root's loader.conf and device.hints on in the
+    // kernel env (CLoaderConf), read now
+    void loaderConfLoad(std::filesystem::path root);
+
+    // Set a kernel env variable from a name=value assignment, overriding
+    // loader.conf
+    void setEnv(std::string_view assignment);
+
     // Load an ELF kernel/module
     void fileLoad(std::filesystem::path path);
 
-    // Load a font file
+    // Load a kernel module and its dependencies by name (after the kernel)
+    void moduleLoad(std::string_view name);
+
+    // Load a font file, or from a directory of fonts the one that
+    // suits the framebuffer (see setConsole)
     void fontLoad(std::filesystem::path path);
 
+    // Set the console size fonts are picked for, in characters
+    void setConsole(unsigned cols, unsigned rows);
+
+    // Preload a memory disk image (md_image), e.g. an mfsroot the
+    // kernel mounts as its root file system
+    void mdrootLoad(std::filesystem::path path);
+
+    // Run the loads above, lay out the image and assemble the boot block.
+    // A cached image with the same inputs skips all of it.
+    void prepare();
+
+    // Boot a prebuilt bundle instead of loading files, prepare() then
+    // only builds the host specific parts
+    void bundleLoad(std::filesystem::path path);
+
+    // Prepare the loaded files and write them as a bundle for other hosts.
+    // The font goes in as is, it must be a file rather than a directory.
+    void bundleCreate(std::filesystem::path path);
+
     // Boot into the new system
     void boot();
 
+    // The kexec segments of the prepared image, as load() hands them to
+    // the kernel, and the address it starts at
+    std::span<const kexec_segment> segments();
+    uintptr_t getEntry();
+
+    // Prepare and load the image now and record it in manifest, the
+    // image stays loaded when this instance goes away
+    void stage(std::filesystem::path manifest);
+
+    // The key stage() records, over the requests: take it before prepare()
+    // to stage the prepared image later with stagePrepared()
+    uint64_t stageKey();
+    void stagePrepared(std::filesystem::path manifest, uint64_t key);
+
+    // The image in manifest is still loaded and is what boot() would load
+    bool isStaged(std::filesystem::path manifest);
+
+    // Reboot into whatever image is loaded
+    static void commit(bool force);
+
     // Set the framebuffer to default resolution
     void setDefaultResolution();
 
 private:
-    void elfLoad(std::vector<char>&& buffer);
-    void elfLoadExec(Elf64_Ehdr hdr, std::vector<char>&& buffer);
-    void elfLoadRel(Elf64_Ehdr hdr, std::vector<char>&& buffer);
-    uintptr_t getEntry();
+    struct request {
+        enum { File, Font, Module, MdImage } kind;
+        std::string arg;
+    };
+
+    // A font picked and converted on the load pipeline
+    struct fontload {
+        std::filesystem::path path;
+        CMappedFile blob;
+        std::optional<CSha256::digest> sha256;  // of the font file, with a manifest
+    };
+
+    void fileLoadNow(std::filesystem::path path);
+    CLoadPipeline::Task<fontload> fontDecode(std::filesystem::path path);
+    void fontLoadNow(CLoadPipeline::Task<fontload> task);
+    std::filesystem::path fontFor(std::filesystem::path path);
+    void prefetchModules(size_t first);
+    void moduleLoadNow(std::string_view name);
+    void mdrootLoadNow(std::filesystem::path path);
+    void addInput(std::filesystem::path path);
+    void addDigest(std::filesystem::path path, const CSha256::digest& sha256);
+    void prepareImage();
+    bool prepareCached();
+    bool adoptImage();
+    void prepareBundle();
+    void assembleBootBlock();
+    void placeHostData();
+    imagelayout saveLayout();
+    void restoreLayout(const imagelayout& l);
+    void storeCached(uint64_t key);
+    uint64_t cacheKey();
+    std::vector<loadsegment> imageSegments();
+    void elfLoad(std::filesystem::path path, CMappedFile&& file);
+    void elfLoadExec(Elf64_Ehdr hdr, std::span<char> buffer);
+    void elfLoadRel(Elf64_Ehdr hdr, std::filesystem::path path, CMappedFile&& file);
+    bool elfMapExec(std::span<Elf64_Phdr> phdr, std::span<char> buffer);
+    void elfCopyExec(std::span<Elf64_Phdr> phdr, std::span<char> buffer);
+    void addSegment(const void* buf, size_t bufsz, uintptr_t phys, size_t memsz);
+    bool isLoaded(std::filesystem::path path);
+    bool isProvided(const moddepend& dep);
+    std::string bootName(std::filesystem::path path);
+    void layoutModules(uintptr_t phys);
     void writeDefaultEnv();
+    void writeEnv();
     void prepareSegments();
     void writeMetadata();
 
@@ -62,13 +180,17 @@ private:
     bool m_efi = false;
     uint32_t m_howto;
     uintptr_t m_btext;
+    CMappedFile m_kernfile;
+    std::vector<loadsegment> m_kernsegs;
     std::vector<char> m_kernblock;
+    size_t m_kernsize;
     std::vector<char> m_bootblock;
     uintptr_t m_metaphys;
     uintptr_t m_kernend;
     fbinfo m_fb;
     uintptr_t m_rsdp;
     uintptr_t m_rsdt;
+    bool m_gbpages;
     kexec_segment m_segments[KEXEC_SEGMENT_MAX];
     unsigned long m_nr_segments;
     CEnvironmentWriter m_env;
@@ -78,11 +200,45 @@ private:
     uintptr_t m_envphys;
     uintptr_t m_bootphys;
     CSymbolsWriter m_sym;
+    unsigned m_symfilter;
     smapinfo m_smap;
     efimapinfo m_efimap;
     bool m_force;
-    std::vector<char> m_fontblock;
+    CMappedFile m_fontblob;
+    std::vector<fontrange> m_fontsubset;
+    unsigned m_cols;
+    unsigned m_rows;
     uintptr_t m_fontphys;
+    CMappedFile m_mdfile;
+    std::string m_mdname;
+    loadsegment m_mdseg;
+    std::filesystem::path m_kernpath;
+    CLinkerHints m_hints;
+    std::vector<CElfModule> m_modules;
+    std::vector<modrecord> m_modrecords;
+    std::vector<std::filesystem::path> m_modfiles;
+    std::vector<modversion> m_provided;
+    std::vector<char> m_modblock;
+    uintptr_t m_modphys;
+    size_t m_symsize;
+    uintptr_t m_hostphys;
+    size_t m_hostslot;
+    loadsegment m_imageseg;
+    std::vector<char> m_imageblock;
+    std::vector<char> m_hostblock;
+    std::vector<request> m_requests;
+    std::vector<fileid> m_inputs;
+    std::optional<CManifest> m_manifest;
+    std::vector<filedigest> m_digests;
+    std::vector<loadervar> m_envvars;
+    CImageCache m_cache;
+    imagecache m_image;
+    bool m_warm;
+    bool m_bundled;
+    size_t m_slack;
+    bool m_loaded;
+    bool m_staged;
+    std::filesystem::path m_bundlepath;
 
 };
 } // namespace beastie
@@ -0,0 +1,177 @@
+#include "cbootbundle.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+
+constexpr static size_t PAGE = 4096;
+
+/*
+ * Documentation for the bundle file format:
+ *
+ * header
+ *   . char[8] magic "BEASTIEB"
+ *   . u32     version
+ *   . u32     pad
+ *   . u64[]   layout (see imagelayout)
+ *   . u32     module count
+ *   . u32     blob count
+ *   . u32     segment count
+ *   . u32     pad
+ *
+ * modules (repeats module count times)
+ *   . u32     name length
+ *   . char[]  name
+ *   . u32     type length
+ *   . char[]  type
+ *   . u64     addr, size
+ *   . u32     ELF header length
+ *   . char[]  ELF header
+ *   . u32     section headers length
+ *   . char[]  section headers
+ *
+ * blobs (repeats blob count times)
+ *   . u64     content hash (hash64)
+ *   . u64     file offset
+ *   . u64     size
+ *
+ * segments (repeats segment count times)
+ *   . u64     phys, memsz
+ *   . u32     blob index
+ *   . u32     pad
+ *
+ * payload
+ *   . char[]  blob bytes, each at a page aligned file offset
+ *
+ * NOTES:
+ *   - Segments with the same content share a blob.
+ *   - The host slot in the layout (env and metadata) already includes
+ *       SLACK, the boot block is not part of the bundle.
+ *   - Everything is stored in little endian (x86-64 only).
+ *   - The bundle may be gzip/zstd/xz compressed as a whole, at the cost
+ *       of decompressing it into memory instead of mapping it.
+ *
+ ****/
+void beastie::CBootBundle::write(std::filesystem::path path, const imagecache& image)
+{
+    // deduplicate the payloads by content
+    struct blobinfo {
+        uint64_t hash;
+        const char* buf;
+        size_t size;
+    };
+    std::vector<blobinfo> blobs;
+    std::vector<uint32_t> segblob;
+    for (auto& seg : image.segments) {
+        uint64_t hash = hash64(std::span<const char>(seg.buf, seg.bufsz));
+        uint32_t index = 0;
+        for (; index < blobs.size(); ++index) {
+            if (blobs[index].hash == hash && blobs[index].size == seg.bufsz &&
+                std::memcmp(blobs[index].buf, seg.buf, seg.bufsz) == 0)
+                break;
+        }
+        if (index == blobs.size())
+            blobs.push_back({hash, seg.buf, seg.bufsz});
+        segblob.push_back(index);
+    }
+
+    CBinaryWriter out;
+    out.bytes(MAGIC, sizeof(MAGIC));
+    out.u32(VERSION);
+    out.u32(0);
+    out.bytes(&image.layout, sizeof(imagelayout));
+    out.u32(image.modules.size());
+    out.u32(blobs.size());
+    out.u32(image.segments.size());
+    out.u32(0);
+
+    for (auto& mod : image.modules) {
+        out.blob(mod.name);
+        out.blob(mod.type);
+        out.u64(mod.addr);
+        out.u64(mod.size);
+        out.blob(mod.ehdr);
+        out.blob(mod.shdr);
+    }
+
+    size_t tables = blobs.size() * 3 * sizeof(uint64_t) + image.segments.size() * 3 * sizeof(uint64_t);
+    size_t offset = howmany(out.size() + tables, PAGE) * PAGE;
+    std::vector<filepart> parts(1);
+    for (auto& b : blobs) {
+        parts.push_back({offset, {b.buf, b.size}});
+        out.u64(b.hash);
+        out.u64(offset);
+        out.u64(b.size);
+        offset += howmany(b.size, PAGE) * PAGE;
+    }
+
+    for (size_t i = 0; i < image.segments.size(); ++i) {
+        out.u64(image.segments[i].phys);
+        out.u64(image.segments[i].memsz);
+        out.u32(segblob[i]);
+        out.u32(0);
+    }
+    parts[0] = {0, out.data()};
+
+    writeAtomic(path, parts);
+}
+
+imagecache beastie::CBootBundle::read(std::filesystem::path path)
+{
+    imagecache image;
+    image.file = zmap(path);
+    auto buffer = image.file.span();
+    CBinaryReader in(buffer, path.string());
+
+    if (std::memcmp(in.bytes(sizeof(MAGIC)).data(), MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(std::format("{}: not a boot bundle", path.string()));
+    uint32_t version = in.u32();
+    if (version != VERSION)
+        throw std::runtime_error(std::format("{}: unsupported bundle version {}", path.string(), version));
+    in.u32();
+
+    std::memcpy(&image.layout, in.bytes(sizeof(imagelayout)).data(), sizeof(imagelayout));
+    uint32_t nmodules = in.u32();
+    uint32_t nblobs = in.u32();
+    uint32_t nsegments = in.u32();
+    in.u32();
+
+    for (uint32_t i = 0; i < nmodules; ++i) {
+        modrecord mod;
+        mod.name = in.string();
+        mod.type = in.string();
+        mod.addr = in.u64();
+        mod.size = in.u64();
+        mod.ehdr = in.blob();
+        mod.shdr = in.blob();
+        image.modules.push_back(std::move(mod));
+    }
+
+    std::vector<std::span<char>> blobs;
+    for (uint32_t i = 0; i < nblobs; ++i) {
+        in.u64();
+        uint64_t offset = in.u64();
+        uint64_t size = in.u64();
+        if (offset > buffer.size() || size > buffer.size() - offset)
+            throw std::runtime_error(std::format("{}: blob {} out of range", path.string(), i));
+        blobs.push_back(buffer.subspan(offset, size));
+    }
+
+    for (uint32_t i = 0; i < nsegments; ++i) {
+        loadsegment seg;
+        seg.phys = in.u64();
+        seg.memsz = in.u64();
+        uint32_t index = in.u32();
+        in.u32();
+        if (index >= blobs.size() || blobs[index].size() > seg.memsz)
+            throw std::runtime_error(std::format("{}: bad segment {}", path.string(), i));
+        seg.buf = blobs[index].data();
+        seg.bufsz = blobs[index].size();
+        image.segments.push_back(seg);
+    }
+
+    return image;
+}
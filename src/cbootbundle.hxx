@@ -0,0 +1,30 @@
+#pragma once
+
+#include "types.hxx"
+#include "cimagecache.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+
+namespace beastie {
+
+// A prepared image built once and booted on other hosts, the boot block,
+// env and metadata are host specific and built at boot time
+class CBootBundle
+{
+public:
+    // Extra room left in the host slot (env and metadata) for the target host
+    constexpr static size_t SLACK = 64 * 1024;
+
+    // Write image (its inputs are ignored) to path
+    static void write(std::filesystem::path path, const imagecache& image);
+
+    // Map a bundle, compressed bundles are decompressed into memory
+    static imagecache read(std::filesystem::path path);
+
+private:
+    constexpr static char MAGIC[8] = {'B', 'E', 'A', 'S', 'T', 'I', 'E', 'B'};
+    constexpr static uint32_t VERSION = 3;
+};
+} // namespace beastie
@@ -0,0 +1,370 @@
+#include "cdaemon.hxx"
+#include "bootloader.hxx"
+#include "constants.hxx"
+#include "cstagemanifest.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void stop(int)
+{
+    s_stop = 1;
+}
+
+static sockaddr_un address(std::filesystem::path path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof(addr.sun_path))
+        throw std::runtime_error(std::format("{}: socket path too long", path.string()));
+    std::strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+beastie::CDaemon::CDaemon(daemonconfig config)
+    : m_config(config)
+    , m_platform()
+    , m_inotify(-1)
+    , m_socket(-1)
+    , m_watches()
+    , m_dirty(false)
+    , m_deadline(0)
+    , m_stages(0)
+    , m_staged(0)
+    , m_error()
+{
+}
+
+beastie::CDaemon::~CDaemon()
+{
+    if (m_socket != -1) {
+        close(m_socket);
+        std::filesystem::remove(m_config.socket);
+    }
+    if (m_inotify != -1)
+        close(m_inotify);
+}
+
+uint64_t beastie::CDaemon::now()
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t).count();
+}
+
+void beastie::CDaemon::run()
+{
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    // stdout is the log, get lines out as they happen
+    std::cout << std::unitbuf;
+
+    m_platform = fetchPlatform();
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify == -1)
+        throw std::runtime_error(std::format("inotify: {}", std::strerror(errno)));
+    listen();
+    watch();
+    restage();
+
+    while (s_stop == 0) {
+        int timeout = -1;
+        if (m_dirty)
+            timeout = m_deadline > now() ? int(m_deadline - now()) : 0;
+
+        pollfd fds[2] = {
+            {m_inotify, POLLIN, 0},
+            {m_socket, POLLIN, 0},
+        };
+        if (poll(fds, 2, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error(std::format("poll: {}", std::strerror(errno)));
+        }
+
+        if (fds[0].revents & POLLIN)
+            drain();
+        if (fds[1].revents & POLLIN)
+            serve();
+
+        if (m_dirty && now() >= m_deadline) {
+            watch();
+            restage();
+        }
+    }
+
+    std::cout << std::format("[DAEMON]   stopping, the staged image stays loaded\n");
+}
+
+void beastie::CDaemon::listen()
+{
+    auto addr = address(m_config.socket);
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_socket == -1)
+        throw std::runtime_error(std::format("socket: {}", std::strerror(errno)));
+
+    // a previous instance that died leaves its socket behind
+    std::error_code ec;
+    std::filesystem::remove(m_config.socket, ec);
+
+    // root only, a connection can reboot the host
+    mode_t mask = umask(0077);
+    int rc = bind(m_socket, (sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (rc == -1 || ::listen(m_socket, 8) == -1)
+        throw std::runtime_error(std::format("{}: {}", m_config.socket.string(), std::strerror(errno)));
+}
+
+/*
+ * (Re)watch the directories the image comes from. FreeBSD's
+ * installkernel renames /boot/kernel to kernel.old and creates a new
+ * one, so the watches are set up again after every change rather
+ * than following the old directory.
+ */
+void beastie::CDaemon::watch()
+{
+    for (auto& [wd, dir] : m_watches)
+        inotify_rm_watch(m_inotify, wd);
+    m_watches.clear();
+
+    constexpr uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                              IN_DELETE_SELF | IN_MOVE_SELF;
+    for (auto dir : {"boot", "boot/kernel", "boot/modules", "boot/fonts", "boot/loader.conf.d"}) {
+        auto path = m_config.root/dir;
+        int wd = inotify_add_watch(m_inotify, path.c_str(), mask | IN_ONLYDIR);
+        if (wd != -1)
+            m_watches[wd] = dir;
+        else if (errno != ENOENT)
+            std::cout << std::format("[DAEMON]   {}: {}\n", path.string(), std::strerror(errno));
+    }
+}
+
+// Only /boot itself has files the image doesn't depend on
+bool beastie::CDaemon::relevant(std::string_view dir, std::string_view name)
+{
+    if (dir != "boot" || name.empty())
+        return true;
+    for (auto file : {"kernel", "modules", "fonts", "loader.conf", "loader.conf.d", "loader.conf.local",
+                      "device.hints"}) {
+        if (name == file)
+            return true;
+    }
+    return false;
+}
+
+void beastie::CDaemon::drain()
+{
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true) {
+        ssize_t len = read(m_inotify, buffer, sizeof(buffer));
+        if (len <= 0)
+            break;
+
+        for (ssize_t pos = 0; pos < len;) {
+            auto ev = (const inotify_event*)(buffer + pos);
+            pos += sizeof(inotify_event) + ev->len;
+
+            auto it = m_watches.find(ev->wd);
+            std::string_view name = ev->len ? std::string_view(ev->name) : std::string_view();
+            if (ev->mask & IN_Q_OVERFLOW) {
+                m_dirty = true;
+                m_deadline = now() + SETTLE_MS;
+                continue;
+            }
+
+            // watch() drops its old watches, their IN_IGNORED lands here too
+            if (it == m_watches.end())
+                continue;
+            bool lost = ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF);
+            if (lost == false && relevant(it->second.string(), name) == false)
+                continue;
+
+            if (m_config.debug)
+                std::cout << std::format("[DAEMON]   {}/{} changed\n", it->second.string(), name);
+            m_dirty = true;
+            m_deadline = now() + SETTLE_MS;
+        }
+    }
+}
+
+void beastie::CDaemon::configure(Bootloader& loader)
+{
+    loader.setDebug(m_config.debug);
+    loader.setHowto(m_config.howto);
+    loader.setForce(m_config.force);
+    loader.setSymbolFilter(m_config.symfilter);
+    loader.setFontSubset(m_config.fontsubset);
+    loader.setConsole(m_config.cols, m_config.rows);
+    if (m_config.cache)
+        loader.setCache(beastie::cachedir);
+    if (m_config.verify.empty() == false)
+        loader.setManifest(m_config.verify);
+
+    loader.loaderConfLoad(m_config.root);
+    loader.fontLoad(m_config.font.empty() ? m_config.root/"boot/fonts" : m_config.font);
+    loader.fileLoad(m_config.root/"boot/kernel/kernel");
+    for (auto& module : m_config.modules)
+        loader.moduleLoad(module);
+    if (m_config.mdroot.empty() == false)
+        loader.mdrootLoad(m_config.mdroot);
+    for (auto& assignment : m_config.env)
+        loader.setEnv(assignment);
+}
+
+/*
+ * A fresh Bootloader on the platform probed at startup. What didn't
+ * change comes from the image cache, an image that is still the one
+ * staged isn't loaded again. A failed stage keeps the previous image
+ * (if any) and is reported by status.
+ */
+void beastie::CDaemon::restage()
+{
+    m_dirty = false;
+    try {
+        Bootloader loader(m_platform);
+        configure(loader);
+        if (loader.isStaged(m_config.manifest)) {
+            m_error.clear();
+            return;
+        }
+
+        loader.stage(m_config.manifest);
+        m_stages++;
+        m_staged = time(nullptr);
+        m_error.clear();
+        std::cout << std::format("[DAEMON]   staged {}\n", m_config.root.string());
+    } catch (const std::exception& e) {
+        m_error = e.what();
+        std::cout << std::format("[DAEMON]   staging failed: {}\n", m_error);
+    }
+}
+
+std::string beastie::CDaemon::status()
+{
+    auto staged = CStageManifest::read(m_config.manifest);
+    bool valid = staged.has_value() && CStageManifest::valid(*staged);
+
+    std::string out = std::format("root {}\n", m_config.root.string());
+    out += std::format("staged {}\n", valid ? "yes" : "no");
+    if (staged.has_value())
+        out += std::format("key {:016x}\n", staged->key);
+    out += std::format("stages {}\n", m_stages);
+    if (m_staged)
+        out += std::format("age {}\n", time(nullptr) - m_staged);
+    if (m_dirty)
+        out += "pending yes\n";
+    if (m_error.empty() == false)
+        out += std::format("error {}\n", m_error);
+    return out;
+}
+
+std::string beastie::CDaemon::handle(std::string_view command, bool& boot)
+{
+    boot = false;
+
+    if (command == "status")
+        return status();
+
+    if (command == "reload") {
+        // a failed probe keeps the platform and the image staged on it
+        try {
+            platforminfo platform = fetchPlatform();
+            m_platform = std::move(platform);
+        } catch (const std::exception& e) {
+            m_error = std::format("platform probe failed: {}", e.what());
+            std::cout << std::format("[DAEMON]   {}\n", m_error);
+            return status();
+        }
+        watch();
+        restage();
+        return status();
+    }
+
+    if (command == "boot") {
+        // don't reboot into an image older than the files on disk
+        if (m_dirty)
+            restage();
+        auto staged = CStageManifest::read(m_config.manifest);
+        if (staged.has_value() == false || CStageManifest::valid(*staged) == false)
+            return std::format("error nothing staged{}{}\n", m_error.empty() ? "" : ": ", m_error);
+        boot = m_config.pretend == false;
+        return boot ? "ok\n" : "ok pretend\n";
+    }
+
+    return std::format("error unknown command '{}'\n", command);
+}
+
+void beastie::CDaemon::serve()
+{
+    int client = accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1)
+        return;
+
+    // a client that never sends must not stall the daemon
+    timeval tv = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char buffer[256];
+    ssize_t len = recv(client, buffer, sizeof(buffer) - 1, 0);
+    std::string_view command(buffer, len > 0 ? len : 0);
+    while (command.empty() == false && std::isspace((unsigned char)command.back()))
+        command.remove_suffix(1);
+
+    bool boot = false;
+    std::string reply = handle(command, boot);
+    ::send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+    close(client);
+
+    if (boot) {
+        std::cout << std::format("[DAEMON]   rebooting into the staged image\n");
+        Bootloader::commit(m_config.force);
+    }
+}
+
+std::string beastie::CDaemon::send(std::filesystem::path socket, std::string_view command)
+{
+    auto addr = address(socket);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw std::runtime_error(std::format("socket: {}", std::strerror(errno)));
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(std::format("{}: {}", socket.string(), std::strerror(err)));
+    }
+
+    std::string line = std::format("{}\n", command);
+    ::send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+    ::shutdown(fd, SHUT_WR);
+
+    std::string reply;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        reply.append(buffer, len);
+    close(fd);
+    return reply;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+class Bootloader;
+
+// What the daemon stages, the same as the command line would
+struct daemonconfig {
+    std::filesystem::path root;
+    std::vector<std::string> modules;
+    std::vector<std::string> env;   // name=value, over loader.conf
+    std::filesystem::path font;     // empty to pick from boot/fonts
+    std::string fontsubset;
+    std::filesystem::path mdroot;
+    std::filesystem::path verify;   // SHA-256 manifest, empty for none
+    unsigned cols;
+    unsigned rows;
+    std::filesystem::path socket;
+    std::filesystem::path manifest;
+    uint32_t howto;
+    unsigned symfilter;
+    bool force;
+    bool debug;
+    bool pretend;
+    bool cache;
+};
+
+// Keeps an image of root staged: the platform is probed once, the boot
+// files are watched with inotify and staged again when they change.
+// Commands (boot, status, reload) come in over a unix socket, one per
+// connection, answered in text.
+class CDaemon
+{
+public:
+    CDaemon(daemonconfig config);
+    CDaemon(const CDaemon&) = delete;
+    CDaemon& operator=(const CDaemon&) = delete;
+    ~CDaemon();
+
+    // Serve until SIGTERM or SIGINT
+    void run();
+
+    // Client side: send a command to a running daemon, return its answer
+    static std::string send(std::filesystem::path socket, std::string_view command);
+
+private:
+    // installs write several files in a row, stage once they settle
+    constexpr static int SETTLE_MS = 500;
+
+    daemonconfig m_config;
+    platforminfo m_platform;
+    int m_inotify;
+    int m_socket;
+    std::map<int,std::filesystem::path> m_watches;
+    bool m_dirty;
+    uint64_t m_deadline;
+    unsigned m_stages;
+    time_t m_staged;
+    std::string m_error;
+
+    void listen();
+    void watch();
+    void drain();
+    void serve();
+    void restage();
+    void configure(Bootloader& loader);
+    std::string handle(std::string_view command, bool& boot);
+    std::string status();
+    static bool relevant(std::string_view dir, std::string_view name);
+    static uint64_t now();
+};
+} // namespace beastie
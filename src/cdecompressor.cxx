@@ -0,0 +1,286 @@
+#include "cdecompressor.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <endian.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+// zlib counts in uInt, keep every call below that
+constexpr static size_t CHUNK_MAX = 1 << 30;
+constexpr static size_t PAGE = 4096;
+
+beastie::CDecompressor::CDecompressor(std::span<char> input, std::string name)
+    : m_input(input)
+    , m_name(std::move(name))
+    , m_format(detect(input))
+    , m_consumed(0)
+    , m_finished(false)
+    , m_stream(nullptr)
+{
+    init();
+}
+
+beastie::CDecompressor::~CDecompressor()
+{
+    switch (m_format) {
+    case Format::Gzip:
+        inflateEnd(static_cast<z_stream*>(m_stream));
+        delete static_cast<z_stream*>(m_stream);
+        break;
+    case Format::Zstd:
+#ifdef HAVE_ZSTD
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(m_stream));
+#endif
+        break;
+    case Format::Xz:
+#ifdef HAVE_LZMA
+        lzma_end(static_cast<lzma_stream*>(m_stream));
+        delete static_cast<lzma_stream*>(m_stream);
+#endif
+        break;
+    case Format::None:
+        break;
+    }
+}
+
+CDecompressor::Format beastie::CDecompressor::detect(std::span<const char> input)
+{
+    auto magic = [&input](std::initializer_list<uint8_t> bytes) {
+        if (input.size() < bytes.size())
+            return false;
+        return std::equal(bytes.begin(), bytes.end(), input.begin(),
+                          [](uint8_t a, char b) { return a == uint8_t(b); });
+    };
+
+    if (magic({0x1f, 0x8b}))
+        return Format::Gzip;
+    if (magic({0x28, 0xb5, 0x2f, 0xfd}))
+        return Format::Zstd;
+    if (magic({0xfd, '7', 'z', 'X', 'Z', 0x00}))
+        return Format::Xz;
+    return Format::None;
+}
+
+void beastie::CDecompressor::init()
+{
+    switch (m_format) {
+    case Format::Gzip: {
+        auto z = new z_stream();
+        // 16 + MAX_WBITS: expect a gzip wrapper, zlib checks CRC32 and ISIZE
+        if (inflateInit2(z, 16 + MAX_WBITS) != Z_OK) {
+            delete z;
+            fail("cannot initialize zlib");
+        }
+        m_stream = z;
+        break;
+    }
+    case Format::Zstd:
+#ifdef HAVE_ZSTD
+        m_stream = ZSTD_createDStream();
+        if (m_stream == nullptr)
+            fail("cannot initialize zstd");
+        break;
+#else
+        fail("zstd support was not compiled in");
+#endif
+    case Format::Xz: {
+#ifdef HAVE_LZMA
+        auto s = new lzma_stream(LZMA_STREAM_INIT);
+        if (lzma_stream_decoder(s, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+            delete s;
+            fail("cannot initialize liblzma");
+        }
+        m_stream = s;
+        break;
+#else
+        fail("xz support was not compiled in");
+#endif
+    }
+    case Format::None:
+        break;
+    }
+}
+
+size_t beastie::CDecompressor::sizeHint()
+{
+    switch (m_format) {
+    case Format::Gzip: {
+        // ISIZE trailer: size modulo 2^32 of the last member
+        if (m_input.size() < 18)
+            return 0;
+        uint32_t isize;
+        std::memcpy(&isize, m_input.data() + m_input.size() - 4, sizeof(isize));
+        return le32toh(isize);
+    }
+    case Format::Zstd: {
+#ifdef HAVE_ZSTD
+        auto size = ZSTD_getFrameContentSize(m_input.data(), m_input.size());
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+            return 0;
+        return size;
+#else
+        return 0;
+#endif
+    }
+    case Format::Xz:
+        return 0;
+    case Format::None:
+        return m_input.size();
+    }
+    return 0;
+}
+
+size_t beastie::CDecompressor::read(std::span<char> out)
+{
+    if (m_finished || out.empty())
+        return 0;
+
+    switch (m_format) {
+    case Format::Gzip:
+        return readGzip(out);
+    case Format::Zstd:
+        return readZstd(out);
+    case Format::Xz:
+        return readXz(out);
+    case Format::None: {
+        size_t n = std::min(out.size(), m_input.size() - m_consumed);
+        std::memcpy(out.data(), m_input.data() + m_consumed, n);
+        m_consumed += n;
+        m_finished = (m_consumed == m_input.size());
+        return n;
+    }
+    }
+    return 0;
+}
+
+size_t beastie::CDecompressor::readGzip(std::span<char> out)
+{
+    auto z = static_cast<z_stream*>(m_stream);
+    size_t written = 0;
+
+    while (written < out.size() && m_finished == false) {
+        size_t inLeft = m_input.size() - m_consumed;
+        z->next_in = reinterpret_cast<Bytef*>(m_input.data() + m_consumed);
+        z->avail_in = std::min(inLeft, CHUNK_MAX);
+        z->next_out = reinterpret_cast<Bytef*>(out.data() + written);
+        z->avail_out = std::min(out.size() - written, CHUNK_MAX);
+
+        uInt availIn = z->avail_in;
+        uInt availOut = z->avail_out;
+        int ret = inflate(z, Z_NO_FLUSH);
+        m_consumed += availIn - z->avail_in;
+        written += availOut - z->avail_out;
+
+        if (ret == Z_STREAM_END) {
+            // gzip members may be concatenated, anything else is padding
+            auto rest = m_input.subspan(m_consumed);
+            if (detect(rest) == Format::Gzip) {
+                inflateReset(z);
+                continue;
+            }
+            m_finished = true;
+        } else if (ret == Z_BUF_ERROR && inLeft == 0) {
+            fail("unexpected end of stream");
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fail(z->msg ? z->msg : "inflate failed");
+        }
+    }
+    return written;
+}
+
+size_t beastie::CDecompressor::readZstd(std::span<char> out)
+{
+#ifdef HAVE_ZSTD
+    auto ds = static_cast<ZSTD_DStream*>(m_stream);
+    ZSTD_inBuffer in = { m_input.data() + m_consumed, m_input.size() - m_consumed, 0 };
+    ZSTD_outBuffer o = { out.data(), out.size(), 0 };
+
+    while (o.pos < o.size && m_finished == false) {
+        size_t ret = ZSTD_decompressStream(ds, &o, &in);
+        if (ZSTD_isError(ret))
+            fail(ZSTD_getErrorName(ret));
+
+        if (ret == 0 && in.pos == in.size)
+            m_finished = true;
+        else if (ret != 0 && in.pos == in.size && o.pos < o.size)
+            fail("unexpected end of stream");
+    }
+    m_consumed += in.pos;
+    return o.pos;
+#else
+    fail("zstd support was not compiled in");
+#endif
+}
+
+size_t beastie::CDecompressor::readXz(std::span<char> out)
+{
+#ifdef HAVE_LZMA
+    auto s = static_cast<lzma_stream*>(m_stream);
+    s->next_in = reinterpret_cast<const uint8_t*>(m_input.data() + m_consumed);
+    s->avail_in = m_input.size() - m_consumed;
+    s->next_out = reinterpret_cast<uint8_t*>(out.data());
+    s->avail_out = out.size();
+
+    // the whole input is in memory, so the decoder may always finish
+    lzma_ret ret = lzma_code(s, LZMA_FINISH);
+    m_consumed = m_input.size() - s->avail_in;
+    size_t written = out.size() - s->avail_out;
+
+    if (ret == LZMA_STREAM_END)
+        m_finished = true;
+    else if (ret != LZMA_OK)
+        fail(std::format("liblzma error {}", int(ret)));
+    return written;
+#else
+    fail("xz support was not compiled in");
+#endif
+}
+
+CMappedFile beastie::CDecompressor::readAll(CSha256* input)
+{
+    // one spare page lets the decoder consume the trailer without a regrow
+    size_t hint = sizeHint();
+    size_t capacity = hint ? hint + PAGE : std::max(m_input.size() * 4, size_t(1 << 20));
+    size_t used = 0;
+    size_t hashed = 0;
+
+    // when hashing, in steps small enough that the input is still cached
+    size_t step = input ? HASH_STEP : capacity;
+
+    auto buffer = CMappedFile::anonymous(capacity);
+    while (m_finished == false) {
+        if (used == capacity) {
+            capacity *= 2;
+            buffer.resize(capacity);
+        }
+        used += read(std::span<char>(buffer.data() + used, std::min(capacity - used, step)));
+        if (input) {
+            input->update(m_input.subspan(hashed, m_consumed - hashed));
+            hashed = m_consumed;
+        }
+    }
+    buffer.resize(used);
+
+    // anything after the stream is part of the file too
+    if (input)
+        input->update(m_input.subspan(hashed));
+    return buffer;
+}
+
+void beastie::CDecompressor::fail(std::string_view what)
+{
+    if (m_name.empty())
+        throw std::runtime_error(std::string(what));
+    throw std::runtime_error(std::format("{}: {}", m_name, what));
+}
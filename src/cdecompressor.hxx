@@ -0,0 +1,66 @@
+#pragma once
+
+#include "cmappedfile.hxx"
+#include "csha256.hxx"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+namespace beastie {
+class CDecompressor
+{
+public:
+    enum class Format {
+        None,
+        Gzip,
+        Zstd,
+        Xz,
+    };
+
+    CDecompressor(std::span<char> input, std::string name = "");
+    ~CDecompressor();
+    CDecompressor(const CDecompressor&) = delete;
+    CDecompressor& operator=(const CDecompressor&) = delete;
+
+    // Guess the format of a buffer from its magic bytes
+    static Format detect(std::span<const char> input);
+
+    auto format() {
+        return m_format;
+    }
+
+    // Decompressed size announced by the container, 0 if unknown
+    size_t sizeHint();
+
+    // Decompress the next chunk into out, returns the bytes written.
+    // Returns 0 once the stream is finished.
+    size_t read(std::span<char> out);
+
+    // Decompress the whole stream into anonymous memory, sized up front
+    // from sizeHint() and grown only if the hint was short. The input is
+    // fed to input as it is consumed, when given.
+    CMappedFile readAll(CSha256* input = nullptr);
+
+    bool finished() {
+        return m_finished;
+    }
+
+private:
+    constexpr static size_t HASH_STEP = 1 << 20;
+
+    std::span<char> m_input;
+    std::string m_name;
+    Format m_format;
+    size_t m_consumed;
+    bool m_finished;
+    void* m_stream;
+
+    void init();
+    size_t readGzip(std::span<char> out);
+    size_t readZstd(std::span<char> out);
+    size_t readXz(std::span<char> out);
+    [[noreturn]] void fail(std::string_view what);
+};
+} // namespace beastie
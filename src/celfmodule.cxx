@@ -0,0 +1,250 @@
+#include "celfmodule.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include <elf.h>
+
+beastie::CElfModule::CElfModule(std::string name, CMappedFile&& file)
+    : m_name(std::move(name))
+    , m_file(std::move(file))
+    , m_ehdr()
+    , m_shdr()
+    , m_offsets()
+    , m_provides()
+    , m_depends()
+    , m_size(0)
+{
+    auto buffer = m_file.span();
+    if (buffer.size() < sizeof(m_ehdr))
+        throw std::runtime_error(std::format("{}: ELF header truncated", m_name));
+    std::memcpy(&m_ehdr, buffer.data(), sizeof(m_ehdr));
+
+    if (m_ehdr.e_type != ET_REL || m_ehdr.e_shentsize != sizeof(Elf64_Shdr))
+        throw std::runtime_error(std::format("{}: not a kernel module", m_name));
+
+    size_t shbytes = m_ehdr.e_shnum * sizeof(Elf64_Shdr);
+    if (m_ehdr.e_shoff > buffer.size() || shbytes > buffer.size() - m_ehdr.e_shoff)
+        throw std::runtime_error(std::format("{}: section headers truncated", m_name));
+
+    m_shdr.resize(m_ehdr.e_shnum);
+    std::memcpy(m_shdr.data(), buffer.data() + m_ehdr.e_shoff, shbytes);
+    m_offsets.assign(m_shdr.size(), SIZE_MAX);
+
+    for (auto& sh : m_shdr) {
+        if (sh.sh_type != SHT_NOBITS &&
+            (sh.sh_offset > buffer.size() || sh.sh_size > buffer.size() - sh.sh_offset))
+            throw std::runtime_error(std::format("{}: section truncated", m_name));
+    }
+
+    parseMetadata();
+}
+
+std::span<char> beastie::CElfModule::section(unsigned index)
+{
+    if (index >= m_shdr.size() || m_shdr[index].sh_type == SHT_NOBITS)
+        return {};
+    return m_file.span().subspan(m_shdr[index].sh_offset, m_shdr[index].sh_size);
+}
+
+std::string_view beastie::CElfModule::sectionName(unsigned index)
+{
+    auto names = section(m_ehdr.e_shstrndx);
+    size_t off = m_shdr[index].sh_name;
+    if (off >= names.size())
+        return {};
+    return std::string_view(names.data() + off, strnlen(names.data() + off, names.size() - off));
+}
+
+/*
+ * Same order as the FreeBSD loader (load_elf_obj.c), the kernel linker
+ * expects it when it relocates the preloaded module:
+ *
+ *   1. allocated PROGBITS/NOBITS/UNWIND/INIT_ARRAY/FINI_ARRAY sections
+ *   2. the symbol table and its string table
+ *   3. the section name table
+ *   4. relocations that apply to allocated sections
+ *
+ ****/
+size_t beastie::CElfModule::layout(uintptr_t addr)
+{
+    size_t off = 0;
+    std::fill(m_offsets.begin(), m_offsets.end(), SIZE_MAX);
+
+    auto place = [&](unsigned i) {
+        Elf64_Xword align = std::max<Elf64_Xword>(m_shdr[i].sh_addralign, 1);
+        off = howmany(off, align) * align;
+        m_offsets[i] = off;
+        m_shdr[i].sh_addr = addr + off;
+        off += m_shdr[i].sh_size;
+    };
+
+    for (unsigned i = 0; i < m_shdr.size(); ++i) {
+        switch (m_shdr[i].sh_type) {
+        case SHT_PROGBITS:
+        case SHT_NOBITS:
+        case SHT_X86_64_UNWIND:
+        case SHT_INIT_ARRAY:
+        case SHT_FINI_ARRAY:
+            if (m_shdr[i].sh_flags & SHF_ALLOC)
+                place(i);
+            break;
+        }
+    }
+
+    for (unsigned i = 0; i < m_shdr.size(); ++i) {
+        if (m_shdr[i].sh_type != SHT_SYMTAB)
+            continue;
+        place(i);
+        if (m_shdr[i].sh_link < m_shdr.size())
+            place(m_shdr[i].sh_link);
+        break;
+    }
+
+    if (m_ehdr.e_shstrndx != SHN_UNDEF && m_ehdr.e_shstrndx < m_shdr.size())
+        place(m_ehdr.e_shstrndx);
+
+    for (unsigned i = 0; i < m_shdr.size(); ++i) {
+        if (m_shdr[i].sh_type != SHT_REL && m_shdr[i].sh_type != SHT_RELA)
+            continue;
+        if (m_shdr[i].sh_info >= m_shdr.size() ||
+            (m_shdr[m_shdr[i].sh_info].sh_flags & SHF_ALLOC) == 0)
+            continue;
+        place(i);
+    }
+
+    m_size = off;
+    return m_size;
+}
+
+void beastie::CElfModule::copy(std::span<char> dst)
+{
+    assert(dst.size() >= m_size);
+    std::memset(dst.data(), 0, m_size);
+
+    for (unsigned i = 0; i < m_shdr.size(); ++i) {
+        if (m_offsets[i] == SIZE_MAX)
+            continue;
+        auto src = section(i);
+        std::memcpy(dst.data() + m_offsets[i], src.data(), src.size());
+    }
+}
+
+/*
+ * Module metadata lives in the set_modmetadata_set linker set, an array
+ * of pointers to
+ *
+ *   struct mod_metadata {
+ *       int          md_version;
+ *       int          md_type;      // MDT_*
+ *       const void  *md_data;      // mod_depend or mod_version
+ *       const char  *md_cval;      // module name
+ *   };
+ *
+ * In a relocatable object every pointer is zero and described by an
+ * R_X86_64_64 relocation instead, so follow those.
+ *
+ ****/
+void beastie::CElfModule::parseMetadata()
+{
+    unsigned setindex = 0;
+    unsigned symindex = 0;
+
+    for (unsigned i = 0; i < m_shdr.size(); ++i) {
+        if (sectionName(i) == "set_modmetadata_set")
+            setindex = i;
+        if (m_shdr[i].sh_type == SHT_SYMTAB && symindex == 0)
+            symindex = i;
+    }
+    if (setindex == 0 || symindex == 0)
+        return;
+
+    auto symtab = section(symindex);
+    size_t nsyms = symtab.size() / sizeof(Elf64_Sym);
+
+    // relocations of a section, indexed by offset, built on first use
+    std::unordered_map<unsigned, std::unordered_map<uint64_t, Elf64_Rela>> relocs;
+    auto relocsOf = [&](unsigned target) -> auto& {
+        auto [it, fresh] = relocs.try_emplace(target);
+        if (fresh) {
+            for (unsigned i = 0; i < m_shdr.size(); ++i) {
+                if (m_shdr[i].sh_type != SHT_RELA || m_shdr[i].sh_info != target)
+                    continue;
+                auto data = section(i);
+                for (size_t r = 0; r + sizeof(Elf64_Rela) <= data.size(); r += sizeof(Elf64_Rela)) {
+                    Elf64_Rela rela;
+                    std::memcpy(&rela, data.data() + r, sizeof(rela));
+                    it->second[rela.r_offset] = rela;
+                }
+            }
+        }
+        return it->second;
+    };
+
+    using location = std::pair<unsigned, uint64_t>;
+    auto pointer = [&](location at) -> std::optional<location> {
+        auto& map = relocsOf(at.first);
+        auto it = map.find(at.second);
+        if (it == map.end() || ELF64_R_TYPE(it->second.r_info) != R_X86_64_64)
+            return std::nullopt;
+
+        size_t symidx = ELF64_R_SYM(it->second.r_info);
+        if (symidx >= nsyms)
+            return std::nullopt;
+
+        Elf64_Sym sym;
+        std::memcpy(&sym, symtab.data() + symidx * sizeof(sym), sizeof(sym));
+        if (sym.st_shndx == SHN_UNDEF || sym.st_shndx >= m_shdr.size())
+            return std::nullopt;
+        return location(sym.st_shndx, sym.st_value + it->second.r_addend);
+    };
+    auto integer = [&](location at) -> std::optional<int> {
+        auto data = section(at.first);
+        if (data.size() < sizeof(int) || at.second > data.size() - sizeof(int))
+            return std::nullopt;
+        int v;
+        std::memcpy(&v, data.data() + at.second, sizeof(v));
+        return v;
+    };
+    auto string = [&](std::optional<location> at) -> std::string {
+        if (at.has_value() == false)
+            return {};
+        auto data = section(at->first);
+        if (at->second >= data.size())
+            return {};
+        return std::string(data.data() + at->second,
+                           strnlen(data.data() + at->second, data.size() - at->second));
+    };
+
+    size_t count = m_shdr[setindex].sh_size / sizeof(uint64_t);
+    for (size_t i = 0; i < count; ++i) {
+        auto md = pointer({setindex, i * sizeof(uint64_t)});
+        if (md.has_value() == false)
+            continue;
+
+        auto type = integer({md->first, md->second + 4});
+        auto data = pointer({md->first, md->second + 8});
+        auto name = string(pointer({md->first, md->second + 16}));
+        if (type.has_value() == false || data.has_value() == false || name.empty())
+            continue;
+
+        if (*type == MDT_DEPEND) {
+            auto minimum = integer({data->first, data->second + 0});
+            auto preferred = integer({data->first, data->second + 4});
+            auto maximum = integer({data->first, data->second + 8});
+            if (minimum && preferred && maximum)
+                m_depends.push_back({name, *minimum, *preferred, *maximum});
+        } else if (*type == MDT_VERSION) {
+            auto version = integer(*data);
+            if (version)
+                m_provides.push_back({name, *version});
+        }
+    }
+}
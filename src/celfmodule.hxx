@@ -0,0 +1,73 @@
+#pragma once
+
+#include "types.hxx"
+#include "cmappedfile.hxx"
+using namespace beastie;
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <elf.h>
+
+namespace beastie {
+class CElfModule
+{
+public:
+    CElfModule(std::string name, CMappedFile&& file);
+
+    auto& name() {
+        return m_name;
+    }
+
+    // MODULE_VERSION() entries of this file
+    auto& provides() {
+        return m_provides;
+    }
+
+    // MODULE_DEPEND() entries of this file
+    auto& depends() {
+        return m_depends;
+    }
+
+    // Assign section addresses starting at addr, returns the image size
+    size_t layout(uintptr_t addr);
+
+    auto size() {
+        return m_size;
+    }
+
+    // Write the laid out image (size() bytes) into dst
+    void copy(std::span<char> dst);
+
+    // Raw headers for the preload metadata
+    std::span<char> ehdr() {
+        return std::span<char>((char*)&m_ehdr, sizeof(m_ehdr));
+    }
+    std::span<char> shdr() {
+        return std::span<char>((char*)m_shdr.data(), m_shdr.size() * sizeof(Elf64_Shdr));
+    }
+
+private:
+    constexpr static int MDT_DEPEND  = 1;
+    constexpr static int MDT_MODULE  = 2;
+    constexpr static int MDT_VERSION = 3;
+
+    std::string m_name;
+    CMappedFile m_file;
+    Elf64_Ehdr m_ehdr;
+    std::vector<Elf64_Shdr> m_shdr;
+    std::vector<size_t> m_offsets;
+    std::vector<modversion> m_provides;
+    std::vector<moddepend> m_depends;
+    size_t m_size;
+
+    std::span<char> section(unsigned index);
+    std::string_view sectionName(unsigned index);
+    void parseMetadata();
+};
+} // namespace beastie
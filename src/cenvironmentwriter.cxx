@@ -4,35 +4,74 @@
 
 beastie::CEnvironmentWriter::CEnvironmentWriter()
     : m_buffer()
+    , m_vars()
+    , m_index()
+    , m_dirty(true)
 {
     m_buffer.reserve(4096);
-    clear();
 }
 
 void beastie::CEnvironmentWriter::clear()
 {
-    m_buffer.clear();
-    m_count = 0;
+    m_vars.clear();
+    m_index.clear();
+    m_dirty = true;
+}
 
-    // keep the buffer double-terminated
-    m_buffer.push_back(0);
-    m_buffer.push_back(0);
+void beastie::CEnvironmentWriter::set(std::string_view name, std::string_view value)
+{
+    auto [it, added] = m_index.try_emplace(std::string(name), m_vars.size());
+    if (added)
+        m_vars.push_back({std::string(name), std::string(value)});
+    else
+        m_vars[it->second].value = value;
+    m_dirty = true;
 }
 
-void beastie::CEnvironmentWriter::push(std::string_view str)
+const std::string* beastie::CEnvironmentWriter::get(std::string_view name)
 {
-    size_t size = (str.size() + 1);
-    m_buffer.resize(m_buffer.size() + size);
-    std::memcpy(m_buffer.end().base() - size - 2, str.data(), size);
+    auto it = m_index.find(std::string(name));
+    if (it == m_index.end())
+        return nullptr;
+    return &m_vars[it->second].value;
 }
 
 void beastie::CEnvironmentWriter::addString(std::string_view str)
 {
-    push(str);
-    this->m_count ++;
+    auto eq = str.find('=');
+    if (eq == std::string_view::npos)
+        set(str, "");
+    else
+        set(str.substr(0, eq), str.substr(eq + 1));
 }
 
 void beastie::CEnvironmentWriter::operator+=(std::string_view str)
 {
     addString(str);
 }
+
+// Every string NUL terminated and the whole double-terminated
+void beastie::CEnvironmentWriter::serialize()
+{
+    size_t total = 2;
+    for (auto& v : m_vars)
+        total += v.name.size() + v.value.size() + 2;
+
+    m_buffer.clear();
+    m_buffer.reserve(total);
+    for (auto& v : m_vars) {
+        m_buffer.append(std::span<const char>(v.name.data(), v.name.size()));
+        m_buffer.append('=');
+        m_buffer.append(std::span<const char>(v.value.data(), v.value.size()));
+        m_buffer.fill(1);
+    }
+    m_buffer.fill(2);
+    m_dirty = false;
+}
+
+beastie::CSegmentBuilder& beastie::CEnvironmentWriter::builder()
+{
+    if (m_dirty)
+        serialize();
+    return m_buffer;
+}
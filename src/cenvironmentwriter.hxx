@@ -1,9 +1,18 @@
 #pragma once
 
+#include "csegmentbuilder.hxx"
+
+#include <cstddef>
+#include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace beastie {
+
+// The kernel's static environment: name=value strings, each name once
+// (the last value set wins, in the place of the first). Serialized when
+// it is asked for after a change, not on every set.
 class CEnvironmentWriter
 {
 public:
@@ -11,21 +20,35 @@ public:
 
     void clear();
     auto data() {
-        return m_buffer.data();
+        return builder().data();
     }
     auto size() {
-        return m_buffer.size();
+        return builder().size();
     }
+    CSegmentBuilder& builder();
+
+    // Set name to value, replacing what it was
+    void set(std::string_view name, std::string_view value);
+
+    // The value of name, nullptr when it isn't set
+    const std::string* get(std::string_view name);
 
+    // A "name=value" string
     void addString(std::string_view);
     void operator+=(std::string_view);
 
 private:
-    std::vector<char> m_buffer;
-    int m_count;
+    struct variable {
+        std::string name;
+        std::string value;
+    };
 
+    CSegmentBuilder m_buffer;
+    std::vector<variable> m_vars;
+    std::unordered_map<std::string, size_t> m_index;
+    bool m_dirty;
 
 private:
-    void push(std::string_view);
+    void serialize();
 };
 } // namespace beastie
@@ -0,0 +1,352 @@
+#include "cfilereader.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+// Closes a descriptor on the way out
+struct fdguard {
+    int fd;
+    ~fdguard() {
+        if (fd != -1)
+            close(fd);
+    }
+};
+
+std::runtime_error failure(const std::filesystem::path& path, int err)
+{
+    return std::runtime_error(std::format("{}: {}", path.string(), std::strerror(err)));
+}
+} // namespace
+
+beastie::CFileReader::CFileReader()
+    : m_ring(-1)
+    , m_ringmem(MAP_FAILED)
+    , m_ringsize(0)
+    , m_sqes(nullptr)
+    , m_sqesize(0)
+    , m_sqhead(nullptr)
+    , m_sqtail(nullptr)
+    , m_sqmask(nullptr)
+    , m_sqarray(nullptr)
+    , m_cqhead(nullptr)
+    , m_cqtail(nullptr)
+    , m_cqmask(nullptr)
+    , m_cqes(nullptr)
+{
+    setup();
+}
+
+beastie::CFileReader::~CFileReader()
+{
+    disableUring();
+}
+
+beastie::CFileReader& beastie::CFileReader::instance()
+{
+    static thread_local CFileReader reader;
+    return reader;
+}
+
+/*
+ * The rings without liburing: the submission and completion rings share
+ * one mapping (IORING_FEAT_SINGLE_MMAP, 5.4), the entries are another.
+ * IORING_FEAT_RW_CUR_POS came with 5.6 like IORING_OP_READ, which makes
+ * it a cheap check for the opcode.
+ */
+void beastie::CFileReader::setup()
+{
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, ENTRIES, &p);
+    if (fd == -1)
+        return;
+
+    constexpr uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+    if ((p.features & needed) != needed || p.sq_entries < ENTRIES || p.cq_entries < ENTRIES) {
+        close(fd);
+        return;
+    }
+
+    m_ringsize = std::max(p.sq_off.array + p.sq_entries * sizeof(uint32_t),
+                          p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    m_ringmem = mmap(nullptr, m_ringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    m_sqesize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (m_ringmem == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, m_sqesize);
+        m_ring = fd;
+        disableUring();
+        return;
+    }
+
+    auto ring = static_cast<char*>(m_ringmem);
+    m_ring = fd;
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+    m_sqhead = (uint32_t*)(ring + p.sq_off.head);
+    m_sqtail = (uint32_t*)(ring + p.sq_off.tail);
+    m_sqmask = (uint32_t*)(ring + p.sq_off.ring_mask);
+    m_sqarray = (uint32_t*)(ring + p.sq_off.array);
+    m_cqhead = (uint32_t*)(ring + p.cq_off.head);
+    m_cqtail = (uint32_t*)(ring + p.cq_off.tail);
+    m_cqmask = (uint32_t*)(ring + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(ring + p.cq_off.cqes);
+}
+
+void beastie::CFileReader::disableUring()
+{
+    if (m_sqes)
+        munmap(m_sqes, m_sqesize);
+    if (m_ringmem != MAP_FAILED)
+        munmap(m_ringmem, m_ringsize);
+    if (m_ring != -1)
+        close(m_ring);
+    m_ring = -1;
+    m_ringmem = MAP_FAILED;
+    m_sqes = nullptr;
+}
+
+void beastie::CFileReader::runPread(std::span<request> reqs, std::span<int> res)
+{
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        ssize_t n;
+        do {
+            n = pread(reqs[i].fd, reqs[i].buf, reqs[i].len, reqs[i].off);
+        } while (n == -1 && errno == EINTR);
+        res[i] = n == -1 ? -errno : int(n);
+    }
+}
+
+// Reaps completions until done reaches count, false when io_uring_enter fails
+bool beastie::CFileReader::drain(uint32_t first, size_t count, size_t& done, std::span<int> res)
+{
+    while (true) {
+        uint32_t head = *m_cqhead;
+        uint32_t ready = std::atomic_ref<uint32_t>(*m_cqtail).load(std::memory_order_acquire);
+        for (; head != ready; ++head, ++done) {
+            auto& cqe = m_cqes[head & *m_cqmask];
+            res[cqe.user_data] = cqe.res;
+        }
+        std::atomic_ref<uint32_t>(*m_cqhead).store(head, std::memory_order_release);
+        if (done >= count)
+            return true;
+
+        uint32_t consumed = std::atomic_ref<uint32_t>(*m_sqhead).load(std::memory_order_acquire) - first;
+        int n = syscall(__NR_io_uring_enter, m_ring, count - std::min<size_t>(consumed, count),
+                        count - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (n == -1 && errno != EINTR)
+            return false;
+    }
+}
+
+/*
+ * The kernel writes into the buffers of every read it took from the ring
+ * until it completes them, so nothing returns before they all have. When
+ * submitting fails, the entries it didn't take are taken back, those it
+ * did are waited for and the rest go through pread. Only when even the
+ * waiting fails is the ring closed, and that is an error.
+ */
+void beastie::CFileReader::run(std::span<request> reqs, std::span<int> res)
+{
+    if (uring() == false) {
+        runPread(reqs, res);
+        return;
+    }
+
+    constexpr int pending = std::numeric_limits<int>::min();
+    std::fill(res.begin(), res.end(), pending);
+
+    // we are the only producer, the kernel only reads the tail
+    uint32_t first = *m_sqtail;
+    uint32_t tail = first;
+    for (size_t i = 0; i < reqs.size(); ++i, ++tail) {
+        uint32_t index = tail & *m_sqmask;
+        io_uring_sqe& sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = reqs[i].fd;
+        sqe.addr = uintptr_t(reqs[i].buf);
+        sqe.len = reqs[i].len;
+        sqe.off = reqs[i].off;
+        sqe.user_data = i;
+        m_sqarray[index] = index;
+    }
+    std::atomic_ref<uint32_t>(*m_sqtail).store(tail, std::memory_order_release);
+
+    size_t done = 0;
+    if (drain(first, reqs.size(), done, res))
+        return;
+    int err = errno;
+
+    uint32_t head = std::atomic_ref<uint32_t>(*m_sqhead).load(std::memory_order_acquire);
+    std::atomic_ref<uint32_t>(*m_sqtail).store(head, std::memory_order_release);
+    if (drain(first, head - first, done, res) == false) {
+        disableUring();
+        throw std::runtime_error(std::format("io_uring_enter: {}", std::strerror(err)));
+    }
+
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        if (res[i] == pending)
+            runPread(reqs.subspan(i, 1), res.subspan(i, 1));
+    }
+}
+
+/*
+ * Up to ENTRIES chunks are in flight at a time, each into its place in
+ * the buffer. A short read goes out again for the rest of its chunk,
+ * only a read of nothing is the end of the file (it shrank since the
+ * fstat, or a sysfs attribute reported a page).
+ */
+size_t beastie::CFileReader::readRange(int fd, char* buf, size_t size, uint64_t offset)
+{
+    request reqs[ENTRIES];
+    int res[ENTRIES];
+    size_t next = 0;    // the first byte not asked for yet
+    size_t end = size;  // where the file ends, as far as known
+    unsigned n = 0;     // the rests of short reads, carried over
+
+    while (true) {
+        for (; n < ENTRIES && next < end; ++n) {
+            size_t len = std::min(CHUNK, end - next);
+            reqs[n] = {fd, buf + next, len, offset + next};
+            next += len;
+        }
+        if (n == 0)
+            break;
+        run({reqs, n}, {res, n});
+
+        unsigned rest = 0;
+        for (unsigned i = 0; i < n; ++i) {
+            if (res[i] < 0)
+                throw std::runtime_error(std::strerror(-res[i]));
+            size_t got = res[i];
+            if (got == 0)
+                end = std::min<size_t>(end, reqs[i].off - offset);
+            else if (got < reqs[i].len)
+                reqs[rest++] = {fd, reqs[i].buf + got, reqs[i].len - got, reqs[i].off + got};
+        }
+
+        n = 0;
+        for (unsigned i = 0; i < rest; ++i) {
+            if (reqs[i].off - offset < end)
+                reqs[n++] = reqs[i];
+        }
+        next = std::min(next, end);
+    }
+    return end;
+}
+
+template<class T>
+T beastie::CFileReader::read(std::filesystem::path path)
+{
+    fdguard fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd.fd == -1)
+        throw failure(path, errno);
+
+    struct stat st;
+    if (fstat(fd.fd, &st) == -1)
+        throw failure(path, errno);
+
+    T buffer;
+    try {
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            if (size_t(st.st_size) > CHUNK) {
+                // start the whole file, readahead(2) would wait for it
+                posix_fadvise(fd.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                posix_fadvise(fd.fd, 0, 0, POSIX_FADV_WILLNEED);
+            }
+            buffer.resize(st.st_size);
+            buffer.resize(readRange(fd.fd, buffer.data(), buffer.size(), 0));
+            return buffer;
+        }
+
+        // procfs and the like don't know their size
+        size_t got = 0;
+        while (true) {
+            buffer.resize(got + SMALL);
+            size_t n = readRange(fd.fd, buffer.data() + got, SMALL, got);
+            got += n;
+            if (n < SMALL)
+                break;
+        }
+        buffer.resize(got);
+    }
+    catch (std::runtime_error& e) {
+        throw std::runtime_error(std::format("{}: {}", path.string(), e.what()));
+    }
+    return buffer;
+}
+template
+std::string beastie::CFileReader::read<std::string>(std::filesystem::path path);
+template
+std::vector<char> beastie::CFileReader::read<std::vector<char>>(std::filesystem::path path);
+
+/*
+ * The files are opened one by one, their reads go out together. A file
+ * that fills SMALL may have more, it is read again on its own.
+ */
+std::vector<std::optional<std::string>> beastie::CFileReader::readMany(std::span<const std::filesystem::path> paths)
+{
+    std::vector<std::optional<std::string>> out(paths.size());
+
+    for (size_t first = 0; first < paths.size(); first += ENTRIES) {
+        size_t count = std::min<size_t>(ENTRIES, paths.size() - first);
+        request reqs[ENTRIES];
+        int res[ENTRIES];
+        size_t which[ENTRIES];
+        std::string buffers[ENTRIES];
+        unsigned n = 0;
+
+        for (size_t i = first; i < first + count; ++i) {
+            int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                continue;
+            buffers[n].resize(SMALL);
+            reqs[n] = {fd, buffers[n].data(), SMALL, 0};
+            which[n] = i;
+            ++n;
+        }
+
+        try {
+            run({reqs, n}, {res, n});
+        }
+        catch (...) {
+            for (unsigned i = 0; i < n; ++i)
+                close(reqs[i].fd);
+            throw;
+        }
+
+        for (unsigned i = 0; i < n; ++i) {
+            close(reqs[i].fd);
+            if (res[i] < 0)
+                continue;
+            if (size_t(res[i]) == SMALL) {
+                try {
+                    out[which[i]] = read<std::string>(paths[which[i]]);
+                }
+                catch (std::runtime_error&) {
+                }
+                continue;
+            }
+            buffers[i].resize(res[i]);
+            out[which[i]] = std::move(buffers[i]);
+        }
+    }
+    return out;
+}
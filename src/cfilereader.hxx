@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace beastie {
+
+// Reads whole files into buffers sized up front, through io_uring: big
+// files in large chunks kept in flight together, after a readahead hint,
+// and batches of small ones (sysfs attributes) in a single submission.
+// Falls back to pread where io_uring is missing or disabled (old kernel,
+// kernel.io_uring_disabled, seccomp). There is one ring per thread.
+class CFileReader
+{
+public:
+    static CFileReader& instance();
+    CFileReader(const CFileReader&) = delete;
+    CFileReader& operator=(const CFileReader&) = delete;
+    ~CFileReader();
+
+    // A whole file, std::string or std::vector<char>
+    template<class T>
+    T read(std::filesystem::path path);
+
+    // Many small files at once, nullopt for those that can't be read
+    std::vector<std::optional<std::string>> readMany(std::span<const std::filesystem::path> paths);
+
+    // False when reads go through pread
+    bool uring() {
+        return m_ring != -1;
+    }
+
+    // Use pread even with io_uring around (benchmarks)
+    void disableUring();
+
+private:
+    constexpr static unsigned ENTRIES = 32;
+    constexpr static size_t CHUNK = 1 << 20;
+    constexpr static size_t SMALL = 4096;
+
+    struct request {
+        int fd;
+        char* buf;
+        size_t len;
+        uint64_t off;
+    };
+
+    CFileReader();
+    void setup();
+
+    // Run up to ENTRIES reads, each result is a byte count or -errno
+    void run(std::span<request> reqs, std::span<int> res);
+    void runPread(std::span<request> reqs, std::span<int> res);
+
+    // Wait for the reads the kernel took up to the one at index count
+    bool drain(uint32_t first, size_t count, size_t& done, std::span<int> res);
+
+    // Read size bytes at offset of fd into buf, fewer at end of file
+    size_t readRange(int fd, char* buf, size_t size, uint64_t offset);
+
+    int m_ring;
+    void* m_ringmem;
+    size_t m_ringsize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqesize;
+    uint32_t* m_sqhead;
+    uint32_t* m_sqtail;
+    uint32_t* m_sqmask;
+    uint32_t* m_sqarray;
+    uint32_t* m_cqhead;
+    uint32_t* m_cqtail;
+    uint32_t* m_cqmask;
+    io_uring_cqe* m_cqes;
+};
+} // namespace beastie
@@ -0,0 +1,279 @@
+#include "cfontblob.hxx"
+#include "cimagecache.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <endian.h>
+
+// Unicode blocks by script, as consoles tend to need them
+static const struct {
+    std::string_view name;
+    fontrange range;
+} namedRanges[] = {
+    {"ascii",    {0x0000, 0x007f}},
+    {"latin",    {0x0000, 0x024f}},
+    {"latin",    {0x1e00, 0x1eff}},
+    {"greek",    {0x0370, 0x03ff}},
+    {"cyrillic", {0x0400, 0x052f}},
+    {"hebrew",   {0x0590, 0x05ff}},
+    {"arabic",   {0x0600, 0x06ff}},
+    {"symbols",  {0x2000, 0x2bff}},     // punctuation, arrows, box drawing, blocks, ...
+    {"cjk",      {0x2e80, 0x9fff}},
+    {"cjk",      {0xac00, 0xd7af}},
+    {"cjk",      {0xf900, 0xfaff}},
+    {"cjk",      {0xff00, 0xffef}},
+};
+
+static uint32_t codepoint(std::string_view s, std::string_view spec)
+{
+    if (s.starts_with("U+") || s.starts_with("u+"))
+        s.remove_prefix(2);
+    uint32_t cp = 0;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), cp, 16);
+    if (ec != std::errc() || end != s.data() + s.size() || s.empty() || cp > 0x10ffff)
+        throw std::runtime_error(std::format("{}: bad font subset", spec));
+    return cp;
+}
+
+std::vector<fontrange> beastie::CFontBlob::parseSubset(std::string_view spec)
+{
+    std::vector<fontrange> subset;
+    std::string_view rest = spec;
+    while (rest.empty() == false) {
+        auto comma = rest.find(',');
+        auto item = rest.substr(0, comma);
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+        if (item.empty())
+            continue;
+
+        bool named = false;
+        for (auto& r : namedRanges) {
+            if (r.name == item) {
+                subset.push_back(r.range);
+                named = true;
+            }
+        }
+        if (named)
+            continue;
+
+        auto dash = item.find('-');
+        uint32_t first = codepoint(item.substr(0, dash), spec);
+        uint32_t last = dash == std::string_view::npos ? first : codepoint(item.substr(dash + 1), spec);
+        if (last < first)
+            throw std::runtime_error(std::format("{}: bad font subset", spec));
+        subset.push_back({first, last});
+    }
+
+    // sorted and merged, the maps built from them must be sorted
+    std::sort(subset.begin(), subset.end(), [](auto& a, auto& b) {
+        return a.first < b.first;
+    });
+    std::vector<fontrange> merged;
+    for (auto& r : subset) {
+        if (merged.empty() == false && r.first <= merged.back().last + 1)
+            merged.back().last = std::max(merged.back().last, r.last);
+        else
+            merged.push_back(r);
+    }
+    return merged;
+}
+
+/*
+ * Documentation for the kernel font blob (MODINFOMD_FONT):
+ *
+ *   . font_info   sizes, map counts and checksum (host endian)
+ *   . vfnt_map[]  the maps, VFNT_MAP_NORMAL first (host endian)
+ *   . u8[]        glyph bitmaps, fi_bitmap_size bytes
+ *
+ * NOTES:
+ *   - A VFNT file has the glyphs before the maps and is big endian.
+ *   - Subsetting keeps glyph 0, which the kernel draws for characters
+ *       without a glyph, renumbers the rest in the order the maps use
+ *       them and splits the maps on the ranges kept.
+ *
+ ****/
+CMappedFile beastie::CFontBlob::convert(std::filesystem::path path, std::span<const fontrange> subset,
+                                        CSha256* sha256)
+{
+    auto buffer = zmap(path, sha256);
+    font_header hdr;
+    if (buffer.size() < sizeof(hdr))
+        throw std::runtime_error(std::format("{}: format error", path.string()));
+    std::memcpy(&hdr, buffer.data(), sizeof(hdr));
+
+    if (std::string((char*)&hdr.fh_magic[0], 8) != "VFNT0002")
+        throw std::runtime_error(std::format("{}: format error", path.string()));
+
+    // The header is stored big endian (!!)
+    hdr.fh_glyph_count = be32toh(hdr.fh_glyph_count);
+    size_t nmaps = 0;
+    for (int i = 0; i < VFNT_MAPS; ++i) {
+        hdr.fh_map_count[i] = be32toh(hdr.fh_map_count[i]);
+        nmaps += hdr.fh_map_count[i];
+    }
+
+    size_t gbytes = howmany(hdr.fh_width, 8) * hdr.fh_height;
+    size_t glyphCount = hdr.fh_glyph_count;
+    size_t index = sizeof(hdr);
+    if (buffer.size() < index + glyphCount * gbytes + nmaps * sizeof(vfnt_map))
+        throw std::runtime_error(std::format("{}: format error", path.string()));
+    const char* bitmap = buffer.data() + index;
+    index += glyphCount * gbytes;
+
+    std::vector<vfnt_map> maps[VFNT_MAPS];
+    for (int i = 0; i < VFNT_MAPS; ++i) {
+        maps[i].resize(hdr.fh_map_count[i]);
+        for (auto& map : maps[i]) {
+            std::memcpy(&map, buffer.data() + index, sizeof(map));
+            map.vfm_src = be32toh(map.vfm_src);
+            map.vfm_dst = be16toh(map.vfm_dst);
+            map.vfm_len = be16toh(map.vfm_len);
+            index += sizeof(map);
+        }
+    }
+
+    // glyphs kept, by new index
+    std::vector<uint32_t> order;
+    if (subset.empty() == false) {
+        std::vector<int32_t> remap(glyphCount, -1);
+        auto glyph = [&](uint32_t old) {
+            if (old >= glyphCount)
+                throw std::runtime_error(std::format("{}: map past the glyphs", path.string()));
+            if (remap[old] < 0) {
+                remap[old] = order.size();
+                order.push_back(old);
+            }
+            return uint32_t(remap[old]);
+        };
+        if (glyphCount > 0)
+            glyph(0);
+
+        for (auto& table : maps) {
+            std::vector<vfnt_map> kept;
+            for (auto& map : table) {
+                uint32_t last = map.vfm_src + map.vfm_len;
+                for (auto& r : subset) {
+                    for (uint32_t cp = std::max(map.vfm_src, r.first); cp <= std::min(last, r.last); ++cp) {
+                        uint32_t g = glyph(map.vfm_dst + (cp - map.vfm_src));
+                        auto* prev = kept.empty() ? nullptr : &kept.back();
+                        if (prev && prev->vfm_len < 0xffff &&
+                            prev->vfm_src + prev->vfm_len + 1 == cp &&
+                            prev->vfm_dst + prev->vfm_len + 1u == g)
+                            prev->vfm_len++;
+                        else
+                            kept.push_back({cp, uint16_t(g), 0});
+                    }
+                }
+            }
+            table = std::move(kept);
+        }
+    }
+
+    size_t keptGlyphs = subset.empty() ? glyphCount : order.size();
+    font_info fi;
+    fi.fi_width = hdr.fh_width;
+    fi.fi_height = hdr.fh_height;
+    fi.fi_bitmap_size = keptGlyphs * gbytes;
+    for (int i = 0; i < VFNT_MAPS; ++i)
+        fi.fi_map_count[i] = maps[i].size();
+
+    uint32_t checksum;
+    checksum = fi.fi_width;
+    checksum += fi.fi_height;
+    checksum += fi.fi_bitmap_size;
+    for (int i = 0; i < VFNT_MAPS; ++i)
+        checksum += fi.fi_map_count[i];
+    fi.fi_checksum = -checksum;
+
+    size_t size = sizeof(fi) + fi.fi_bitmap_size;
+    for (auto& table : maps)
+        size += table.size() * sizeof(vfnt_map);
+
+    // written once, straight into the memory that gets loaded
+    auto blob = CMappedFile::anonymous(size);
+    char* out = blob.data();
+    std::memcpy(out, &fi, sizeof(fi));
+    out += sizeof(fi);
+    for (auto& table : maps) {
+        std::memcpy(out, table.data(), table.size() * sizeof(vfnt_map));
+        out += table.size() * sizeof(vfnt_map);
+    }
+    if (subset.empty()) {
+        std::memcpy(out, bitmap, fi.fi_bitmap_size);
+    } else {
+        for (auto old : order) {
+            std::memcpy(out, bitmap + old * gbytes, gbytes);
+            out += gbytes;
+        }
+    }
+    return blob;
+}
+
+uint64_t beastie::CFontBlob::cacheKey(std::filesystem::path path, std::span<const fontrange> subset)
+{
+    uint64_t h = hash64(std::format("font {} {}", VERSION, path.string()));
+    auto mix = [&h](auto v) {
+        h = hash64(std::span<const char>((const char*)&v, sizeof(v)), h);
+    };
+
+    auto id = CImageCache::identify(path);
+    mix(id->dev);
+    mix(id->ino);
+    mix(id->size);
+    mix(id->mtime);
+    mix(id->ctime);
+    for (auto& r : subset) {
+        mix(r.first);
+        mix(r.last);
+    }
+    return h;
+}
+
+// The blob is self checking, its sizes must add up
+bool beastie::CFontBlob::valid(CMappedFile& blob)
+{
+    font_info fi;
+    if (blob.size() < sizeof(fi))
+        return false;
+    std::memcpy(&fi, blob.data(), sizeof(fi));
+
+    uint32_t checksum = fi.fi_width + fi.fi_height + fi.fi_bitmap_size;
+    size_t size = sizeof(fi) + fi.fi_bitmap_size;
+    for (int i = 0; i < VFNT_MAPS; ++i) {
+        checksum += fi.fi_map_count[i];
+        size += size_t(fi.fi_map_count[i]) * sizeof(vfnt_map);
+    }
+    return checksum + uint32_t(fi.fi_checksum) == 0 && size == blob.size();
+}
+
+CMappedFile beastie::CFontBlob::load(std::filesystem::path path, std::span<const fontrange> subset,
+                                     std::filesystem::path cachedir)
+{
+    if (cachedir.empty() || CImageCache::identify(path).has_value() == false)
+        return convert(path, subset);
+
+    auto entry = cachedir/std::format("{:016x}.font", cacheKey(path, subset));
+    try {
+        CMappedFile blob(entry);
+        if (valid(blob))
+            return blob;
+    } catch (const std::exception&) {
+        // not cached yet
+    }
+
+    auto blob = convert(path, subset);
+
+    // a failed write only costs the next run the conversion
+    try {
+        std::filesystem::create_directories(cachedir);
+        writeAtomic(entry, blob.span());
+    } catch (const std::exception&) {
+    }
+    return blob;
+}
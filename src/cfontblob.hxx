@@ -0,0 +1,47 @@
+#pragma once
+
+#include "types.hxx"
+#include "cmappedfile.hxx"
+#include "csha256.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+// A range of code points, both ends included
+struct fontrange {
+    uint32_t first;
+    uint32_t last;
+};
+
+// Turns a VFNT font into the blob the kernel takes as MODINFOMD_FONT
+// (font_info, the four maps, then the glyphs), optionally keeping only
+// the glyphs of some code points.
+class CFontBlob
+{
+public:
+    // Parse a subset: comma separated names (latin, greek, cyrillic,
+    // symbols, cjk, ...) or U+XXXX-U+YYYY ranges. Empty keeps everything.
+    static std::vector<fontrange> parseSubset(std::string_view spec);
+
+    // Convert a (possibly compressed) VFNT file, feeding the file as
+    // stored to sha256 when given
+    static CMappedFile convert(std::filesystem::path path, std::span<const fontrange> subset,
+                               CSha256* sha256 = nullptr);
+
+    // convert(), through a cache of converted blobs in cachedir (none when empty)
+    static CMappedFile load(std::filesystem::path path, std::span<const fontrange> subset,
+                            std::filesystem::path cachedir);
+
+private:
+    constexpr static uint32_t VERSION = 1;
+
+    static uint64_t cacheKey(std::filesystem::path path, std::span<const fontrange> subset);
+    static bool valid(CMappedFile& blob);
+};
+} // namespace beastie
@@ -0,0 +1,166 @@
+#include "cfontindex.hxx"
+#include "cdecompressor.hxx"
+#include "cimagecache.hxx"
+#include "cmappedfile.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+#include <endian.h>
+
+std::optional<fontentry> beastie::CFontIndex::probe(std::filesystem::path path)
+{
+    auto id = CImageCache::identify(path);
+    if (id.has_value() == false)
+        return std::nullopt;
+
+    font_header hdr;
+    try {
+        // mapped, only the pages the header comes from are read
+        CMappedFile file(path);
+        if (CDecompressor::detect(file.span()) == CDecompressor::Format::None) {
+            if (file.size() < sizeof(hdr))
+                return std::nullopt;
+            std::memcpy(&hdr, file.data(), sizeof(hdr));
+        } else {
+            CDecompressor z(file.span(), path.string());
+            size_t done = 0;
+            while (done < sizeof(hdr)) {
+                size_t n = z.read(std::span<char>((char*)&hdr + done, sizeof(hdr) - done));
+                if (n == 0)
+                    return std::nullopt;
+                done += n;
+            }
+        }
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+
+    if (std::memcmp(hdr.fh_magic, "VFNT0002", 8) != 0 || hdr.fh_width == 0 || hdr.fh_height == 0)
+        return std::nullopt;
+    return fontentry{*id, hdr.fh_width, hdr.fh_height, be32toh(hdr.fh_glyph_count)};
+}
+
+std::filesystem::path beastie::CFontIndex::indexPath(std::filesystem::path dir, std::filesystem::path cachedir)
+{
+    return cachedir/std::format("{:016x}.fonts", hash64(dir.string()));
+}
+
+/*
+ * Documentation for the index, a text file:
+ *
+ *   beastie-fonts 1
+ *   <width> <height> <glyphs> <dev> <ino> <size> <mtime> <ctime> <path>
+ *   ...
+ *
+ ****/
+std::vector<fontentry> beastie::CFontIndex::readIndex(std::filesystem::path path)
+{
+    std::vector<fontentry> fonts;
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec) == false)
+        return fonts;
+
+    auto lines = slurpLines(path);
+    if (lines.empty() || lines[0] != std::format("{} {}", MAGIC, VERSION))
+        return fonts;
+
+    for (size_t i = 1; i < lines.size(); ++i) {
+        std::istringstream line(lines[i]);
+        fontentry font;
+        if (!(line >> font.width >> font.height >> font.glyphs >>
+              font.id.dev >> font.id.ino >> font.id.size >> font.id.mtime >> font.id.ctime))
+            return {};
+        std::getline(line >> std::ws, font.id.path);
+        fonts.push_back(font);
+    }
+    return fonts;
+}
+
+void beastie::CFontIndex::writeIndex(std::filesystem::path path, std::span<const fontentry> fonts)
+{
+    std::string text = std::format("{} {}\n", MAGIC, VERSION);
+    for (auto& font : fonts)
+        text += std::format("{} {} {} {} {} {} {} {} {}\n", font.width, font.height, font.glyphs,
+                            font.id.dev, font.id.ino, font.id.size, font.id.mtime, font.id.ctime, font.id.path);
+
+    std::filesystem::create_directories(path.parent_path());
+    writeAtomic(path, text);
+}
+
+std::vector<fontentry> beastie::CFontIndex::scan(std::filesystem::path dir, std::filesystem::path cachedir)
+{
+    std::vector<fontentry> cached;
+    if (cachedir.empty() == false) {
+        try {
+            cached = readIndex(indexPath(dir, cachedir));
+        } catch (const std::exception&) {
+        }
+    }
+
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        auto name = entry.path().filename().string();
+        if (name.find(".fnt") != std::string::npos && entry.is_regular_file(ec))
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<fontentry> fonts;
+    bool changed = cached.size() != files.size();
+    for (auto& path : files) {
+        auto id = CImageCache::identify(path);
+        auto it = std::find_if(cached.begin(), cached.end(), [&](auto& font) {
+            return id.has_value() && font.id == *id;
+        });
+        if (it != cached.end()) {
+            fonts.push_back(*it);
+            continue;
+        }
+
+        changed = true;
+        auto font = probe(path);
+        if (font.has_value())
+            fonts.push_back(*font);
+    }
+
+    // a directory that can't be written only means probing again next time
+    if (changed && cachedir.empty() == false) {
+        try {
+            writeIndex(indexPath(dir, cachedir), fonts);
+        } catch (const std::exception&) {
+        }
+    }
+    return fonts;
+}
+
+std::optional<fontentry> beastie::CFontIndex::choose(std::span<const fontentry> fonts,
+                                                     unsigned width, unsigned height,
+                                                     unsigned cols, unsigned rows)
+{
+    const fontentry* best = nullptr;
+    const fontentry* smallest = nullptr;
+    auto larger = [](const fontentry* a, const fontentry& b) {
+        return a == nullptr || std::tie(b.height, b.width) > std::tie(a->height, a->width);
+    };
+
+    for (auto& font : fonts) {
+        if (smallest == nullptr || std::tie(font.height, font.width) < std::tie(smallest->height, smallest->width))
+            smallest = &font;
+        if (font.width * cols <= width && font.height * rows <= height && larger(best, font))
+            best = &font;
+    }
+
+    if (best == nullptr)
+        best = smallest;
+    if (best == nullptr)
+        return std::nullopt;
+    return *best;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace beastie {
+
+// A font file and the size of its glyphs
+struct fontentry {
+    fileid id;
+    unsigned width;
+    unsigned height;
+    uint32_t glyphs;
+};
+
+// Knows the fonts of a directory (*.fnt, *.fnt.gz, ...) from their
+// headers alone, without decompressing any of them.
+class CFontIndex
+{
+public:
+    // Index dir, files that didn't change come from an index cached in
+    // cachedir (none when empty)
+    static std::vector<fontentry> scan(std::filesystem::path dir, std::filesystem::path cachedir);
+
+    // Read the header of a font, streaming only the first bytes if compressed
+    static std::optional<fontentry> probe(std::filesystem::path path);
+
+    // The largest font that still gives cols x rows on a width x height
+    // screen, else the smallest one
+    static std::optional<fontentry> choose(std::span<const fontentry> fonts,
+                                           unsigned width, unsigned height,
+                                           unsigned cols, unsigned rows);
+
+private:
+    constexpr static char MAGIC[] = "beastie-fonts";
+    constexpr static uint32_t VERSION = 1;
+
+    static std::filesystem::path indexPath(std::filesystem::path dir, std::filesystem::path cachedir);
+    static std::vector<fontentry> readIndex(std::filesystem::path path);
+    static void writeIndex(std::filesystem::path path, std::span<const fontentry> fonts);
+};
+} // namespace beastie
@@ -4,6 +4,14 @@
 #include <vector>
 
 namespace beastie {
+
+// outl(value, port), as done by the trampoline
+struct portwrite {
+    uint16_t port;
+    uint16_t pad;
+    uint32_t value;
+};
+
 class CGfx
 {
 public:
@@ -18,8 +26,8 @@ public:
     // Debug print information about this card
     virtual void debug() = 0;
 
-    // Assemble reset code for this card
-    virtual std::vector<char> assembleReset(int, int) = 0;
+    // The port writes resetting this card to width x height
+    virtual std::vector<portwrite> resetSequence(int, int) = 0;
 
 };
 } // namespace beastie
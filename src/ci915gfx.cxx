@@ -3,6 +3,7 @@
 using namespace beastie;
 
 #include <cassert>
+#include <format>
 #include <iostream>
 
 beastie::CI915gfx::CI915gfx()
@@ -20,7 +20,7 @@ public:
 
     void debug() override;
 
-    std::vector<char> assembleReset(int, int) override {
+    std::vector<portwrite> resetSequence(int, int) override {
         return {};
     }
 
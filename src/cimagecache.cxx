@@ -0,0 +1,214 @@
+#include "cimagecache.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+constexpr static size_t PAGE = 4096;
+
+beastie::CImageCache::CImageCache()
+    : m_dir()
+{
+}
+
+void beastie::CImageCache::setDirectory(std::filesystem::path dir)
+{
+    m_dir = dir;
+}
+
+std::optional<fileid> beastie::CImageCache::identify(std::filesystem::path path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+        return std::nullopt;
+
+    fileid id;
+    id.path = path.string();
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    id.size = st.st_size;
+    id.mtime = st.st_mtim.tv_sec * 1'000'000'000ULL + st.st_mtim.tv_nsec;
+    id.ctime = st.st_ctim.tv_sec * 1'000'000'000ULL + st.st_ctim.tv_nsec;
+    return id;
+}
+
+std::filesystem::path beastie::CImageCache::entryPath(uint64_t key)
+{
+    return m_dir/std::format("{:016x}.img", key);
+}
+
+/*
+ * Documentation for the cache file format:
+ *
+ * header
+ *   . char[8] magic "BEASTIEC"
+ *   . u32     version
+ *   . u32     pad
+ *   . u64     key
+ *   . u64[]   layout (see imagelayout)
+ *   . u32     input count
+ *   . u32     pad
+ *   . u32     module count
+ *   . u32     segment count
+ *
+ * inputs (repeats input count times)
+ *   . u64     dev, ino, size, mtime, ctime
+ *   . u32     path length
+ *   . char[]  path
+ *
+ * modules (repeats module count times)
+ *   . u32     name length
+ *   . char[]  name
+ *   . u32     type length
+ *   . char[]  type
+ *   . u64     addr, size
+ *   . u32     ELF header length
+ *   . char[]  ELF header
+ *   . u32     section headers length
+ *   . char[]  section headers
+ *
+ * segments (repeats segment count times)
+ *   . u64     phys, memsz, bufsz, file offset
+ *   . u8[32]  sha256 of the segment bytes
+ *
+ * payload
+ *   . char[]  segment bytes, each at a page aligned file offset
+ *
+ * NOTES:
+ *   - Everything is stored in host byte order, the cache never leaves
+ *       the machine that wrote it.
+ *   - Images loaded with a manifest (--verify) are never cached.
+ *   - The segments are checked against their digests on every read, an
+ *       entry torn by a crash must not get to kexec_load.
+ *
+ ****/
+bool beastie::CImageCache::read(uint64_t key, imagecache& entry)
+{
+    if (enabled() == false)
+        return false;
+
+    try {
+        CMappedFile file(entryPath(key));
+        auto buffer = file.span();
+        CBinaryReader in(buffer, entryPath(key).string());
+
+        if (std::memcmp(in.bytes(sizeof(MAGIC)).data(), MAGIC, sizeof(MAGIC)) != 0)
+            return false;
+        if (in.u32() != VERSION)
+            return false;
+        in.u32();
+        if (in.u64() != key)
+            return false;
+
+        std::memcpy(&entry.layout, in.bytes(sizeof(imagelayout)).data(), sizeof(imagelayout));
+        uint32_t ninputs = in.u32();
+        in.u32();
+        uint32_t nmodules = in.u32();
+        uint32_t nsegments = in.u32();
+
+        entry.inputs.clear();
+        for (uint32_t i = 0; i < ninputs; ++i) {
+            fileid id;
+            id.dev = in.u64();
+            id.ino = in.u64();
+            id.size = in.u64();
+            id.mtime = in.u64();
+            id.ctime = in.u64();
+            id.path = in.string();
+            entry.inputs.push_back(id);
+        }
+
+        entry.modules.clear();
+        for (uint32_t i = 0; i < nmodules; ++i) {
+            modrecord mod;
+            mod.name = in.string();
+            mod.type = in.string();
+            mod.addr = in.u64();
+            mod.size = in.u64();
+            mod.ehdr = in.blob();
+            mod.shdr = in.blob();
+            entry.modules.push_back(std::move(mod));
+        }
+
+        entry.segments.clear();
+        for (uint32_t i = 0; i < nsegments; ++i) {
+            loadsegment seg;
+            seg.phys = in.u64();
+            seg.memsz = in.u64();
+            seg.bufsz = in.u64();
+            uint64_t offset = in.u64();
+            auto sha256 = in.bytes(sizeof(CSha256::digest));
+            if (offset > buffer.size() || seg.bufsz > buffer.size() - offset || seg.bufsz > seg.memsz)
+                return false;
+            seg.buf = buffer.data() + offset;
+            if (std::memcmp(CSha256::of({seg.buf, seg.bufsz}).data(), sha256.data(), sha256.size()) != 0)
+                return false;
+            entry.segments.push_back(seg);
+        }
+
+        // the mapping moves with the object, the pointers above stay valid
+        entry.file = std::move(file);
+        return true;
+    }
+    catch (std::exception&) {
+        return false;
+    }
+}
+
+void beastie::CImageCache::write(uint64_t key, const imagecache& entry)
+{
+    if (enabled() == false)
+        return;
+
+    CBinaryWriter out;
+    out.bytes(MAGIC, sizeof(MAGIC));
+    out.u32(VERSION);
+    out.u32(0);
+    out.u64(key);
+    out.bytes(&entry.layout, sizeof(imagelayout));
+    out.u32(entry.inputs.size());
+    out.u32(0);
+    out.u32(entry.modules.size());
+    out.u32(entry.segments.size());
+
+    for (auto& id : entry.inputs) {
+        out.u64(id.dev);
+        out.u64(id.ino);
+        out.u64(id.size);
+        out.u64(id.mtime);
+        out.u64(id.ctime);
+        out.blob(id.path);
+    }
+
+    for (auto& mod : entry.modules) {
+        out.blob(mod.name);
+        out.blob(mod.type);
+        out.u64(mod.addr);
+        out.u64(mod.size);
+        out.blob(mod.ehdr);
+        out.blob(mod.shdr);
+    }
+
+    // payload offsets follow the segment table, page aligned
+    size_t table = entry.segments.size() * (4 * sizeof(uint64_t) + sizeof(CSha256::digest));
+    size_t offset = howmany(out.size() + table, PAGE) * PAGE;
+    std::vector<filepart> parts(1);
+    for (auto& seg : entry.segments) {
+        parts.push_back({offset, {seg.buf, seg.bufsz}});
+        out.u64(seg.phys);
+        out.u64(seg.memsz);
+        out.u64(seg.bufsz);
+        out.u64(offset);
+        auto sha256 = CSha256::of({seg.buf, seg.bufsz});
+        out.bytes(sha256.data(), sha256.size());
+        offset += howmany(seg.bufsz, PAGE) * PAGE;
+    }
+    parts[0] = {0, out.data()};
+
+    std::filesystem::create_directories(m_dir);
+    writeAtomic(entryPath(key), parts);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types.hxx"
+#include "cmappedfile.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace beastie {
+
+// Physical layout of a prepared image
+struct imagelayout {
+    uint64_t btext;
+    uint64_t kernphys;
+    uint64_t kernsize;
+    uint64_t symphys;
+    uint64_t symsize;
+    uint64_t fontphys;
+    uint64_t hostphys;      // metadata and env, rebuilt for the host
+    uint64_t hostslot;
+    uint64_t kernend;
+    uint64_t bootphys;
+};
+
+// A prepared image, minus the host specific env and metadata
+struct imagecache {
+    imagelayout layout;
+    std::vector<fileid> inputs;
+    std::vector<modrecord> modules;
+    std::vector<loadsegment> segments;
+    CMappedFile file;
+};
+
+class CImageCache
+{
+public:
+    CImageCache();
+
+    // Use dir for the cache, an empty path disables it
+    void setDirectory(std::filesystem::path dir);
+
+    bool enabled() {
+        return m_dir.empty() == false;
+    }
+    auto& directory() {
+        return m_dir;
+    }
+
+    // Identity of a file, empty if it can't be stat'ed
+    static std::optional<fileid> identify(std::filesystem::path path);
+
+    // Map the entry for key, false when missing, stale or damaged
+    bool read(uint64_t key, imagecache& entry);
+
+    // Store an entry for key, replacing any previous one
+    void write(uint64_t key, const imagecache& entry);
+
+private:
+    constexpr static char MAGIC[8] = {'B', 'E', 'A', 'S', 'T', 'I', 'E', 'C'};
+    constexpr static uint32_t VERSION = 6;
+    std::filesystem::path m_dir;
+
+    std::filesystem::path entryPath(uint64_t key);
+};
+} // namespace beastie
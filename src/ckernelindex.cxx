@@ -0,0 +1,261 @@
+#include "ckernelindex.hxx"
+#include "cdecompressor.hxx"
+#include "cimagecache.hxx"
+#include "cloadpipeline.hxx"
+#include "cmappedfile.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace {
+// Where the kernel is linked, as Bootloader maps it
+constexpr uint64_t KERNBASE = 0xffff'ffff'8000'0000;
+constexpr uint64_t KERNSTART = KERNBASE + 0x20'0000;
+
+// Elf_Note type of the FreeBSD ABI tag, its descriptor is __FreeBSD_version
+constexpr uint32_t NT_FREEBSD_ABI_TAG = 1;
+
+uint32_t noteVersion(std::span<const char> notes)
+{
+    size_t pos = 0;
+    while (pos + sizeof(Elf64_Nhdr) <= notes.size()) {
+        Elf64_Nhdr nh;
+        std::memcpy(&nh, notes.data() + pos, sizeof(nh));
+        size_t name = pos + sizeof(nh);
+        size_t desc = name + howmany(size_t(nh.n_namesz), 4) * 4;
+        pos = desc + howmany(size_t(nh.n_descsz), 4) * 4;
+        if (pos > notes.size())
+            break;
+
+        if (nh.n_type == NT_FREEBSD_ABI_TAG && nh.n_namesz == 8 &&
+            std::memcmp(notes.data() + name, "FreeBSD", 8) == 0 && nh.n_descsz >= sizeof(uint32_t)) {
+            uint32_t version;
+            std::memcpy(&version, notes.data() + desc, sizeof(version));
+            return version;
+        }
+    }
+    return 0;
+}
+} // namespace
+
+bool beastie::CKernelIndex::valid(const Elf64_Ehdr& hdr)
+{
+    return hdr.e_ident[EI_MAG0] == 0x7f &&
+           hdr.e_ident[EI_MAG1] == 0x45 &&
+           hdr.e_ident[EI_MAG2] == 0x4c &&
+           hdr.e_ident[EI_MAG3] == 0x46 &&
+           hdr.e_ident[EI_CLASS] == 0x02 &&
+           hdr.e_ident[EI_DATA] == 0x01 &&
+           hdr.e_ident[EI_VERSION] == 0x01 &&
+           hdr.e_ident[EI_OSABI] == 0x09 &&
+           hdr.e_machine == 0x3e && // amd64
+           hdr.e_version == 0x01 &&
+           (hdr.e_type == ET_EXEC || hdr.e_type == ET_REL);
+}
+
+/*
+ * The headers and notes sit at the start of the file. A mapped kernel
+ * only reads the pages they are on, a compressed one is decompressed up
+ * to the last byte asked for, PREFIX_MAX at most. The section headers
+ * are at the end, they are only looked at for the note when mapped.
+ */
+kernelentry beastie::CKernelIndex::probe(std::filesystem::path path)
+{
+    kernelentry kernel{};
+    kernel.id.path = path.string();
+    auto id = CImageCache::identify(path);
+    if (id.has_value() == false)
+        return kernel;
+    kernel.id = *id;
+
+    try {
+        CMappedFile file(path);
+        std::unique_ptr<CDecompressor> z;
+        std::vector<char> prefix;
+        if (CDecompressor::detect(file.span()) != CDecompressor::Format::None)
+            z = std::make_unique<CDecompressor>(file.span(), path.string());
+
+        // size bytes at offset into out, false past the end (or PREFIX_MAX)
+        auto bytes = [&](uint64_t offset, uint64_t size, void* out) {
+            uint64_t limit = z ? PREFIX_MAX : file.size();
+            if (size > limit || offset > limit - size)
+                return false;
+            if (z == nullptr) {
+                std::memcpy(out, file.data() + offset, size);
+                return true;
+            }
+            while (prefix.size() < offset + size) {
+                size_t have = prefix.size();
+                prefix.resize(std::min<uint64_t>(PREFIX_MAX, std::max<uint64_t>(offset + size, 2 * have + 4096)));
+                size_t n = z->read(std::span<char>(prefix.data() + have, prefix.size() - have));
+                prefix.resize(have + n);
+                if (n == 0)
+                    return false;
+            }
+            std::memcpy(out, prefix.data() + offset, size);
+            return true;
+        };
+
+        Elf64_Ehdr hdr;
+        if (bytes(0, sizeof(hdr), &hdr) == false)
+            return kernel;
+        if (valid(hdr) == false || hdr.e_type != ET_EXEC || hdr.e_entry == 0 ||
+            hdr.e_phnum == 0 || hdr.e_phentsize != sizeof(Elf64_Phdr))
+            return kernel;
+
+        std::vector<Elf64_Phdr> phdrs(hdr.e_phnum);
+        if (bytes(hdr.e_phoff, phdrs.size() * sizeof(Elf64_Phdr), phdrs.data()) == false)
+            return kernel;
+
+        // what Bootloader::elfLoadExec() lays out from kernphys
+        uint64_t end = 0;
+        for (auto& ph : phdrs) {
+            if (ph.p_type != PT_LOAD)
+                continue;
+            if (ph.p_vaddr < KERNSTART || ph.p_filesz > ph.p_memsz)
+                return kernel;
+            end = std::max(end, ph.p_vaddr - KERNSTART + ph.p_memsz);
+        }
+        if (end == 0)
+            return kernel;
+        kernel.bootable = true;
+        kernel.loadsize = end;
+
+        std::vector<char> notes;
+        for (auto& ph : phdrs) {
+            if (ph.p_type != PT_NOTE || kernel.version)
+                continue;
+            notes.resize(ph.p_filesz);
+            if (bytes(ph.p_offset, notes.size(), notes.data()))
+                kernel.version = noteVersion(notes);
+        }
+
+        if (kernel.version || z || hdr.e_shentsize != sizeof(Elf64_Shdr))
+            return kernel;
+        std::vector<Elf64_Shdr> shdrs(hdr.e_shnum);
+        if (bytes(hdr.e_shoff, shdrs.size() * sizeof(Elf64_Shdr), shdrs.data()) == false)
+            return kernel;
+        for (auto& sh : shdrs) {
+            if (sh.sh_type != SHT_NOTE || kernel.version)
+                continue;
+            notes.resize(sh.sh_size);
+            if (bytes(sh.sh_offset, notes.size(), notes.data()))
+                kernel.version = noteVersion(notes);
+        }
+    } catch (const std::exception&) {
+        kernel.bootable = false;
+    }
+    return kernel;
+}
+
+// One index per set of roots, a boot menu asks for the same ones each time
+std::filesystem::path beastie::CKernelIndex::indexPath(std::span<const std::filesystem::path> roots,
+                                                       std::filesystem::path cachedir)
+{
+    uint64_t h = hash64(std::string_view(MAGIC));
+    for (auto& root : roots)
+        h = hash64(root.string() + '\n', h);
+    return cachedir/std::format("{:016x}.kernels", h);
+}
+
+/*
+ * Documentation for the index, a text file:
+ *
+ *   beastie-kernels 1
+ *   <bootable> <version> <loadsize> <dev> <ino> <size> <mtime> <ctime> <path>
+ *   ...
+ *
+ * NOTES:
+ *   - A kernel that isn't there is listed with a zero identity.
+ *
+ ****/
+std::vector<kernelentry> beastie::CKernelIndex::readIndex(std::filesystem::path path)
+{
+    std::vector<kernelentry> kernels;
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec) == false)
+        return kernels;
+
+    auto lines = slurpLines(path);
+    if (lines.empty() || lines[0] != std::format("{} {}", MAGIC, VERSION))
+        return kernels;
+
+    for (size_t i = 1; i < lines.size(); ++i) {
+        std::istringstream line(lines[i]);
+        kernelentry kernel;
+        if (!(line >> kernel.bootable >> kernel.version >> kernel.loadsize >>
+              kernel.id.dev >> kernel.id.ino >> kernel.id.size >> kernel.id.mtime >> kernel.id.ctime))
+            return {};
+        std::getline(line >> std::ws, kernel.id.path);
+        kernels.push_back(kernel);
+    }
+    return kernels;
+}
+
+void beastie::CKernelIndex::writeIndex(std::filesystem::path path, std::span<const kernelentry> kernels)
+{
+    std::string text = std::format("{} {}\n", MAGIC, VERSION);
+    for (auto& k : kernels)
+        text += std::format("{:d} {} {} {} {} {} {} {} {}\n", k.bootable, k.version, k.loadsize,
+                            k.id.dev, k.id.ino, k.id.size, k.id.mtime, k.id.ctime, k.id.path);
+
+    std::filesystem::create_directories(path.parent_path());
+    writeAtomic(path, text);
+}
+
+std::vector<kernelentry> beastie::CKernelIndex::scan(std::span<const std::filesystem::path> roots,
+                                                     std::filesystem::path cachedir)
+{
+    std::vector<kernelentry> cached;
+    if (cachedir.empty() == false) {
+        try {
+            cached = readIndex(indexPath(roots, cachedir));
+        } catch (const std::exception&) {
+        }
+    }
+
+    auto& pipeline = CLoadPipeline::instance();
+    std::vector<kernelentry> kernels(roots.size());
+    std::vector<CLoadPipeline::Task<kernelentry>> probes(roots.size());
+    bool changed = cached.size() != roots.size();
+    for (size_t i = 0; i < roots.size(); ++i) {
+        auto path = roots[i]/"boot/kernel/kernel";
+        auto id = CImageCache::identify(path).value_or(fileid{path.string(), 0, 0, 0, 0, 0});
+        auto it = std::find_if(cached.begin(), cached.end(), [&](auto& kernel) {
+            return kernel.id == id;
+        });
+        if (it != cached.end()) {
+            kernels[i] = *it;
+            continue;
+        }
+
+        changed = true;
+        if (id.ino == 0)
+            kernels[i] = kernelentry{id, false, 0, 0};
+        else
+            probes[i] = pipeline.async([path]() {
+                return probe(path);
+            });
+    }
+
+    for (size_t i = 0; i < roots.size(); ++i) {
+        if (probes[i].valid())
+            kernels[i] = probes[i].get();
+    }
+
+    // unwritable is fine, the changed roots are probed again next scan
+    if (changed && cachedir.empty() == false) {
+        try {
+            writeIndex(indexPath(roots, cachedir), kernels);
+        } catch (const std::exception&) {
+        }
+    }
+    return kernels;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <elf.h>
+
+namespace beastie {
+
+// The kernel of a root, as far as its headers tell
+struct kernelentry {
+    fileid id;              // path only when it can't be stat'ed
+    bool bootable;          // a FreeBSD amd64 kernel
+    uint32_t version;       // __FreeBSD_version from its ABI note, 0 if none
+    uint64_t loadsize;      // memory its PT_LOAD segments span
+};
+
+// Knows the kernels (boot/kernel/kernel) of many roots, boot environments
+// for a menu, from the ELF header, the program headers and the version
+// note alone. Roots are probed concurrently on the load pipeline.
+class CKernelIndex
+{
+public:
+    // Index the roots, in order. Kernels that didn't change come from an
+    // index cached in cachedir (none when empty)
+    static std::vector<kernelentry> scan(std::span<const std::filesystem::path> roots,
+                                         std::filesystem::path cachedir);
+
+    // Read the headers of a kernel, streaming only the first bytes if compressed
+    static kernelentry probe(std::filesystem::path path);
+
+    // The header checks of elfLoad(), for any ELF file beastie loads
+    static bool valid(const Elf64_Ehdr& hdr);
+
+private:
+    constexpr static char MAGIC[] = "beastie-kernels";
+    constexpr static uint32_t VERSION = 1;
+    constexpr static size_t PREFIX_MAX = 1 << 20;
+
+    static std::filesystem::path indexPath(std::span<const std::filesystem::path> roots,
+                                           std::filesystem::path cachedir);
+    static std::vector<kernelentry> readIndex(std::filesystem::path path);
+    static void writeIndex(std::filesystem::path path, std::span<const kernelentry> kernels);
+};
+} // namespace beastie
@@ -0,0 +1,103 @@
+#include "clayoutplanner.hxx"
+#include "constants.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cassert>
+#include <format>
+#include <stdexcept>
+
+constexpr static size_t PAGE = 4096;
+
+beastie::CLayoutPlanner::CLayoutPlanner(const smapinfo& smap)
+    : m_usable()
+    , m_blobs()
+    , m_cursor(0)
+{
+    for (auto& e : smap.e820_table) {
+        if (e.type != SMAP_TYPE_MEMORY || e.size == 0)
+            continue;
+        m_usable.push_back({e.addr, e.addr + e.size});
+    }
+
+    // sort and merge touching entries, firmware often splits RAM
+    std::sort(m_usable.begin(), m_usable.end());
+    std::vector<std::pair<uintptr_t, uintptr_t>> merged;
+    for (auto& r : m_usable) {
+        if (merged.empty() == false && r.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, r.second);
+        else
+            merged.push_back(r);
+    }
+    m_usable = std::move(merged);
+}
+
+void beastie::CLayoutPlanner::reserve(std::string_view name, uintptr_t phys, size_t size)
+{
+    m_blobs.push_back({std::string(name), phys, size});
+}
+
+void beastie::CLayoutPlanner::setCursor(uintptr_t phys)
+{
+    m_cursor = phys;
+}
+
+uintptr_t beastie::CLayoutPlanner::place(std::string_view name, size_t size, size_t align)
+{
+    uintptr_t phys = howmany(m_cursor, align) * align;
+    m_blobs.push_back({std::string(name), phys, size});
+    m_cursor = phys + size;
+    return phys;
+}
+
+void beastie::CLayoutPlanner::check()
+{
+    auto blobs = m_blobs;
+    std::sort(blobs.begin(), blobs.end(), [](auto& a, auto& b) {
+        return a.phys < b.phys;
+    });
+
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        auto& b = blobs[i];
+        if (i > 0 && blobs[i - 1].phys + blobs[i - 1].size > b.phys)
+            throw std::runtime_error(std::format("{} overlaps {}", b.name, blobs[i - 1].name));
+
+        // an empty memory map (odd firmware) can't tell us anything
+        if (m_usable.empty() || b.size == 0)
+            continue;
+
+        bool usable = std::any_of(m_usable.begin(), m_usable.end(), [&b](auto& r) {
+            return b.phys >= r.first && b.phys + b.size <= r.second;
+        });
+        if (usable == false)
+            throw std::runtime_error(std::format("{} at 0x{:x}-0x{:x} is not in usable RAM",
+                                                 b.name, b.phys, b.phys + b.size));
+    }
+}
+
+loadsegment beastie::CLayoutPlanner::coalesce(std::span<const part> parts, size_t memsz,
+                                              std::vector<char>& block)
+{
+    assert(parts.empty() == false);
+    uintptr_t base = parts.front().phys;
+    assert(base % PAGE == 0);
+
+    size_t bufsz = 0;
+    for (auto& p : parts) {
+        // empty parts may have no address at all
+        if (p.builder->size() == 0)
+            continue;
+        assert(p.phys >= base + bufsz);
+        bufsz = p.phys - base + p.builder->size();
+    }
+
+    block.assign(bufsz, 0);
+    for (auto& p : parts) {
+        if (p.builder->size() > 0)
+            p.builder->gather(std::span<char>(block.data() + (p.phys - base), p.builder->size()));
+    }
+
+    assert(bufsz <= memsz);
+    return {block.data(), bufsz, base, memsz};
+}
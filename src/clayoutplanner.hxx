@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.hxx"
+#include "csegmentbuilder.hxx"
+using namespace beastie;
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+// Places the blobs of the image in physical memory. The kernel wants
+// everything it is handed between its own image and kernend, so blobs
+// are packed one after the other and checked against the usable RAM of
+// the memory map.
+class CLayoutPlanner
+{
+public:
+    CLayoutPlanner(const smapinfo& smap);
+
+    // Claim a range at a fixed address (kernel, boot block)
+    void reserve(std::string_view name, uintptr_t phys, size_t size);
+
+    // Where place() continues
+    void setCursor(uintptr_t phys);
+    uintptr_t cursor() {
+        return m_cursor;
+    }
+
+    // Place size bytes after the previous blob, returns the address
+    uintptr_t place(std::string_view name, size_t size, size_t align);
+
+    // Throw unless every blob lies in usable RAM without overlapping
+    void check();
+
+    // Gather blobs placed back to back into one page aligned segment,
+    // the gaps between them are zeroed. block is the only allocation.
+    struct part {
+        uintptr_t phys;
+        CSegmentBuilder* builder;
+    };
+    static loadsegment coalesce(std::span<const part> parts, size_t memsz,
+                                std::vector<char>& block);
+
+private:
+    struct blob {
+        std::string name;
+        uintptr_t phys;
+        size_t size;
+    };
+
+    std::vector<std::pair<uintptr_t, uintptr_t>> m_usable;
+    std::vector<blob> m_blobs;
+    uintptr_t m_cursor;
+};
+} // namespace beastie
@@ -0,0 +1,157 @@
+#include "clinkerhints.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+beastie::CLinkerHints::CLinkerHints()
+    : m_index()
+    , m_dirs()
+{
+}
+
+void beastie::CLinkerHints::clear()
+{
+    m_index.clear();
+    m_dirs.clear();
+}
+
+void beastie::CLinkerHints::addDirectory(std::filesystem::path dir)
+{
+    for (auto& d : m_dirs) {
+        if (d == dir)
+            return;
+    }
+    m_dirs.push_back(dir);
+
+    std::filesystem::path path = dir/"linker.hints";
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    if (ec || size < sizeof(int))
+        return;
+    if (size > LINKER_HINTS_MAX)
+        throw std::runtime_error(std::format("{}: too large", path.string()));
+
+    // one read for the whole file, everything else happens in memory
+    auto hints = slurp<std::string>(path);
+    int version;
+    std::memcpy(&version, hints.data(), sizeof(version));
+    if (version != LINKER_HINTS_VERSION)
+        throw std::runtime_error(std::format("{}: unsupported version {}", path.string(), version));
+
+    parse(dir, std::string_view(hints).substr(sizeof(int)));
+}
+
+/*
+ * Documentation for linker.hints (written by kldxref):
+ *
+ * header
+ *   . int     version
+ *
+ * records
+ *   . int     length of the record
+ *   . int     type (MDT_*)
+ *   . ...     type specific data
+ *
+ * MDT_VERSION data
+ *   . str     module name
+ *   . int     version (aligned to an int from the start of the record)
+ *   . str     file name
+ *
+ * MDT_MODULE data
+ *   . str     module name
+ *   . str     file name
+ *
+ * NOTES:
+ *   - Strings are a length byte followed by the characters, no NUL.
+ *   - Integers are stored in host byte order.
+ *
+ ****/
+void beastie::CLinkerHints::parse(std::filesystem::path dir, std::string_view hints)
+{
+    size_t pos = 0;
+
+    while (pos + sizeof(int) <= hints.size()) {
+        int reclen;
+        std::memcpy(&reclen, hints.data() + pos, sizeof(reclen));
+        pos += sizeof(int);
+        if (reclen <= 0 || pos + reclen > hints.size())
+            break;
+
+        std::string_view rec = hints.substr(pos, reclen);
+        pos += reclen;
+
+        size_t cp = 0;
+        auto integer = [&rec, &cp]() {
+            int v = 0;
+            cp = howmany(cp, sizeof(int)) * sizeof(int);
+            if (cp + sizeof(int) <= rec.size())
+                std::memcpy(&v, rec.data() + cp, sizeof(int));
+            cp += sizeof(int);
+            return v;
+        };
+        auto string = [&rec, &cp]() {
+            if (cp >= rec.size())
+                return std::string_view();
+            size_t len = uint8_t(rec[cp++]);
+            auto s = rec.substr(std::min(cp, rec.size()), len);
+            cp += len;
+            return s;
+        };
+
+        int type = integer();
+        if (type == MDT_VERSION) {
+            auto name = string();
+            int version = integer();
+            auto file = string();
+            m_index[std::string(name)].push_back({version, dir/file});
+        } else if (type == MDT_MODULE) {
+            auto name = string();
+            auto file = string();
+            m_index[std::string(name)].push_back({-1, dir/file});
+        }
+    }
+}
+
+std::optional<std::filesystem::path> beastie::CLinkerHints::lookup(std::string_view modname,
+                                                                   const moddepend* verinfo)
+{
+    auto it = m_index.find(std::string(modname));
+    if (it != m_index.end()) {
+        const record* best = nullptr;
+        const record* any = nullptr;
+
+        // same rules as file_lookup_modname() in the FreeBSD loader: without
+        // version info the first versioned record wins, otherwise the
+        // preferred version, otherwise the newest version within range
+        for (auto& r : it->second) {
+            if (r.version < 0) {
+                any = any ? any : &r;
+                continue;
+            }
+            if (verinfo == nullptr || r.version == verinfo->preferred)
+                return r.path;
+            if (r.version < verinfo->minimum || r.version > verinfo->maximum)
+                continue;
+            if (best == nullptr || r.version > best->version)
+                best = &r;
+        }
+        if (best)
+            return best->path;
+        if (any && verinfo == nullptr)
+            return any->path;
+    }
+
+    // not indexed, try <dir>/<name>.ko like the loader does
+    std::string file(modname);
+    if (file.ends_with(".ko") == false)
+        file += ".ko";
+    for (auto& d : m_dirs) {
+        if (std::filesystem::exists(d/file))
+            return d/file;
+    }
+    return std::nullopt;
+}
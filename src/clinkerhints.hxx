@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace beastie {
+class CLinkerHints
+{
+public:
+    CLinkerHints();
+
+    void clear();
+
+    // Index the linker.hints of a module directory, a missing file is fine
+    void addDirectory(std::filesystem::path dir);
+
+    // Find the file providing a module, optionally within a version range
+    std::optional<std::filesystem::path> lookup(std::string_view modname,
+                                                const moddepend* verinfo = nullptr);
+
+private:
+    constexpr static int LINKER_HINTS_VERSION = 1;
+    constexpr static int LINKER_HINTS_MAX = 1024 * 1024 * 16;
+    constexpr static int MDT_DEPEND  = 1;
+    constexpr static int MDT_MODULE  = 2;
+    constexpr static int MDT_VERSION = 3;
+
+    struct record {
+        int version;        // -1 for MDT_MODULE records
+        std::filesystem::path path;
+    };
+
+    std::unordered_map<std::string, std::vector<record>> m_index;
+    std::vector<std::filesystem::path> m_dirs;
+
+    void parse(std::filesystem::path dir, std::string_view hints);
+};
+} // namespace beastie
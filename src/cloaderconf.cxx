@@ -0,0 +1,135 @@
+#include "cloaderconf.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+namespace {
+bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+void skipSpace(std::string_view& s)
+{
+    while (s.empty() == false && isSpace(s.front()))
+        s.remove_prefix(1);
+}
+
+// name = "value" or name = value, the rest of the line empty or a comment
+bool parseLine(std::string_view line, loadervar& var)
+{
+    skipSpace(line);
+    size_t end = 0;
+    while (end < line.size() && line[end] != '=' && line[end] != '#' && isSpace(line[end]) == false)
+        ++end;
+    if (end == 0)
+        return false;
+    std::string_view name = line.substr(0, end);
+    line.remove_prefix(end);
+
+    skipSpace(line);
+    if (line.starts_with("=") == false)
+        return false;
+    line.remove_prefix(1);
+    skipSpace(line);
+
+    std::string_view value;
+    if (line.starts_with("\"")) {
+        size_t close = line.find('"', 1);
+        if (close == std::string_view::npos)
+            return false;
+        value = line.substr(1, close - 1);
+        line.remove_prefix(close + 1);
+    } else {
+        end = 0;
+        while (end < line.size() && line[end] != '#' && isSpace(line[end]) == false)
+            ++end;
+        value = line.substr(0, end);
+        line.remove_prefix(end);
+    }
+
+    skipSpace(line);
+    if (line.empty() == false && line.front() != '#')
+        return false;
+    var = {std::string(name), std::string(value)};
+    return true;
+}
+} // namespace
+
+/*
+ * Documentation for loader.conf and device.hints (see loader.conf(5)):
+ *
+ *   # comment
+ *   name="value"        # comment
+ *   name=value
+ *
+ * NOTES:
+ *   - Every assignment goes to the kernel env, like loader(8) passes
+ *       its whole environment on. *_load lines don't load anything here.
+ *   - /boot/defaults/loader.conf is not read, the kernel has its own
+ *       defaults for what it leaves unset.
+ *
+ ****/
+std::vector<loadervar> beastie::CLoaderConf::parse(std::string_view text)
+{
+    std::vector<loadervar> vars;
+    while (text.empty() == false) {
+        size_t eol = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+        loadervar var;
+        if (parseLine(line, var))
+            vars.push_back(std::move(var));
+    }
+    return vars;
+}
+
+loadervar beastie::CLoaderConf::assignment(std::string_view text)
+{
+    auto eq = text.find('=');
+    if (eq == 0 || eq == std::string_view::npos)
+        throw std::runtime_error(std::format("{}: not a name=value assignment", text));
+
+    std::string_view value = text.substr(eq + 1);
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        value = value.substr(1, value.size() - 2);
+    return {std::string(text.substr(0, eq)), std::string(value)};
+}
+
+std::vector<std::filesystem::path> beastie::CLoaderConf::files(std::filesystem::path root)
+{
+    auto boot = root/"boot";
+    std::vector<std::filesystem::path> files = {boot/"device.hints", boot/"loader.conf"};
+
+    std::vector<std::filesystem::path> dropins;
+    std::error_code ec;
+    for (auto& entry : std::filesystem::directory_iterator(boot/"loader.conf.d", ec)) {
+        if (entry.path().extension() == ".conf")
+            dropins.push_back(entry.path());
+    }
+    std::sort(dropins.begin(), dropins.end());
+    files.insert(files.end(), dropins.begin(), dropins.end());
+
+    files.push_back(boot/"loader.conf.local");
+    return files;
+}
+
+std::vector<loadervar> beastie::CLoaderConf::read(std::filesystem::path root)
+{
+    // small files, read in one batch
+    auto paths = files(root);
+    auto texts = slurpMany(paths);
+
+    std::vector<loadervar> vars;
+    for (auto& text : texts) {
+        if (text.has_value() == false)
+            continue;
+        auto more = parse(*text);
+        std::move(more.begin(), more.end(), std::back_inserter(vars));
+    }
+    return vars;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+// A loader variable, for the kernel env
+struct loadervar {
+    std::string name;
+    std::string value;
+};
+
+// Reads the loader configuration of a root the way loader(8) does:
+// device.hints, loader.conf, loader.conf.d/*.conf then loader.conf.local,
+// a later assignment of a variable overriding an earlier one.
+class CLoaderConf
+{
+public:
+    // The variables of root in assignment order, files that don't exist
+    // are skipped
+    static std::vector<loadervar> read(std::filesystem::path root);
+
+    // The assignments in text, lines that don't parse are skipped
+    static std::vector<loadervar> parse(std::string_view text);
+
+    // A name=value assignment (-e), throws without a '='
+    static loadervar assignment(std::string_view text);
+
+    // The files read() reads, in order
+    static std::vector<std::filesystem::path> files(std::filesystem::path root);
+};
+} // namespace beastie
@@ -0,0 +1,158 @@
+#include "cloadpipeline.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+beastie::CLoadPipeline::CLoadPipeline()
+    : m_workers(std::clamp(std::thread::hardware_concurrency(), 1u, 4u))
+    , m_threads()
+    , m_lock()
+    , m_wake()
+    , m_queue()
+    , m_files()
+    , m_stopping(false)
+{
+}
+
+beastie::CLoadPipeline::~CLoadPipeline()
+{
+    stop();
+}
+
+beastie::CLoadPipeline& beastie::CLoadPipeline::instance()
+{
+    static CLoadPipeline pipeline;
+    return pipeline;
+}
+
+void beastie::CLoadPipeline::setWorkers(unsigned workers)
+{
+    stop();
+    m_workers = workers;
+}
+
+// Threads are only started once there is something to do
+void beastie::CLoadPipeline::start()
+{
+    m_stopping = false;
+    for (unsigned i = 0; i < m_workers; ++i)
+        m_threads.emplace_back(&CLoadPipeline::work, this);
+}
+
+// Queued jobs are dropped, a Task still runs its own in get()
+void beastie::CLoadPipeline::stop()
+{
+    {
+        std::lock_guard guard(m_lock);
+        m_stopping = true;
+        m_queue.clear();
+    }
+    m_wake.notify_all();
+    for (auto& t : m_threads)
+        t.join();
+    m_threads.clear();
+}
+
+void beastie::CLoadPipeline::work()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock guard(m_lock);
+            m_wake.wait(guard, [this]() {
+                return m_stopping || m_queue.empty() == false;
+            });
+            if (m_stopping)
+                return;
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        job();
+    }
+}
+
+void beastie::CLoadPipeline::submit(std::function<void()> job)
+{
+    if (m_workers == 0)
+        return;
+    {
+        std::lock_guard guard(m_lock);
+        if (m_threads.empty())
+            start();
+        m_queue.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+}
+
+void beastie::CLoadPipeline::readahead(std::filesystem::path path)
+{
+    submit([path]() {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+            ::readahead(fd, 0, st.st_size);
+        close(fd);
+    });
+}
+
+void beastie::CLoadPipeline::prefetch(std::filesystem::path path, bool sha256)
+{
+    auto task = async([path, sha256]() {
+        loaded l;
+        if (sha256 == false) {
+            l.file = zmap(path);
+            return l;
+        }
+        CSha256 hash;
+        l.file = zmap(path, &hash);
+        l.sha256 = hash.final();
+        return l;
+    });
+    std::lock_guard guard(m_lock);
+    m_files[path.string()] = std::move(task);
+}
+
+CMappedFile beastie::CLoadPipeline::take(std::filesystem::path path, CSha256::digest* sha256)
+{
+    Task<loaded> task;
+    {
+        std::lock_guard guard(m_lock);
+        auto it = m_files.find(path.string());
+        if (it != m_files.end()) {
+            task = std::move(it->second);
+            m_files.erase(it);
+        }
+    }
+
+    loaded l;
+    if (task.valid())
+        l = task.get();
+    else if (sha256 == nullptr)
+        l.file = zmap(path);
+
+    // not prefetched, or prefetched without hashing
+    if (sha256 && l.sha256.has_value() == false) {
+        CSha256 hash;
+        l.file = zmap(path, &hash);
+        l.sha256 = hash.final();
+    }
+    if (sha256)
+        *sha256 = *l.sha256;
+    return std::move(l.file);
+}
+
+// A queued read of theirs is skipped rather than run for nothing
+void beastie::CLoadPipeline::discard()
+{
+    std::lock_guard guard(m_lock);
+    for (auto& [path, task] : m_files)
+        task.m_state->claimed.exchange(true);
+    m_files.clear();
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "cmappedfile.hxx"
+#include "csha256.hxx"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace beastie {
+
+// Reads, decompresses and decodes boot files on a few worker threads
+// while the caller parses the ones it already has. Work is queued and
+// taken by whichever thread gets to it first: a worker, or the caller
+// that needs the result, which then runs it itself instead of waiting.
+// With no workers everything runs in the caller, as it did serially.
+class CLoadPipeline
+{
+public:
+    // A queued job and its result
+    template<class R>
+    class Task
+    {
+    public:
+        Task() = default;
+
+        bool valid() {
+            return m_state != nullptr;
+        }
+
+        // The result, running the job here if nobody started it yet.
+        // Rethrows what the job threw.
+        R get() {
+            if (m_state->claimed.exchange(true) == false)
+                m_state->task();
+            auto state = std::move(m_state);
+            return state->result.get();
+        }
+
+    private:
+        friend class CLoadPipeline;
+        struct state {
+            std::packaged_task<R()> task;
+            std::future<R> result;
+            std::atomic<bool> claimed{false};
+        };
+        std::shared_ptr<state> m_state;
+    };
+
+    static CLoadPipeline& instance();
+    ~CLoadPipeline();
+
+    // Number of worker threads, 0 runs everything in the caller
+    void setWorkers(unsigned workers);
+    unsigned workers() {
+        return m_workers;
+    }
+
+    // Queue f, get() its result
+    template<class F>
+    auto async(F f) -> Task<std::invoke_result_t<F>>
+    {
+        using R = std::invoke_result_t<F>;
+        Task<R> t;
+        t.m_state = std::make_shared<typename Task<R>::state>();
+        t.m_state->task = std::packaged_task<R()>(std::move(f));
+        t.m_state->result = t.m_state->task.get_future();
+        submit([state = t.m_state]() {
+            if (state->claimed.exchange(true) == false)
+                state->task();
+        });
+        return t;
+    }
+
+    // Pull a file into the page cache, nothing is kept
+    void readahead(std::filesystem::path path);
+
+    // Queue zmap(path), for a later take(). With sha256 the file is
+    // hashed as it is read.
+    void prefetch(std::filesystem::path path, bool sha256 = false);
+
+    // zmap(path), prefetched or not, and its digest when asked for
+    CMappedFile take(std::filesystem::path path, CSha256::digest* sha256 = nullptr);
+
+    // Forget the prefetched files nobody took
+    void discard();
+
+private:
+    // A prefetched file
+    struct loaded {
+        CMappedFile file;
+        std::optional<CSha256::digest> sha256;
+    };
+
+    CLoadPipeline();
+    void submit(std::function<void()> job);
+    void start();
+    void stop();
+    void work();
+
+    unsigned m_workers;
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_queue;
+    std::map<std::string, Task<loaded>> m_files;
+    bool m_stopping;
+};
+} // namespace beastie
@@ -0,0 +1,96 @@
+#include "cmanifest.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <format>
+#include <stdexcept>
+
+namespace {
+// Manifests are written from the root of a tree: "./boot/kernel/kernel"
+// and "/boot/kernel/kernel" both stand for boot/kernel/kernel
+std::string_view relative(std::string_view path)
+{
+    while (true) {
+        if (path.starts_with("./"))
+            path.remove_prefix(2);
+        else if (path.starts_with("/"))
+            path.remove_prefix(1);
+        else
+            return path;
+    }
+}
+} // namespace
+
+/*
+ * Documentation for the manifest, a text file with a line per file in
+ * either of the usual formats:
+ *
+ *   SHA256 (./boot/kernel/kernel) = <64 hex digits>     (BSD)
+ *   <64 hex digits>  ./boot/kernel/kernel               (GNU, " *" for binary)
+ *   <64 hex digits> ./boot/kernel/kernel                (BSD, sha256 -r)
+ *
+ * NOTES:
+ *   - Empty lines and lines starting with '#' are skipped, anything else
+ *       that doesn't parse is an error.
+ *   - A path matches its trailing components, the tree may be mounted
+ *       anywhere. The longest match wins.
+ *
+ ****/
+CManifest beastie::CManifest::read(std::filesystem::path path)
+{
+    CManifest manifest;
+    manifest.m_path = path;
+
+    auto lines = slurpLines(path);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::string_view line = lines[i];
+        if (line.empty() || line.starts_with("#"))
+            continue;
+
+        std::string_view name;
+        std::optional<CSha256::digest> sha256;
+        if (line.starts_with("SHA256 (")) {
+            auto end = line.rfind(") = ");
+            if (end != std::string_view::npos && end >= 8) {
+                name = line.substr(8, end - 8);
+                sha256 = CSha256::parse(line.substr(end + 4));
+            }
+        }
+        else if (line.size() > 65 && line[64] == ' ') {
+            name = line.substr(65);
+            if (name.starts_with(" ") || name.starts_with("*"))
+                name.remove_prefix(1);
+            sha256 = CSha256::parse(line.substr(0, 64));
+        }
+
+        if (sha256.has_value() == false || relative(name).empty())
+            throw std::runtime_error(std::format("{}:{}: bad manifest line", path.string(), i + 1));
+        manifest.m_entries.push_back({std::string(relative(name)), *sha256});
+    }
+    return manifest;
+}
+
+std::optional<CSha256::digest> beastie::CManifest::lookup(std::filesystem::path path) const
+{
+    std::string full = path.lexically_normal().string();
+    const entry* best = nullptr;
+    for (auto& e : m_entries) {
+        bool matches = full == e.path ||
+            (full.ends_with(e.path) && full[full.size() - e.path.size() - 1] == '/');
+        if (matches && (best == nullptr || e.path.size() > best->path.size()))
+            best = &e;
+    }
+    if (best == nullptr)
+        return std::nullopt;
+    return best->sha256;
+}
+
+void beastie::CManifest::verify(std::filesystem::path path, const CSha256::digest& sha256) const
+{
+    auto expected = lookup(path);
+    if (expected.has_value() == false)
+        throw std::runtime_error(std::format("{}: not in {}", path.string(), m_path.string()));
+    if (*expected != sha256)
+        throw std::runtime_error(std::format("{}: sha256 {} doesn't match {}", path.string(),
+                                             CSha256::hex(sha256), m_path.string()));
+}
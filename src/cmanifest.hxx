@@ -0,0 +1,36 @@
+#pragma once
+
+#include "csha256.hxx"
+using namespace beastie;
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+// The expected SHA-256 of the boot files, as written by sha256(1) or
+// sha256sum(1). Its signature is checked before it is handed to us.
+class CManifest
+{
+public:
+    static CManifest read(std::filesystem::path path);
+
+    // The expected digest of path, nullopt when it isn't listed
+    std::optional<CSha256::digest> lookup(std::filesystem::path path) const;
+
+    // Throw unless path is listed with this digest
+    void verify(std::filesystem::path path, const CSha256::digest& sha256) const;
+
+private:
+    struct entry {
+        std::string path;
+        CSha256::digest sha256;
+    };
+
+    std::filesystem::path m_path;
+    std::vector<entry> m_entries;
+};
+} // namespace beastie
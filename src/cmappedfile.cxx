@@ -0,0 +1,128 @@
+#include "cmappedfile.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr static size_t PAGE = 4096;
+
+beastie::CMappedFile::CMappedFile()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_mapsize(0)
+{
+}
+
+beastie::CMappedFile::CMappedFile(std::filesystem::path path)
+    : m_data(nullptr)
+    , m_size(0)
+    , m_mapsize(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error(std::format("{}: {}", path.string(), std::strerror(errno)));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error(std::format("{}: {}", path.string(), std::strerror(err)));
+    }
+
+    if (st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error(std::format("{}: empty file", path.string()));
+    }
+
+    /*
+     * A private writable mapping costs nothing until a page is written,
+     * and lets callers patch the image in place (copy-on-write).
+     */
+    void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error(std::format("{}: {}", path.string(), std::strerror(err)));
+
+    m_data = static_cast<char*>(p);
+    m_size = st.st_size;
+    m_mapsize = st.st_size;
+}
+
+CMappedFile beastie::CMappedFile::anonymous(size_t size)
+{
+    CMappedFile mf;
+    mf.resize(size);
+    return mf;
+}
+
+beastie::CMappedFile::CMappedFile(CMappedFile&& rhs)
+    : m_data(std::exchange(rhs.m_data, nullptr))
+    , m_size(std::exchange(rhs.m_size, 0))
+    , m_mapsize(std::exchange(rhs.m_mapsize, 0))
+{
+}
+
+CMappedFile& beastie::CMappedFile::operator=(CMappedFile&& rhs)
+{
+    if (this != &rhs) {
+        close();
+        m_data = std::exchange(rhs.m_data, nullptr);
+        m_size = std::exchange(rhs.m_size, 0);
+        m_mapsize = std::exchange(rhs.m_mapsize, 0);
+    }
+    return *this;
+}
+
+beastie::CMappedFile::~CMappedFile()
+{
+    close();
+}
+
+void beastie::CMappedFile::willNeed(size_t offset, size_t length)
+{
+    if (m_data == nullptr || offset >= m_size)
+        return;
+
+    size_t start = offset & ~(PAGE - 1);
+    length = std::min(length + (offset - start), m_size - start);
+    madvise(m_data + start, length, MADV_WILLNEED);
+}
+
+void beastie::CMappedFile::resize(size_t size)
+{
+    size_t mapsize = std::max((size + PAGE - 1) & ~(PAGE - 1), PAGE);
+    void* p;
+
+    if (m_data == nullptr)
+        p = mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else if (mapsize != m_mapsize)
+        p = mremap(m_data, m_mapsize, mapsize, MREMAP_MAYMOVE);
+    else
+        p = m_data;
+
+    if (p == MAP_FAILED)
+        throw std::runtime_error(std::format("cannot map {} bytes: {}", size, std::strerror(errno)));
+
+    m_data = static_cast<char*>(p);
+    m_size = size;
+    m_mapsize = mapsize;
+}
+
+void beastie::CMappedFile::close()
+{
+    if (m_data)
+        munmap(m_data, m_mapsize);
+    m_data = nullptr;
+    m_size = 0;
+    m_mapsize = 0;
+}
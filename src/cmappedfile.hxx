@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace beastie {
+class CMappedFile
+{
+public:
+    CMappedFile();
+    CMappedFile(std::filesystem::path path);
+    CMappedFile(CMappedFile&&);
+    CMappedFile& operator=(CMappedFile&&);
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+    ~CMappedFile();
+
+    // Allocate zero-filled anonymous memory that behaves like a mapping
+    static CMappedFile anonymous(size_t size);
+
+    auto data() {
+        return m_data;
+    }
+    auto size() {
+        return m_size;
+    }
+    std::span<char> span() {
+        return std::span<char>(m_data, m_size);
+    }
+
+    // Hint that a range of the file will be read soon
+    void willNeed(size_t offset, size_t length);
+
+    // Change the visible size of anonymous memory, growing or trimming
+    // the mapping as needed
+    void resize(size_t size);
+
+    // Unmap the file
+    void close();
+
+private:
+    char* m_data;
+    size_t m_size;
+    size_t m_mapsize;
+};
+} // namespace beastie
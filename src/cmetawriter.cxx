@@ -25,8 +25,7 @@ void beastie::CMetaWriter::clear()
 
 void beastie::CMetaWriter::push(std::integral auto v)
 {
-    m_buffer.resize(m_buffer.size() + sizeof(v));
-    std::memcpy(m_buffer.end().base() - sizeof(v), &v, sizeof(v));
+    m_buffer.append(v);
 }
 
 void beastie::CMetaWriter::str(auto type, std::string_view s)
@@ -52,24 +51,19 @@ void beastie::CMetaWriter::span(auto type, std::span<char> span)
     size_t size = span.size();
     push(uint32_t(type));
     push(uint32_t(size));
-    for (char b : span)
-        push(b);
+    m_buffer.append(span);
     align(size);
 }
 
 void beastie::CMetaWriter::push(std::string_view str)
 {
-    size_t size = (str.size() + 1);
-    m_buffer.resize(m_buffer.size() + size);
-    std::memcpy(m_buffer.end().base() - size, str.data(), size);
+    m_buffer.append(std::span<const char>(str.data(), str.size()));
+    m_buffer.fill(1);
 }
 
 void beastie::CMetaWriter::align(size_t a)
 {
-    while (offset() % ALIGN)
-    {
-        push(uint8_t(0));
-    }
+    m_buffer.align(ALIGN);
 }
 
 void beastie::CMetaWriter::addEnd()
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "csegmentbuilder.hxx"
+
 #include <cstddef>
 #include <cstdint>
 #include <string_view>
@@ -20,8 +22,11 @@ public:
     auto size() {
         return m_buffer.size();
     }
-    std::span<char> span() {
-        return std::span<char>(m_buffer.begin(), m_buffer.end());
+    std::span<const char> span() {
+        return std::span<const char>(m_buffer.data(), m_buffer.size());
+    }
+    auto& builder() {
+        return m_buffer;
     }
 
     void addEnd();
@@ -35,7 +40,7 @@ public:
     void addMetadata(int type, std::span<char>);
 
 private:
-    std::vector<char> m_buffer;
+    CSegmentBuilder m_buffer;
 
 
 private:
@@ -46,7 +51,7 @@ private:
     void span(auto, std::span<char>);
     void align(size_t);
     size_t offset() {
-        return (m_buffer.end() - m_buffer.begin());
+        return m_buffer.size();
     }
 };
 } // namespace beastie
@@ -5,6 +5,10 @@
 namespace beastie {
 constexpr std::string_view progname = "beastie";
 constexpr std::string_view progvers = "0.1";
+constexpr std::string_view cachedir = "/var/cache/beastie";
+constexpr std::string_view bundlename = "beastie.bundle";
+constexpr std::string_view stagefile = "/run/beastie.staged";
+constexpr std::string_view socketpath = "/run/beastied.sock";
 
 constexpr int RB_AUTOBOOT = 0;       /* flags for system auto-booting itself */
 constexpr int RB_ASKNAME  = 0x001;   /* force prompt of device of root filesystem */
@@ -0,0 +1,28 @@
+#include "cprofiler.hxx"
+using namespace beastie;
+
+#include <cstdlib>
+#include <new>
+
+// Linked into the executables only: a library must not replace the
+// operator new of the process that loads it.
+
+// count every allocation, a relaxed increment is all it costs
+void* operator new(std::size_t size)
+{
+    CProfiler::countAllocation();
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
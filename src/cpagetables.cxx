@@ -0,0 +1,51 @@
+#include "cpagetables.hxx"
+using namespace beastie;
+
+#include <cassert>
+
+beastie::CPageTables::CPageTables(uintptr_t phys, bool gbpages)
+    : m_phys(phys)
+    , m_gbpages(gbpages)
+    , m_entries(ENTRIES, 0)
+{
+    assert(phys % 4096 == 0);
+}
+
+size_t beastie::CPageTables::child(size_t table, unsigned index)
+{
+    // m_entries may move below, only hold indices
+    size_t slot = table * ENTRIES + index;
+    assert((m_entries[slot] & PG_PS) == 0);
+
+    if (m_entries[slot] == 0) {
+        size_t next = tables();
+        m_entries.resize(m_entries.size() + ENTRIES, 0);
+        m_entries[slot] = (m_phys + next * 4096) | PG_RW | PG_P;
+        return next;
+    }
+    return ((m_entries[slot] & ~uint64_t(0xfff)) - m_phys) / 4096;
+}
+
+void beastie::CPageTables::map(uint64_t virt, uint64_t phys, uint64_t size)
+{
+    uint64_t page = pageSize();
+    uint64_t skew = virt % page;
+    assert(skew == phys % page);
+
+    virt -= skew;
+    phys -= skew;
+    size += skew;
+
+    for (uint64_t off = 0; off < size; off += page) {
+        uint64_t va = virt + off;
+        size_t pdpt = child(0, (va >> 39) & 511);
+
+        size_t table = pdpt;
+        unsigned index = (va >> 30) & 511;
+        if (m_gbpages == false) {
+            table = child(pdpt, index);
+            index = (va >> 21) & 511;
+        }
+        m_entries[table * ENTRIES + index] = (phys + off) | PG_PS | PG_RW | PG_P;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace beastie {
+
+// The 4-level page tables the trampoline loads into cr3, computed on the
+// host. Tables are one page each, allocated as mappings need them and
+// laid out back to back from a known physical address, the PML4 first.
+class CPageTables
+{
+public:
+    // phys is where data() will be loaded, page aligned
+    CPageTables(uintptr_t phys, bool gbpages);
+
+    // Map [virt, virt + size) to phys with 1 GiB pages when the cpu has
+    // them, 2 MiB pages otherwise. The range grows to page boundaries.
+    void map(uint64_t virt, uint64_t phys, uint64_t size);
+
+    // The physical address of the PML4
+    uintptr_t root() {
+        return m_phys;
+    }
+
+    // Size of a leaf page
+    uint64_t pageSize() {
+        return m_gbpages ? GIGA : TWOMEG;
+    }
+
+    size_t tables() {
+        return m_entries.size() / ENTRIES;
+    }
+
+    std::span<const char> data() {
+        return {(const char*)m_entries.data(), m_entries.size() * sizeof(uint64_t)};
+    }
+
+private:
+    constexpr static size_t ENTRIES = 512;
+    constexpr static uint64_t TWOMEG = 1ULL << 21;
+    constexpr static uint64_t GIGA = 1ULL << 30;
+    constexpr static uint64_t PG_P = 0x01;   // present
+    constexpr static uint64_t PG_RW = 0x02;  // writable
+    constexpr static uint64_t PG_PS = 0x80;  // leaf above level 1
+
+    uintptr_t m_phys;
+    bool m_gbpages;
+    std::vector<uint64_t> m_entries;
+
+    // Table number of the table entry index of table points to, made on demand
+    size_t child(size_t table, unsigned index);
+};
+} // namespace beastie
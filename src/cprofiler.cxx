@@ -0,0 +1,196 @@
+#include "cprofiler.hxx"
+#include "constants.hxx"
+using namespace beastie;
+
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+std::atomic<uint64_t> beastie::CProfiler::s_allocations{0};
+
+static void faults(long& minflt, long& majflt)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    minflt = ru.ru_minflt;
+    majflt = ru.ru_majflt;
+}
+
+beastie::CProfiler::CProfiler()
+    : m_enabled(false)
+    , m_reported(false)
+    , m_path()
+    , m_epoch(0)
+    , m_lock()
+    , m_records()
+{
+}
+
+beastie::CProfiler& beastie::CProfiler::instance()
+{
+    static CProfiler profiler;
+    return profiler;
+}
+
+void beastie::CProfiler::enable(std::filesystem::path path)
+{
+    m_path = path;
+    m_epoch = 0;
+    m_epoch = now();
+    m_enabled = true;
+}
+
+uint64_t beastie::CProfiler::now()
+{
+    auto t = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(t).count() - m_epoch;
+}
+
+beastie::CProfiler::Phase::Phase(std::string_view name, std::string_view detail)
+    : m_name(name)
+    , m_detail(detail)
+    , m_active(CProfiler::instance().enabled())
+    , m_start(0)
+    , m_bytes(0)
+    , m_allocs(0)
+    , m_minflt(0)
+    , m_majflt(0)
+{
+    if (m_active == false)
+        return;
+    faults(m_minflt, m_majflt);
+    m_allocs = s_allocations.load(std::memory_order_relaxed);
+    m_start = CProfiler::instance().now();
+}
+
+beastie::CProfiler::Phase::~Phase()
+{
+    end();
+}
+
+void beastie::CProfiler::Phase::end()
+{
+    if (m_active == false)
+        return;
+    m_active = false;
+
+    auto& profiler = CProfiler::instance();
+    uint64_t stop = profiler.now();
+    long minflt, majflt;
+    faults(minflt, majflt);
+
+    profiler.add({
+        m_name,
+        m_detail,
+        m_start,
+        stop - m_start,
+        m_bytes,
+        s_allocations.load(std::memory_order_relaxed) - m_allocs,
+        minflt - m_minflt,
+        majflt - m_majflt,
+        false,
+        gettid(),
+    });
+}
+
+void beastie::CProfiler::add(record r)
+{
+    std::lock_guard guard(m_lock);
+    m_records.push_back(std::move(r));
+}
+
+void beastie::CProfiler::mark(std::string_view name)
+{
+    if (m_enabled == false)
+        return;
+    add({std::string(name), {}, now(), 0, 0, 0, 0, 0, true, gettid()});
+}
+
+static std::string quote(std::string_view s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if (uint8_t(c) < 0x20)
+            out += std::format("\\u{:04x}", int(uint8_t(c)));
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+/*
+ * Documentation for the report:
+ *
+ *   {
+ *     "program": "beastie", "version": "...",
+ *     "phases": [
+ *       { "name", "detail", "start_us", "duration_us", "bytes",
+ *         "allocations", "minor_faults", "major_faults" }, ...
+ *     ],
+ *     "traceEvents": [ ... ]
+ *   }
+ *
+ * NOTES:
+ *   - traceEvents makes the file loadable as is in chrome://tracing or
+ *       Perfetto, other keys are ignored there.
+ *   - Phases nest (an ELF load contains its symbol extraction), their
+ *       counters include those of the phases inside them.
+ *   - Phases of the load pipeline workers are on their own tid. The
+ *       allocation and fault counters are per process, so they include
+ *       whatever ran concurrently.
+ *
+ ****/
+void beastie::CProfiler::report()
+{
+    if (m_enabled == false || m_reported)
+        return;
+    m_reported = true;
+
+    std::lock_guard guard(m_lock);
+    std::string phases;
+    std::string events;
+    int pid = getpid();
+    for (auto& r : m_records) {
+        if (phases.empty() == false) {
+            phases += ",\n";
+            events += ",\n";
+        }
+
+        std::string counters = std::format("\"bytes\": {}, \"allocations\": {}, "
+                                           "\"minor_faults\": {}, \"major_faults\": {}",
+                                           r.bytes, r.allocs, r.minflt, r.majflt);
+        phases += std::format("    {{\"name\": {}, \"detail\": {}, \"start_us\": {}, \"duration_us\": {}, {}}}",
+                              quote(r.name), quote(r.detail), r.start, r.duration, counters);
+
+        if (r.mark)
+            events += std::format("    {{\"name\": {}, \"ph\": \"i\", \"s\": \"p\", \"ts\": {}, \"pid\": {}, \"tid\": {}}}",
+                                  quote(r.name), r.start, pid, r.tid);
+        else
+            events += std::format("    {{\"name\": {}, \"ph\": \"X\", \"ts\": {}, \"dur\": {}, \"pid\": {}, \"tid\": {}, "
+                                  "\"args\": {{\"detail\": {}, {}}}}}",
+                                  quote(r.name), r.start, r.duration, pid, r.tid, quote(r.detail), counters);
+    }
+
+    std::string json = std::format("{{\n  \"program\": {}, \"version\": {},\n"
+                                   "  \"phases\": [\n{}\n  ],\n"
+                                   "  \"traceEvents\": [\n{}\n  ]\n}}\n",
+                                   quote(progname), quote(progvers), phases, events);
+
+    if (m_path.empty()) {
+        std::cout << json << std::flush;
+        return;
+    }
+
+    std::ofstream file(m_path, std::ios::out | std::ios::trunc);
+    if (file.is_open() == false)
+        throw std::runtime_error(std::format("{}: {}", m_path.string(), std::strerror(errno)));
+    file << json;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace beastie {
+
+// Times the phases of a boot, with the bytes they processed, the
+// allocations they made and the page faults they took. Does nothing
+// until enabled. Phases may end on any thread, each gets its own lane
+// in the trace.
+class CProfiler
+{
+public:
+    static CProfiler& instance();
+
+    // Start profiling, the report goes to path (stdout when empty)
+    void enable(std::filesystem::path path);
+
+    bool enabled() {
+        return m_enabled;
+    }
+
+    // A timed phase, from construction to end() or destruction
+    class Phase
+    {
+    public:
+        Phase(std::string_view name, std::string_view detail = {});
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+        ~Phase();
+
+        void addBytes(size_t bytes) {
+            m_bytes += bytes;
+        }
+        void end();
+
+    private:
+        std::string m_name;
+        std::string m_detail;
+        bool m_active;
+        uint64_t m_start;
+        uint64_t m_bytes;
+        uint64_t m_allocs;
+        long m_minflt;
+        long m_majflt;
+    };
+
+    // A point in time, for steps that never return (shutdown handoff)
+    void mark(std::string_view name);
+
+    // Write the report, once. JSON with the phases and Chrome trace events.
+    void report();
+
+    struct record {
+        std::string name;
+        std::string detail;
+        uint64_t start;      // microseconds since enable()
+        uint64_t duration;   // microseconds, 0 for marks
+        uint64_t bytes;
+        uint64_t allocs;
+        long minflt;
+        long majflt;
+        bool mark;
+        int tid;
+    };
+
+    // Phases recorded so far, and forgetting them (benchmarks)
+    const std::vector<record>& records() {
+        return m_records;
+    }
+    void clear() {
+        m_records.clear();
+        m_reported = false;
+    }
+
+    // Called by the operator new of countingnew.cxx, which only the
+    // executables link in (allocations count as 0 without it)
+    static void countAllocation() {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    CProfiler();
+    uint64_t now();
+    void add(record r);
+
+    static std::atomic<uint64_t> s_allocations;
+    bool m_enabled;
+    bool m_reported;
+    std::filesystem::path m_path;
+    uint64_t m_epoch;
+    std::mutex m_lock;
+    std::vector<record> m_records;
+};
+} // namespace beastie
@@ -0,0 +1,99 @@
+#include "csegmentbuilder.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+beastie::CSegmentBuilder::CSegmentBuilder()
+    : m_buffer()
+    , m_pieces()
+    , m_size(0)
+{
+}
+
+void beastie::CSegmentBuilder::clear()
+{
+    m_buffer.clear();
+    m_pieces.clear();
+    m_size = 0;
+}
+
+void beastie::CSegmentBuilder::reserve(size_t size)
+{
+    m_buffer.reserve(m_buffer.size() + size);
+}
+
+const char* beastie::CSegmentBuilder::data()
+{
+    assert(contiguous());
+    if (m_pieces.empty())
+        return m_buffer.data();
+    if (m_pieces[0].external)
+        return m_pieces[0].external;
+    return m_buffer.data() + m_pieces[0].offset;
+}
+
+// The owned run at the end, a new one after a reference
+beastie::CSegmentBuilder::piece& beastie::CSegmentBuilder::owned()
+{
+    if (m_pieces.empty() || m_pieces.back().external)
+        m_pieces.push_back({nullptr, m_buffer.size(), 0});
+    return m_pieces.back();
+}
+
+void beastie::CSegmentBuilder::append(std::span<const char> bytes)
+{
+    auto& p = owned();
+    m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+    p.length += bytes.size();
+    m_size += bytes.size();
+}
+
+void beastie::CSegmentBuilder::fill(size_t count, char c)
+{
+    auto& p = owned();
+    m_buffer.resize(m_buffer.size() + count, c);
+    p.length += count;
+    m_size += count;
+}
+
+void beastie::CSegmentBuilder::align(size_t a)
+{
+    if (m_size % a)
+        fill(a - m_size % a);
+}
+
+void beastie::CSegmentBuilder::truncate(size_t size)
+{
+    assert(size <= m_size);
+    while (m_size > size) {
+        auto& p = m_pieces.back();
+        assert(p.external == nullptr);
+        size_t drop = std::min(p.length, m_size - size);
+        p.length -= drop;
+        m_size -= drop;
+        m_buffer.resize(m_buffer.size() - drop);
+        if (p.length == 0)
+            m_pieces.pop_back();
+    }
+}
+
+void beastie::CSegmentBuilder::reference(std::span<const char> bytes)
+{
+    if (bytes.empty())
+        return;
+    m_pieces.push_back({bytes.data(), 0, bytes.size()});
+    m_size += bytes.size();
+}
+
+void beastie::CSegmentBuilder::gather(std::span<char> dst)
+{
+    assert(dst.size() >= m_size);
+    char* out = dst.data();
+    for (auto& p : m_pieces) {
+        const char* src = p.external ? p.external : m_buffer.data() + p.offset;
+        std::memcpy(out, src, p.length);
+        out += p.length;
+    }
+}
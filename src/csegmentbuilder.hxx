@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include <concepts>
+
+namespace beastie {
+
+// The contents of one kexec segment: bytes written by the builder, and
+// references to memory that already holds the data (mapped files, cached
+// blobs). Nothing is copied until gather().
+class CSegmentBuilder
+{
+public:
+    CSegmentBuilder();
+
+    void clear();
+
+    // Grow the owned storage once for size more bytes
+    void reserve(size_t size);
+
+    auto size() {
+        return m_size;
+    }
+
+    // True when the contents are a single run of memory
+    bool contiguous() {
+        return m_pieces.size() <= 1;
+    }
+
+    // The contents, only valid when contiguous()
+    const char* data();
+
+    void append(std::span<const char> bytes);
+    void append(std::integral auto v) {
+        append(std::span<const char>((const char*)&v, sizeof(v)));
+    }
+    void fill(size_t count, char c = 0);
+    void align(size_t a);
+
+    // Drop owned bytes from the end
+    void truncate(size_t size);
+
+    // Refer to bytes that outlive the builder instead of copying them
+    void reference(std::span<const char> bytes);
+
+    // Write the contents (size() bytes) into dst
+    void gather(std::span<char> dst);
+
+private:
+    // a run of the owned buffer (external == nullptr) or of external memory
+    struct piece {
+        const char* external;
+        size_t offset;
+        size_t length;
+    };
+
+    std::vector<char> m_buffer;
+    std::vector<piece> m_pieces;
+    size_t m_size;
+
+    piece& owned();
+};
+} // namespace beastie
@@ -0,0 +1,242 @@
+#include "csha256.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cstring>
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+namespace {
+constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+void blocksPortable(uint32_t state[8], const uint8_t* data, size_t count)
+{
+    for (; count > 0; --count, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+                   uint32_t(data[4 * i + 2]) << 8 | uint32_t(data[4 * i + 3]);
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+/*
+ * The SHA extensions keep the state as ABEF/CDGH and do two rounds per
+ * sha256rnds2, four rounds (one K vector) per step below. Message words
+ * 16 and up come from sha256msg1/msg2 over the last four vectors:
+ *
+ *   w[i] = sigma1(w[i-2]) + w[i-7] + sigma0(w[i-15]) + w[i-16]
+ *
+ ****/
+__attribute__((target("sha,sse4.1,ssse3")))
+void blocksShaNi(uint32_t state[8], const uint8_t* data, size_t count)
+{
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);    // DCBA
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]); // HGFE
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);                           // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);                     // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);             // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);                  // CDGH
+
+    for (; count > 0; --count, data += 64) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i msg[4];
+        for (int i = 0; i < 4; ++i)
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), shuffle);
+
+        for (int i = 0; i < 16; ++i) {
+            // msg[i & 3] holds the vector four back, msg[(i + 3) & 3] the last one
+            if (i >= 4) {
+                __m128i x = _mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+                msg[i & 3] = _mm_sha256msg2_epu32(x, msg[(i + 3) & 3]);
+            }
+
+            __m128i wk = _mm_add_epi32(msg[i & 3], _mm_loadu_si128((const __m128i*)&K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            wk = _mm_shuffle_epi32(wk, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);                        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);                     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);                  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);                     // HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+bool hasShaNi()
+{
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+        return false;
+    bool sha = ebx & (1u << 29);
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+        return false;
+    bool sse41 = ecx & (1u << 19);
+    bool ssse3 = ecx & (1u << 9);
+    return sha && sse41 && ssse3;
+}
+
+const bool ShaNi = hasShaNi();
+} // namespace
+
+beastie::CSha256::CSha256()
+    : m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+    , m_block()
+    , m_fill(0)
+    , m_length(0)
+{
+}
+
+bool beastie::CSha256::accelerated()
+{
+    return ShaNi;
+}
+
+void beastie::CSha256::blocks(const uint8_t* data, size_t count)
+{
+    if (ShaNi)
+        blocksShaNi(m_state, data, count);
+    else
+        blocksPortable(m_state, data, count);
+}
+
+void beastie::CSha256::update(std::span<const char> data)
+{
+    auto p = (const uint8_t*)data.data();
+    size_t n = data.size();
+    m_length += n;
+
+    if (m_fill) {
+        size_t take = std::min(n, sizeof(m_block) - m_fill);
+        std::memcpy(m_block + m_fill, p, take);
+        m_fill += take;
+        p += take;
+        n -= take;
+        if (m_fill < sizeof(m_block))
+            return;
+        blocks(m_block, 1);
+        m_fill = 0;
+    }
+
+    // whole blocks straight from the input
+    blocks(p, n / 64);
+    p += n / 64 * 64;
+    n %= 64;
+
+    std::memcpy(m_block, p, n);
+    m_fill = n;
+}
+
+CSha256::digest beastie::CSha256::final()
+{
+    uint64_t bits = m_length * 8;
+    uint8_t pad[72] = {0x80};
+    size_t padlen = (m_fill < 56 ? 56 : 120) - m_fill;
+    for (int i = 0; i < 8; ++i)
+        pad[padlen + i] = uint8_t(bits >> (56 - 8 * i));
+    update(std::span<const char>((const char*)pad, padlen + 8));
+
+    digest d;
+    for (int i = 0; i < 8; ++i) {
+        d[4 * i] = uint8_t(m_state[i] >> 24);
+        d[4 * i + 1] = uint8_t(m_state[i] >> 16);
+        d[4 * i + 2] = uint8_t(m_state[i] >> 8);
+        d[4 * i + 3] = uint8_t(m_state[i]);
+    }
+    return d;
+}
+
+CSha256::digest beastie::CSha256::of(std::span<const char> data)
+{
+    CSha256 h;
+    h.update(data);
+    return h.final();
+}
+
+std::string beastie::CSha256::hex(const digest& d)
+{
+    constexpr char digits[] = "0123456789abcdef";
+    std::string s;
+    for (uint8_t b : d) {
+        s += digits[b >> 4];
+        s += digits[b & 15];
+    }
+    return s;
+}
+
+std::optional<CSha256::digest> beastie::CSha256::parse(std::string_view hex)
+{
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    };
+
+    digest d;
+    if (hex.size() != 2 * d.size())
+        return std::nullopt;
+    for (size_t i = 0; i < d.size(); ++i) {
+        int hi = nibble(hex[2 * i]);
+        int lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return std::nullopt;
+        d[i] = uint8_t(hi << 4 | lo);
+    }
+    return d;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace beastie {
+
+// SHA-256, fed as the data goes by (a file being read or decompressed)
+// rather than in a pass of its own. Uses the SHA extensions (SHA-NI)
+// when the cpu has them, portable code otherwise.
+class CSha256
+{
+public:
+    using digest = std::array<uint8_t, 32>;
+
+    CSha256();
+
+    void update(std::span<const char> data);
+    digest final();
+
+    // The digest of one buffer
+    static digest of(std::span<const char> data);
+
+    // Lowercase hex, and back (nullopt unless 64 hex digits)
+    static std::string hex(const digest& d);
+    static std::optional<digest> parse(std::string_view hex);
+
+    // Whether the SHA extensions are used
+    static bool accelerated();
+
+private:
+    uint32_t m_state[8];
+    uint8_t m_block[64];
+    size_t m_fill;
+    uint64_t m_length;
+
+    void blocks(const uint8_t* data, size_t count);
+};
+} // namespace beastie
@@ -0,0 +1,87 @@
+#include "cstagemanifest.hxx"
+#include "cimagecache.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <cstring>
+#include <format>
+#include <sstream>
+#include <stdexcept>
+
+
+/*
+ * Documentation for the manifest, a text file:
+ *
+ *   beastie-stage 1
+ *   key 0123456789abcdef
+ *   input <dev> <ino> <size> <mtime> <ctime> <path>
+ *   ...
+ *
+ * NOTES:
+ *   - It lives on tmpfs (/run), a reboot forgets it along with the
+ *       staged image.
+ *   - Paths are the rest of the line, they may contain spaces.
+ *
+ ****/
+void beastie::CStageManifest::write(std::filesystem::path path, const stagemanifest& manifest)
+{
+    std::string text = std::format("{} {}\nkey {:016x}\n", MAGIC, VERSION, manifest.key);
+    for (auto& id : manifest.inputs)
+        text += std::format("input {} {} {} {} {} {}\n", id.dev, id.ino, id.size, id.mtime, id.ctime, id.path);
+
+    writeAtomic(path, text);
+}
+
+std::optional<stagemanifest> beastie::CStageManifest::read(std::filesystem::path path)
+{
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec) == false)
+        return std::nullopt;
+
+    auto lines = slurpLines(path);
+    if (lines.size() < 2 || lines[0] != std::format("{} {}", MAGIC, VERSION))
+        return std::nullopt;
+
+    stagemanifest manifest;
+    std::istringstream key(lines[1]);
+    std::string tag;
+    if (!(key >> tag >> std::hex >> manifest.key) || tag != "key")
+        return std::nullopt;
+
+    for (size_t i = 2; i < lines.size(); ++i) {
+        std::istringstream line(lines[i]);
+        fileid id;
+        if (!(line >> tag >> id.dev >> id.ino >> id.size >> id.mtime >> id.ctime) || tag != "input")
+            return std::nullopt;
+        std::getline(line >> std::ws, id.path);
+        manifest.inputs.push_back(id);
+    }
+    return manifest;
+}
+
+void beastie::CStageManifest::remove(std::filesystem::path path)
+{
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+bool beastie::CStageManifest::valid(const stagemanifest& manifest)
+{
+    // catches a kexec -u since the stage. The kernel only says whether an
+    // image is loaded, not whose, so one loaded since by another tool
+    // (kexec -l) passes for ours; the sysfs file's mtime doesn't follow
+    // its value either
+    try {
+        if (slurpULL("/sys/kernel/kexec_loaded") != 1)
+            return false;
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    for (auto& id : manifest.inputs) {
+        auto now = CImageCache::identify(id.path);
+        if (now.has_value() == false || *now != id)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.hxx"
+using namespace beastie;
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace beastie {
+
+// What a --stage run left loaded in the kernel
+struct stagemanifest {
+    uint64_t key;                   // Bootloader::stageKey() of the staged image
+    std::vector<fileid> inputs;     // files the image was built from
+};
+
+// Records the image staged with kexec_load, so a later --commit can
+// reboot into it without preparing and loading it again.
+class CStageManifest
+{
+public:
+    static void write(std::filesystem::path path, const stagemanifest& manifest);
+    static std::optional<stagemanifest> read(std::filesystem::path path);
+    static void remove(std::filesystem::path path);
+
+    // The kernel still holds a loaded image and none of the inputs changed.
+    // Whether that image is still the staged one can't be checked
+    static bool valid(const stagemanifest& manifest);
+
+private:
+    constexpr static char MAGIC[] = "beastie-stage";
+    constexpr static uint32_t VERSION = 1;
+};
+} // namespace beastie
@@ -1,10 +1,16 @@
 #include "csymbolswriter.hxx"
+#include "misc.hxx"
 using namespace beastie;
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <concepts>
+#include <string_view>
+#include <unordered_map>
+
+#include <elf.h>
 
 constexpr static int ALIGN = sizeof(uintptr_t);
 
@@ -22,33 +28,133 @@ void beastie::CSymbolsWriter::clear()
 
 void beastie::CSymbolsWriter::push(std::integral auto v)
 {
-    m_buffer.resize(m_buffer.size() + sizeof(v));
-    std::memcpy(m_buffer.end().base() - sizeof(v), &v, sizeof(v));
+    m_buffer.append(v);
 }
 
-void beastie::CSymbolsWriter::push(std::vector<char> vs)
+void beastie::CSymbolsWriter::addSymTab(std::span<const char> vs)
 {
-    m_buffer.insert(m_buffer.end(), vs.begin(), vs.end());
+    push(long(vs.size()));
+    m_buffer.reference(vs);
+    align(sizeof(long));
 }
 
-void beastie::CSymbolsWriter::addSymTab(std::vector<char> vs)
+void beastie::CSymbolsWriter::addStrTab(std::span<const char> vs)
 {
     push(long(vs.size()));
-    push(vs);
+    m_buffer.reference(vs);
     align(sizeof(long));
 }
 
-void beastie::CSymbolsWriter::addStrTab(std::vector<char> vs)
+/*
+ * Same layout as addSymTab() followed by addStrTab():
+ *
+ *   . long    symbol table size
+ *   . char[]  symbol table (Elf64_Sym[])
+ *   . long    string table size
+ *   . char[]  string table
+ *
+ * The first pass picks the symbols and builds the string offsets, the
+ * second appends both tables to storage reserved for their final size.
+ *
+ ****/
+void beastie::CSymbolsWriter::addSymbols(std::span<const char> symtab,
+                                         std::span<const char> strtab,
+                                         unsigned filter)
 {
-    push(long(vs.size()));
-    push(vs);
+    if (filter == KeepAll) {
+        addSymTab(symtab);
+        addStrTab(strtab);
+        return;
+    }
+
+    size_t nsyms = symtab.size() / sizeof(Elf64_Sym);
+    auto name = [&strtab](Elf64_Word off) {
+        if (off >= strtab.size())
+            return std::string_view();
+        return std::string_view(strtab.data() + off, strnlen(strtab.data() + off, strtab.size() - off));
+    };
+
+    std::vector<Elf64_Sym> syms;
+    std::vector<uint32_t> names;
+    std::vector<std::string_view> strings;
+    std::unordered_map<std::string_view, uint32_t> unique;
+    syms.reserve(nsyms);
+    names.reserve(nsyms);
+    unique.reserve(nsyms);
+
+    for (size_t i = 0; i < nsyms; ++i) {
+        Elf64_Sym sym;
+        std::memcpy(&sym, symtab.data() + i * sizeof(sym), sizeof(sym));
+
+        // index 0 is the undefined symbol, always there
+        if (i > 0) {
+            auto type = ELF64_ST_TYPE(sym.st_info);
+            if ((filter & DropLocal) && ELF64_ST_BIND(sym.st_info) == STB_LOCAL)
+                continue;
+            if ((filter & DropDebug) && (type == STT_FILE || type == STT_SECTION || sym.st_name == 0))
+                continue;
+        }
+
+        auto s = name(sym.st_name);
+        uint32_t index = UINT32_MAX;
+        if (s.empty() == false) {
+            auto [it, fresh] = unique.try_emplace(s, uint32_t(strings.size()));
+            if (fresh)
+                strings.push_back(s);
+            index = it->second;
+        }
+        syms.push_back(sym);
+        names.push_back(index);
+    }
+
+    // share tails like the linker does, a string that ends another one
+    // sorts right after it when compared backwards
+    std::vector<uint32_t> order(strings.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&strings](uint32_t a, uint32_t b) {
+        return std::lexicographical_compare(strings[a].rbegin(), strings[a].rend(),
+                                            strings[b].rbegin(), strings[b].rend());
+    });
+
+    std::vector<Elf64_Word> stroffsets(strings.size());
+    std::vector<uint32_t> written;
+    size_t strsize = 1;
+    std::string_view owner;
+    Elf64_Word owneroff = 0;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        auto s = strings[*it];
+        if (owner.ends_with(s)) {
+            stroffsets[*it] = owneroff + (owner.size() - s.size());
+            continue;
+        }
+        owner = s;
+        owneroff = strsize;
+        stroffsets[*it] = owneroff;
+        written.push_back(*it);
+        strsize += s.size() + 1;
+    }
+
+    for (size_t i = 0; i < syms.size(); ++i)
+        syms[i].st_name = names[i] == UINT32_MAX ? 0 : stroffsets[names[i]];
+
+    size_t symbytes = syms.size() * sizeof(Elf64_Sym);
+    m_buffer.reserve(2 * sizeof(long) + howmany(symbytes, ALIGN) * ALIGN + howmany(strsize, ALIGN) * ALIGN);
+
+    push(long(symbytes));
+    m_buffer.append(std::span<const char>((const char*)syms.data(), symbytes));
+    align(sizeof(long));
+
+    push(long(strsize));
+    m_buffer.fill(1);
+    for (auto i : written) {
+        m_buffer.append(std::span<const char>(strings[i].data(), strings[i].size()));
+        m_buffer.fill(1);
+    }
     align(sizeof(long));
 }
 
 void beastie::CSymbolsWriter::align(size_t a)
 {
-    while (offset() % ALIGN)
-    {
-        push(uint8_t(0));
-    }
+    m_buffer.align(ALIGN);
 }
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "csegmentbuilder.hxx"
+
 #include <cstddef>
 #include <cstdint>
+#include <span>
 #include <string_view>
 #include <vector>
 #include <concepts>
@@ -10,29 +13,40 @@ namespace beastie {
 class CSymbolsWriter
 {
 public:
+    // Symbols left out by addSymbols()
+    enum Filter : unsigned {
+        KeepAll   = 0,
+        DropDebug = 1 << 0,    // STT_FILE, STT_SECTION and unnamed symbols
+        DropLocal = 1 << 1,    // STB_LOCAL symbols
+    };
+
     CSymbolsWriter();
 
     void clear();
-    auto data() {
-        return m_buffer.data();
-    }
     auto size() {
         return m_buffer.size();
     }
+    auto& builder() {
+        return m_buffer;
+    }
+
+    // The tables are referenced, not copied, and must outlive the writer
+    void addSymTab(std::span<const char>);
+    void addStrTab(std::span<const char>);
 
-    void addSymTab(std::vector<char>);
-    void addStrTab(std::vector<char>);
+    // Add a symbol table and its string table, filtered and with the
+    // strings deduplicated, in a single write
+    void addSymbols(std::span<const char> symtab, std::span<const char> strtab, unsigned filter);
 
 private:
-    std::vector<char> m_buffer;
+    CSegmentBuilder m_buffer;
 
 
 private:
     void push(std::integral auto);
-    void push(std::vector<char>);
     void align(size_t);
     size_t offset() {
-        return (m_buffer.end() - m_buffer.begin());
+        return m_buffer.size();
     }
 };
 } // namespace beastie
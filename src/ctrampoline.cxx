@@ -0,0 +1,204 @@
+#include "ctrampoline.hxx"
+#include "cvmwaregfx.hxx"
+using namespace beastie;
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+constexpr uint64_t KERNBASE = 0xffff'ffff'8000'0000ULL;
+constexpr uint64_t GIGA = 1ULL << 30;
+constexpr size_t PAGE = 4096;
+constexpr size_t STACK_SIZE = 1 * PAGE;
+
+/*
+ * The stub, entered at BASE in long mode with the memory identity
+ * mapped (kexec purgatory). It only reads the parameter block, which
+ * follows it, and writes the base of GDTP. Everything is rip relative.
+ *
+ * Built from this with GNU as (--64, .intel_syntax noprefix), the
+ * offsets to GDT, GDTP and params are those of the listing:
+ *
+ *  entry:  cli
+ *          lea     rsi, [rip + GDT]
+ *          mov     [rip + GDTP + 2], rsi
+ *          lgdt    [rip + GDTP]
+ *          push    0x10                        # reload CS
+ *          lea     rax, [rip + 1f]
+ *          push    rax
+ *          rex.w retf
+ *  1:      mov     eax, 0x18                   # data segments
+ *          mov     ss, eax  (ds, es, fs, gs)
+ *          mov     rsp, [rip + params.stack]
+ *          mov     rax, [rip + params.cr3]
+ *          mov     cr3, rax
+ *          lea     rsi, [rip + params.ports]   # reset the display adapter
+ *          mov     ecx, [rip + params.nports]
+ *          jrcxz   3f
+ *  2:      mov     dx, [rsi]
+ *          mov     eax, [rsi + 4]
+ *          out     dx, eax
+ *          add     rsi, 8
+ *          loop    2b
+ *  3:      push kernend, modulep, 0 as dwords  # the i386 style frame btext wants
+ *          mov     rax, [rip + params.btext]
+ *          jmp     rax
+ *  4:      hlt
+ *          jmp     4b
+ *          .balign 16
+ *  GDT:    null, null, kernel code, kernel data
+ *  GDTP:   .word 4*8-1, .quad 0
+ *          .balign 16
+ *  params:
+ *
+ ****/
+constexpr uint8_t stub[] = {
+    0xfa,                                       // 00  cli
+    0x48, 0x8d, 0x35, 0x88, 0x00, 0x00, 0x00,   // 01  lea rsi, [rip + GDT]
+    0x48, 0x89, 0x35, 0xa3, 0x00, 0x00, 0x00,   // 08  mov [rip + GDTP + 2], rsi
+    0x0f, 0x01, 0x15, 0x9a, 0x00, 0x00, 0x00,   // 0f  lgdt [rip + GDTP]
+    0x6a, 0x10,                                 // 16  push 0x10
+    0x48, 0x8d, 0x05, 0x03, 0x00, 0x00, 0x00,   // 18  lea rax, [rip + 0x22]
+    0x50,                                       // 1f  push rax
+    0x48, 0xcb,                                 // 20  retfq
+    0xb8, 0x18, 0x00, 0x00, 0x00,               // 22  mov eax, 0x18
+    0x8e, 0xd0,                                 // 27  mov ss, eax
+    0x8e, 0xd8,                                 // 29  mov ds, eax
+    0x8e, 0xc0,                                 // 2b  mov es, eax
+    0x8e, 0xe0,                                 // 2d  mov fs, eax
+    0x8e, 0xe8,                                 // 2f  mov gs, eax
+    0x48, 0x8b, 0x25, 0x98, 0x00, 0x00, 0x00,   // 31  mov rsp, [rip + params.stack]
+    0x48, 0x8b, 0x05, 0x89, 0x00, 0x00, 0x00,   // 38  mov rax, [rip + params.cr3]
+    0x0f, 0x22, 0xd8,                           // 3f  mov cr3, rax
+    0x48, 0x8d, 0x35, 0x9f, 0x00, 0x00, 0x00,   // 42  lea rsi, [rip + params.ports]
+    0x8b, 0x0d, 0x91, 0x00, 0x00, 0x00,         // 49  mov ecx, [rip + params.nports]
+    0xe3, 0x0d,                                 // 4f  jrcxz 0x5e
+    0x66, 0x8b, 0x16,                           // 51  mov dx, [rsi]
+    0x8b, 0x46, 0x04,                           // 54  mov eax, [rsi + 4]
+    0xef,                                       // 57  out dx, eax
+    0x48, 0x83, 0xc6, 0x08,                     // 58  add rsi, 8
+    0xe2, 0xf3,                                 // 5c  loop 0x51
+    0x8b, 0x05, 0x78, 0x00, 0x00, 0x00,         // 5e  mov eax, [rip + params.kernend]
+    0x48, 0x83, 0xec, 0x04,                     // 64  sub rsp, 4
+    0x89, 0x04, 0x24,                           // 68  mov [rsp], eax
+    0x8b, 0x05, 0x67, 0x00, 0x00, 0x00,         // 6b  mov eax, [rip + params.modulep]
+    0x48, 0x83, 0xec, 0x04,                     // 71  sub rsp, 4
+    0x89, 0x04, 0x24,                           // 75  mov [rsp], eax
+    0x48, 0x83, 0xec, 0x04,                     // 78  sub rsp, 4
+    0xc7, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00,   // 7c  mov dword [rsp], 0
+    0x48, 0x8b, 0x05, 0x36, 0x00, 0x00, 0x00,   // 83  mov rax, [rip + params.btext]
+    0xff, 0xe0,                                 // 8a  jmp rax
+    0xf4,                                       // 8c  hlt
+    0xeb, 0xfd,                                 // 8d  jmp 0x8c
+    0x00,                                       // 8f  .balign 16
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 90  GDT: null
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 98  null
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xaf, 0x00, // a0  kernel code
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00, // a8  kernel data
+    0x1f, 0x00,                                     // b0  GDTP: limit
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // b2  base
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,             // ba  .balign 16
+};
+
+// the rip relative displacements above depend on these
+static_assert(sizeof(stub) == 0xc0);
+static_assert(offsetof(trampparams, btext) == 0x00);
+static_assert(offsetof(trampparams, cr3) == 0x08);
+static_assert(offsetof(trampparams, stack) == 0x10);
+static_assert(offsetof(trampparams, modulep) == 0x18);
+static_assert(offsetof(trampparams, kernend) == 0x1c);
+static_assert(offsetof(trampparams, nports) == 0x20);
+static_assert(offsetof(trampparams, ports) == 0x28);
+static_assert(sizeof(portwrite) == 8);
+static_assert(sizeof(stub) + sizeof(trampparams) <= CTrampoline::TABLES - CTrampoline::BASE);
+} // namespace
+
+/*
+ * The identity map covers the first 4 GiB at least, which the kernel
+ * still uses before it switches to its own tables, up to kernend
+ * otherwise, and the framebuffer when it lies higher (ext_lfb_base).
+ * KERNBASE maps the top 2 GiB onto physical 0.
+ */
+CPageTables beastie::CTrampoline::pageTables(uintptr_t kernend, const fbinfo& fb, bool gbpages)
+{
+    CPageTables tables(TABLES, gbpages);
+    uint64_t low = std::max<uint64_t>(4 * GIGA, kernend);
+    tables.map(0, 0, low);
+    if (fb.phys + fb.size > low)
+        tables.map(fb.phys, fb.phys, fb.size);
+    tables.map(KERNBASE, 0, 2 * GIGA);
+    return tables;
+}
+
+std::vector<portwrite> beastie::CTrampoline::gfxReset(const fbinfo& fb)
+{
+    if (fb.id == "vmwgfxdrmfb")
+        return CVmwaregfx().resetSequence(fb.width, fb.height);
+    return {};
+}
+
+beastie::CTrampoline::CTrampoline(uintptr_t btext,
+                                  uintptr_t modulep,
+                                  uintptr_t kernend,
+                                  fbinfo fb,
+                                  bool gbpages)
+    : m_params()
+    , m_tables(pageTables(kernend, fb, gbpages))
+{
+    assert(modulep < kernend);
+    if (kernend > UINT32_MAX)
+        throw std::runtime_error(std::format("kernend 0x{:x} above 4 GiB", kernend));
+
+    auto ports = gfxReset(fb);
+    if (ports.size() > std::size(m_params.ports))
+        throw std::runtime_error(std::format("{}: {} port writes, at most {}", fb.id,
+                                             ports.size(), std::size(m_params.ports)));
+
+    m_params.btext = btext;
+    m_params.cr3 = m_tables.root();
+    m_params.stack = TABLES + m_tables.data().size() + STACK_SIZE;
+    m_params.modulep = modulep;
+    m_params.kernend = kernend;
+    m_params.nports = ports.size();
+    std::copy(ports.begin(), ports.end(), m_params.ports);
+}
+
+void beastie::CTrampoline::debug()
+{
+    std::cout << std::format("=========================================\n");
+    std::cout << std::format("btext       | {:016x}\n", m_params.btext);
+    std::cout << std::format("modulep     | {:016x}\n", m_params.modulep);
+    std::cout << std::format("kernend     | {:016x}\n", m_params.kernend);
+    std::cout << std::format("cr3         | {:016x}\n", m_params.cr3);
+    std::cout << std::format("stack       | {:016x}\n", m_params.stack);
+    std::cout << std::format("page tables | {} x 4 KiB, {} MiB pages\n",
+                             m_tables.tables(), m_tables.pageSize() >> 20);
+    for (unsigned i = 0; i < m_params.nports; ++i)
+        std::cout << std::format("outl        | {:04x} <- {:08x}\n",
+                                 m_params.ports[i].port, m_params.ports[i].value);
+    std::cout << std::format("=========================================\n");
+    std::flush(std::cout);
+}
+
+/*
+ * The boot block, loaded at BASE:
+ *
+ *   BASE       stub, parameter block
+ *   TABLES     page tables, PML4 first
+ *              stack
+ *
+ ****/
+std::vector<char> beastie::CTrampoline::data()
+{
+    auto tables = m_tables.data();
+    std::vector<char> buffer(TABLES - BASE + tables.size() + STACK_SIZE, 0);
+    std::memcpy(buffer.data(), stub, sizeof(stub));
+    std::memcpy(buffer.data() + sizeof(stub), &m_params, sizeof(m_params));
+    std::memcpy(buffer.data() + TABLES - BASE, tables.data(), tables.size());
+    return buffer;
+}
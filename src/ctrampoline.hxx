@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hxx"
+#include "cgfx.hxx"
+#include "cpagetables.hxx"
+using namespace beastie;
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace beastie {
+
+/*
+ * The parameter block of the stub, right after its code. Everything
+ * that differs between two boots is in here or in the page tables.
+ *
+ *   btext     kernel entry point, the absolute e_entry virtual address
+ *   cr3       physical address of the PML4
+ *   stack     top of the stack, physical
+ *   modulep   preload metadata, physical, below 4 GiB
+ *   kernend   end of the image, physical, below 4 GiB
+ *   nports    how many of ports[] are written before entering the kernel
+ *   ports     outl(value, port) writes, resetting the display adapter
+ *
+ ****/
+struct trampparams {
+    uint64_t btext;
+    uint64_t cr3;
+    uint64_t stack;
+    uint32_t modulep;
+    uint32_t kernend;
+    uint32_t nports;
+    uint32_t pad;
+    portwrite ports[16];
+};
+
+// The boot block without an assembler: a prebuilt, position independent
+// stub with its parameter block filled in, followed by the page tables
+// and a stack.
+class CTrampoline
+{
+public:
+    // Where the boot block is loaded, and its page tables in it
+    constexpr static uintptr_t BASE = 0x10'0000;
+    constexpr static uintptr_t TABLES = BASE + 0x1'000;
+
+    CTrampoline(uintptr_t btext,
+                uintptr_t modulep,
+                uintptr_t kernend,
+                fbinfo fb,
+                bool gbpages);
+    void debug();
+
+    // The page tables the kernel is entered with, at TABLES
+    static CPageTables pageTables(uintptr_t kernend, const fbinfo& fb, bool gbpages);
+
+    // The writes resetting the display adapter, if it needs any
+    static std::vector<portwrite> gfxReset(const fbinfo& fb);
+
+    std::vector<char> data();
+
+private:
+    trampparams m_params;
+    CPageTables m_tables;
+};
+} // namespace beastie
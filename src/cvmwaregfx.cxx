@@ -2,10 +2,10 @@
 #include "misc.hxx"
 using namespace beastie;
 
+#include <format>
 #include <iostream>
 
 #include <sys/io.h>
-#include <asmjit/asmjit.h>
 
 const static std::filesystem::path devices = "/sys/bus/pci/devices";
 
@@ -14,22 +14,29 @@ beastie::CVmwaregfx::CVmwaregfx()
     , m_present(false)
     , m_fbbase(0)
     , m_fbsize(0)
-    , m_asm()
-    , m_code()
-    , m_environment()
 {
-    initAsmJit();
-
+    // the ids of every device in one go
+    std::vector<std::filesystem::path> dirs;
+    std::vector<std::filesystem::path> ids;
     for (auto const& dir_entry : std::filesystem::directory_iterator{devices}) {
-        uint16_t device = slurpULL(dir_entry.path()/"device") & 0xffff;
-        uint16_t vendor = slurpULL(dir_entry.path()/"vendor") & 0xffff;
+        dirs.push_back(dir_entry.path());
+        ids.push_back(dir_entry.path()/"device");
+        ids.push_back(dir_entry.path()/"vendor");
+    }
+
+    auto values = slurpMany(ids);
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        if (values[2 * i].has_value() == false || values[2 * i + 1].has_value() == false)
+            continue;
+        uint16_t device = std::stoull(*values[2 * i], 0, 0) & 0xffff;
+        uint16_t vendor = std::stoull(*values[2 * i + 1], 0, 0) & 0xffff;
 
         if (vendor == VENDOR_VMWARE &&
             device == DEVICE_SVGAII) {
             m_present = true;
 
             // BAR0: I/O ports
-            m_iostart = slurpULL(dir_entry.path()/"resource") & 0xffff;
+            m_iostart = slurpULL(dirs[i]/"resource") & 0xffff;
         }
     }
 
@@ -82,20 +89,13 @@ void beastie::CVmwaregfx::setMode(int w, int h)
     write(SVGA_REG_ENABLE, 1);
 }
 
-std::vector<char> beastie::CVmwaregfx::assembleReset(int width,
-                                                     int height)
+std::vector<portwrite> beastie::CVmwaregfx::resetSequence(int width,
+                                                          int height)
 {
-    using namespace asmjit::x86::regs;
-
-    auto outl = [this](unsigned int value, unsigned short int port)
-    {
-        m_asm.mov(eax, value);
-        m_asm.mov(edx, port);
-        m_asm.out(dx, eax);
-    };
-    auto write = [this, outl](uint32_t reg, uint32_t value) {
-        outl(reg, this->m_iostart);
-        outl(value, this->m_iostart + 1);
+    std::vector<portwrite> seq;
+    auto write = [this, &seq](uint32_t reg, uint32_t value) {
+        seq.push_back({m_iostart, 0, reg});
+        seq.push_back({uint16_t(m_iostart + 1), 0, value});
     };
 
     write(SVGA_REG_ENABLE, 0);
@@ -105,18 +105,5 @@ std::vector<char> beastie::CVmwaregfx::assembleReset(int width,
     write(SVGA_REG_BITS_PER_PIXEL, 32);
     write(SVGA_REG_BYTES_PER_LINE, height * 4);
     write(SVGA_REG_ENABLE, 1);
-
-    m_asm.finalize();
-    std::vector<char> buffer(m_code.codeSize());
-    m_code.copySectionData(buffer.data(), buffer.size(), 0);
-    return buffer;
-}
-
-void beastie::CVmwaregfx::initAsmJit()
-{
-    m_environment.setArch(asmjit::Arch::kX64);
-    m_code.init(m_environment);
-    m_code.attach(&m_asm);
-    // Enable strict validation.
-    m_asm.addDiagnosticOptions(asmjit::DiagnosticOptions::kValidateAssembler);
+    return seq;
 }
@@ -3,11 +3,10 @@
 #include "cgfx.hxx"
 using namespace beastie;
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
-#include <asmjit/asmjit.h>
-
 namespace beastie {
 class CVmwaregfx : public CGfx
 {
@@ -23,7 +22,7 @@ public:
 
     void debug() override;
 
-    std::vector<char> assembleReset(int, int) override;
+    std::vector<portwrite> resetSequence(int, int) override;
 
 private:
     constexpr static int VENDOR_VMWARE = 0x15AD;
@@ -58,11 +57,5 @@ private:
     uint32_t read(uint32_t reg);
     void setMode(int w, int h);
 
-    asmjit::x86::Assembler m_asm;
-    asmjit::CodeHolder m_code;
-    asmjit::Environment m_environment;
-
-    void initAsmJit();
-
 };
 } // namespace beastie
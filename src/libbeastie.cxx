@@ -0,0 +1,337 @@
+#include "beastie.h"
+#include "bootloader.hxx"
+#include "cfontblob.hxx"
+#include "ckernelindex.hxx"
+#include "cloaderconf.hxx"
+#include "constants.hxx"
+#include "misc.hxx"
+using namespace beastie;
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct beastie_context {
+    std::string error;
+    std::optional<platforminfo> platform;
+    uint32_t howto = 0;
+    bool debug = false;
+    bool force = false;
+    std::filesystem::path cache{beastie::cachedir};
+    unsigned cols = 80;
+    unsigned rows = 25;
+    std::string fontsubset;
+    std::filesystem::path manifest;
+    std::filesystem::path mdroot;
+    std::vector<std::string> modules;
+    std::vector<std::string> env;
+    std::filesystem::path root;
+    std::unique_ptr<Bootloader> loader;
+    uint64_t stagekey = 0;      // of loader, taken before it was prepared
+};
+
+namespace {
+// Runs f, turning what it throws into BEASTIE_ERROR and ctx->error
+template<class F>
+int guarded(beastie_context* ctx, F f)
+{
+    if (ctx == nullptr)
+        return BEASTIE_ERROR;
+    try {
+        ctx->error.clear();
+        f();
+        return BEASTIE_OK;
+    }
+    catch (std::exception& e) {
+        ctx->error = e.what();
+    }
+    catch (...) {
+        ctx->error = "unknown error";
+    }
+    return BEASTIE_ERROR;
+}
+
+// A Bootloader set up like the command line would for ctx->root
+std::unique_ptr<Bootloader> configure(beastie_context* ctx)
+{
+    if (ctx->root.empty())
+        throw std::runtime_error("no root loaded");
+    if (ctx->platform.has_value() == false)
+        ctx->platform = fetchPlatform();
+
+    auto loader = std::make_unique<Bootloader>(*ctx->platform);
+    loader->setDebug(ctx->debug);
+    loader->setHowto(ctx->howto);
+    loader->setForce(ctx->force);
+    loader->setFontSubset(ctx->fontsubset);
+    loader->setConsole(ctx->cols, ctx->rows);
+    loader->setCache(ctx->cache);
+    if (ctx->manifest.empty() == false)
+        loader->setManifest(ctx->manifest);
+
+    loader->loaderConfLoad(ctx->root);
+    loader->fontLoad(ctx->root/"boot/fonts");
+    loader->fileLoad(ctx->root/"boot/kernel/kernel");
+    for (auto& module : ctx->modules)
+        loader->moduleLoad(module);
+    if (ctx->mdroot.empty() == false)
+        loader->mdrootLoad(ctx->mdroot);
+    for (auto& assignment : ctx->env)
+        loader->setEnv(assignment);
+    return loader;
+}
+
+Bootloader& loaded(beastie_context* ctx)
+{
+    if (ctx->loader == nullptr)
+        throw std::runtime_error("no root loaded");
+    return *ctx->loader;
+}
+
+/*
+ * Documentation for the image handed out by beastie_image_fd():
+ *
+ * header
+ *   . char[8] magic "BEASTIEI"
+ *   . u32     version 1
+ *   . u32     segment count
+ *   . u64     entry
+ *
+ * segments (repeats segment count times)
+ *   . u64     phys, memsz, bufsz, file offset
+ *
+ * payload
+ *   . char[]  segment bytes, each at a page aligned file offset
+ *
+ * NOTES:
+ *   - These are the kexec segments as loaded, boot block, kernel,
+ *       modules, metadata and env included, in host byte order.
+ *   - The memfd is sealed, it can't be written, grown or shrunk.
+ *
+ ****/
+int writeImage(Bootloader& loader)
+{
+    constexpr char MAGIC[8] = {'B', 'E', 'A', 'S', 'T', 'I', 'E', 'I'};
+    constexpr uint32_t VERSION = 1;
+    constexpr size_t PAGE = 4096;
+
+    auto segments = loader.segments();
+    CBinaryWriter out;
+    out.bytes(MAGIC, sizeof(MAGIC));
+    out.u32(VERSION);
+    out.u32(segments.size());
+    out.u64(loader.getEntry());
+
+    size_t offset = howmany(out.size() + segments.size() * 4 * sizeof(uint64_t), PAGE) * PAGE;
+    std::vector<filepart> parts(1);
+    for (auto& seg : segments) {
+        parts.push_back({offset, {(const char*)seg.buf, seg.bufsz}});
+        out.u64(uintptr_t(seg.mem));
+        out.u64(seg.memsz);
+        out.u64(seg.bufsz);
+        out.u64(offset);
+        offset += howmany(seg.bufsz, PAGE) * PAGE;
+    }
+    parts[0] = {0, out.data()};
+
+    int fd = memfd_create("beastie-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        throw std::runtime_error(std::format("memfd_create: {}", std::strerror(errno)));
+
+    bool ok = ftruncate(fd, offset) == 0 && writeParts(fd, parts) &&
+              fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) == 0;
+    if (ok == false) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(std::format("image memfd: {}", std::strerror(err)));
+    }
+    return fd;
+}
+
+// The C strings may be NULL where a path can be empty
+std::filesystem::path optionalPath(const char* path)
+{
+    return path ? std::filesystem::path(path) : std::filesystem::path();
+}
+} // namespace
+
+beastie_context* beastie_create(void)
+{
+    return new (std::nothrow) beastie_context;
+}
+
+void beastie_destroy(beastie_context* ctx)
+{
+    delete ctx;
+}
+
+const char* beastie_error(beastie_context* ctx)
+{
+    if (ctx == nullptr)
+        return "no context";
+    return ctx->error.c_str();
+}
+
+int beastie_probe(beastie_context* ctx)
+{
+    return guarded(ctx, [ctx]() {
+        ctx->platform = fetchPlatform();
+    });
+}
+
+int beastie_set_howto(beastie_context* ctx, uint32_t howto)
+{
+    return guarded(ctx, [ctx, howto]() {
+        ctx->howto = howto;
+    });
+}
+
+int beastie_set_debug(beastie_context* ctx, int debug)
+{
+    return guarded(ctx, [ctx, debug]() {
+        ctx->debug = debug != 0;
+    });
+}
+
+int beastie_set_force(beastie_context* ctx, int force)
+{
+    return guarded(ctx, [ctx, force]() {
+        ctx->force = force != 0;
+    });
+}
+
+int beastie_set_cache(beastie_context* ctx, const char* dir)
+{
+    return guarded(ctx, [ctx, dir]() {
+        ctx->cache = optionalPath(dir);
+    });
+}
+
+int beastie_set_console(beastie_context* ctx, unsigned cols, unsigned rows)
+{
+    return guarded(ctx, [ctx, cols, rows]() {
+        if (cols == 0 || rows == 0)
+            throw std::runtime_error("empty console");
+        ctx->cols = cols;
+        ctx->rows = rows;
+    });
+}
+
+int beastie_set_font_subset(beastie_context* ctx, const char* sets)
+{
+    return guarded(ctx, [ctx, sets]() {
+        std::string spec = sets ? sets : "";
+        CFontBlob::parseSubset(spec);   // throws on a bad one
+        ctx->fontsubset = spec;
+    });
+}
+
+int beastie_set_manifest(beastie_context* ctx, const char* manifest)
+{
+    return guarded(ctx, [ctx, manifest]() {
+        ctx->manifest = optionalPath(manifest);
+    });
+}
+
+int beastie_set_mdroot(beastie_context* ctx, const char* image)
+{
+    return guarded(ctx, [ctx, image]() {
+        ctx->mdroot = optionalPath(image);
+    });
+}
+
+int beastie_add_module(beastie_context* ctx, const char* name)
+{
+    return guarded(ctx, [ctx, name]() {
+        if (name == nullptr || *name == 0)
+            throw std::runtime_error("empty module name");
+        ctx->modules.push_back(name);
+    });
+}
+
+int beastie_clear_modules(beastie_context* ctx)
+{
+    return guarded(ctx, [ctx]() {
+        ctx->modules.clear();
+    });
+}
+
+int beastie_add_env(beastie_context* ctx, const char* assignment)
+{
+    return guarded(ctx, [ctx, assignment]() {
+        if (assignment == nullptr)
+            throw std::runtime_error("no env assignment");
+        CLoaderConf::assignment(assignment);
+        ctx->env.push_back(assignment);
+    });
+}
+
+int beastie_clear_env(beastie_context* ctx)
+{
+    return guarded(ctx, [ctx]() {
+        ctx->env.clear();
+    });
+}
+
+int beastie_index(beastie_context* ctx, const char* const* roots, size_t count, beastie_kernel* kernels)
+{
+    return guarded(ctx, [ctx, roots, count, kernels]() {
+        if (count && (roots == nullptr || kernels == nullptr))
+            throw std::runtime_error("no roots or kernels to index into");
+        for (size_t i = 0; i < count; ++i) {
+            if (roots[i] == nullptr)
+                throw std::runtime_error(std::format("root {} is NULL", i));
+        }
+        std::vector<std::filesystem::path> paths(roots, roots + count);
+        auto found = CKernelIndex::scan(paths, ctx->cache);
+        for (size_t i = 0; i < count; ++i)
+            kernels[i] = {found[i].bootable, found[i].version, found[i].loadsize};
+    });
+}
+
+int beastie_load_root(beastie_context* ctx, const char* root)
+{
+    return guarded(ctx, [ctx, root]() {
+        ctx->loader.reset();
+        ctx->root = optionalPath(root);
+        auto loader = configure(ctx);
+        uint64_t key = loader->stageKey();
+        loader->prepare();
+        ctx->loader = std::move(loader);
+        ctx->stagekey = key;
+    });
+}
+
+int beastie_image_fd(beastie_context* ctx, int* fd)
+{
+    return guarded(ctx, [ctx, fd]() {
+        if (fd == nullptr)
+            throw std::runtime_error("no fd to return the image in");
+        *fd = writeImage(loaded(ctx));
+    });
+}
+
+// The image beastie_image_fd() hands out, under the key --commit compares
+int beastie_stage(beastie_context* ctx)
+{
+    return guarded(ctx, [ctx]() {
+        loaded(ctx).stagePrepared(beastie::stagefile, ctx->stagekey);
+    });
+}
+
+int beastie_boot(beastie_context* ctx)
+{
+    return guarded(ctx, [ctx]() {
+        loaded(ctx).boot();
+    });
+}
@@ -1,11 +1,19 @@
 #include "bootloader.hxx"
 #include "constants.hxx"
+#include "cdaemon.hxx"
+#include "ckernelindex.hxx"
+#include "cloadpipeline.hxx"
+#include "cprofiler.hxx"
+#include "cstagemanifest.hxx"
 using namespace beastie;
 
+#include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <string_view>
 #include <format>
+#include <string>
+#include <vector>
 
 #include <getopt.h>
 #include <unistd.h>
@@ -15,7 +23,29 @@ struct {
     bool debugAssembly;
     bool pretend;
     bool force;
+    bool nocache;
     std::filesystem::path root;
+    std::filesystem::path bundle;
+    std::filesystem::path output;
+    bool bundleCreate;
+    unsigned symfilter;
+    bool stats;
+    std::filesystem::path statsPath;
+    bool stage;
+    bool commit;
+    bool daemon;
+    bool index;
+    std::vector<std::filesystem::path> roots;
+    std::string control;
+    std::string fontsubset;
+    std::filesystem::path mdroot;
+    std::filesystem::path verify;
+    std::filesystem::path font;
+    unsigned cols = 80;
+    unsigned rows = 25;
+    int jobs = -1;
+    std::vector<std::string> modules;
+    std::vector<std::string> env;
     unsigned int boot_howto;
 } Options;
 
@@ -27,6 +57,12 @@ void version()
 void usage()
 {
     std::cout << std::format("Usage: {} [OPTION]... [root]\n", beastie::progname);
+    std::cout << std::format("  or:  {} [OPTION]... --bundle-create root [-o file]\n", beastie::progname);
+    std::cout << std::format("  or:  {} [OPTION]... --bundle-boot file\n", beastie::progname);
+    std::cout << std::format("  or:  {} [OPTION]... --commit [root]\n", beastie::progname);
+    std::cout << std::format("  or:  {} [OPTION]... --daemon root\n", beastie::progname);
+    std::cout << std::format("  or:  {} --control boot|status|reload\n", beastie::progname);
+    std::cout << std::format("  or:  {} [-n] --index root...\n", beastie::progname);
     std::cout << std::format("Directly reboot into FreeBSD\n");
     std::cout << std::format("\n");
     std::cout << std::format(" -h, --help        Print this help.\n");
@@ -39,8 +75,72 @@ void usage()
     std::cout << std::format(" -c, --cdrom       Boot in cdrom mode.\n");
     std::cout << std::format(" -s, --serial      Boot in serial mode.\n");
     std::cout << std::format(" -V, --verbose     Boot in verbose mode.\n");
+    std::cout << std::format(" -m, --module NAME Preload a kernel module and its\n");
+    std::cout << std::format("                   dependencies (repeatable).\n");
+    std::cout << std::format(" -e, --env NAME=VALUE\n");
+    std::cout << std::format("                   Set a kernel env variable, over what\n");
+    std::cout << std::format("                   boot/loader.conf sets (repeatable).\n");
+    std::cout << std::format(" -S, --symbols LEVEL\n");
+    std::cout << std::format("                   Kernel symbols to preload: all (default),\n");
+    std::cout << std::format("                   nodebug or global.\n");
+    std::cout << std::format("     --mdroot IMAGE\n");
+    std::cout << std::format("                   Preload IMAGE (may be compressed) as an\n");
+    std::cout << std::format("                   md_image, for a memory disk root.\n");
+    std::cout << std::format("     --verify MANIFEST\n");
+    std::cout << std::format("                   Check the SHA-256 of the files loaded against\n");
+    std::cout << std::format("                   MANIFEST (sha256 -r or sha256sum output) and\n");
+    std::cout << std::format("                   refuse to boot on a mismatch.\n");
+    std::cout << std::format("     --console COLSxROWS\n");
+    std::cout << std::format("                   Pick the largest font in boot/fonts that\n");
+    std::cout << std::format("                   still fits COLSxROWS (default: 80x25).\n");
+    std::cout << std::format("     --font FILE   Load FILE rather than pick from boot/fonts,\n");
+    std::cout << std::format("                   required with --bundle-create.\n");
+    std::cout << std::format("     --font-subset SETS\n");
+    std::cout << std::format("                   Only load the glyphs of SETS, comma separated\n");
+    std::cout << std::format("                   ascii, latin, greek, cyrillic, hebrew, arabic,\n");
+    std::cout << std::format("                   symbols, cjk or U+XXXX-U+YYYY ranges.\n");
+    std::cout << std::format("     --jobs N      Read and decompress on N threads, 0 loads\n");
+    std::cout << std::format("                   everything serially (default: up to 4).\n");
+    std::cout << std::format("     --stats[=FILE]\n");
+    std::cout << std::format("                   Time each phase and write a JSON report,\n");
+    std::cout << std::format("                   also a Chrome trace, to FILE or stdout.\n");
+    std::cout << std::format(" -n, --no-cache    Don't use the prepared image cache\n");
+    std::cout << std::format("                   in {}.\n", beastie::cachedir);
+    std::cout << std::format(" -B, --bundle-create ROOT\n");
+    std::cout << std::format("                   Write the prepared image of ROOT as a\n");
+    std::cout << std::format("                   bundle for other hosts, don't boot.\n");
+    std::cout << std::format(" -o, --output FILE Bundle to write (default: {}).\n", beastie::bundlename);
+    std::cout << std::format(" -b, --bundle-boot FILE\n");
+    std::cout << std::format("                   Boot a bundle (may be compressed).\n");
+    std::cout << std::format("     --stage       Load the image now and keep running,\n");
+    std::cout << std::format("                   for a later --commit.\n");
+    std::cout << std::format("     --commit      Reboot into the staged image. With a root\n");
+    std::cout << std::format("                   or bundle, load it first unless it is\n");
+    std::cout << std::format("                   the one staged. An image loaded by\n");
+    std::cout << std::format("                   another tool since --stage isn't noticed.\n");
+    std::cout << std::format("     --daemon      Keep root staged, staging it again when\n");
+    std::cout << std::format("                   its boot files change, and take commands\n");
+    std::cout << std::format("                   on {}.\n", beastie::socketpath);
+    std::cout << std::format("     --control CMD Send a command to the daemon.\n");
+    std::cout << std::format("     --index       List the kernel of each root, whether it\n");
+    std::cout << std::format("                   boots, its version and size, from its\n");
+    std::cout << std::format("                   headers alone.\n");
 }
 
+// long options without a short one
+constexpr int OPT_STATS  = 0x100;
+constexpr int OPT_STAGE  = 0x101;
+constexpr int OPT_COMMIT = 0x102;
+constexpr int OPT_DAEMON = 0x103;
+constexpr int OPT_CONTROL = 0x104;
+constexpr int OPT_FONTSUBSET = 0x105;
+constexpr int OPT_CONSOLE = 0x106;
+constexpr int OPT_MDROOT = 0x107;
+constexpr int OPT_JOBS = 0x108;
+constexpr int OPT_VERIFY = 0x109;
+constexpr int OPT_INDEX = 0x10a;
+constexpr int OPT_FONT = 0x10b;
+
 int main(int argc, char* argv[])
 {
     try {
@@ -66,10 +166,29 @@ int main(int argc, char* argv[])
                 {"cdrom",       no_argument,       0, 'c'},
                 {"serial",      no_argument,       0, 's'},
                 {"verbose",     no_argument,       0, 'V'},
+                {"module",      required_argument, 0, 'm'},
+                {"no-cache",    no_argument,       0, 'n'},
+                {"env",         required_argument, 0, 'e'},
+                {"symbols",     required_argument, 0, 'S'},
+                {"bundle-create", required_argument, 0, 'B'},
+                {"bundle-boot", required_argument, 0, 'b'},
+                {"output",      required_argument, 0, 'o'},
+                {"stats",       optional_argument, 0, OPT_STATS},
+                {"stage",       no_argument,       0, OPT_STAGE},
+                {"commit",      no_argument,       0, OPT_COMMIT},
+                {"daemon",      no_argument,       0, OPT_DAEMON},
+                {"control",     required_argument, 0, OPT_CONTROL},
+                {"font",        required_argument, 0, OPT_FONT},
+                {"font-subset", required_argument, 0, OPT_FONTSUBSET},
+                {"console",     required_argument, 0, OPT_CONSOLE},
+                {"mdroot",      required_argument, 0, OPT_MDROOT},
+                {"jobs",        required_argument, 0, OPT_JOBS},
+                {"verify",      required_argument, 0, OPT_VERIFY},
+                {"index",       no_argument,       0, OPT_INDEX},
                 {0, 0, 0, 0}
             };
 
-            c = getopt_long (argc, argv, "hvpfdDcsV",
+            c = getopt_long (argc, argv, "hvpfdDcsVm:ne:B:b:o:S:",
                             long_options, &option_index);
 
             /* Detect the end of the options. */
@@ -109,6 +228,82 @@ int main(int argc, char* argv[])
             case 'V':
                 Options.boot_howto |= RB_VERBOSE;
                 break;
+            case 'm':
+                Options.modules.push_back(optarg);
+                break;
+            case 'e':
+                Options.env.push_back(optarg);
+                break;
+            case 'n':
+                Options.nocache = true;
+                break;
+            case 'S':
+                if (std::string_view(optarg) == "all")
+                    Options.symfilter = CSymbolsWriter::KeepAll;
+                else if (std::string_view(optarg) == "nodebug")
+                    Options.symfilter = CSymbolsWriter::DropDebug;
+                else if (std::string_view(optarg) == "global")
+                    Options.symfilter = CSymbolsWriter::DropDebug | CSymbolsWriter::DropLocal;
+                else {
+                    usage();
+                    return -1;
+                }
+                break;
+            case 'B':
+                Options.bundleCreate = true;
+                Options.root = std::filesystem::path(optarg);
+                break;
+            case 'b':
+                Options.bundle = std::filesystem::path(optarg);
+                break;
+            case 'o':
+                Options.output = std::filesystem::path(optarg);
+                break;
+            case OPT_STATS:
+                Options.stats = true;
+                if (optarg)
+                    Options.statsPath = std::filesystem::path(optarg);
+                break;
+            case OPT_STAGE:
+                Options.stage = true;
+                break;
+            case OPT_COMMIT:
+                Options.commit = true;
+                break;
+            case OPT_DAEMON:
+                Options.daemon = true;
+                break;
+            case OPT_CONTROL:
+                Options.control = optarg;
+                break;
+            case OPT_FONTSUBSET:
+                Options.fontsubset = optarg;
+                break;
+            case OPT_FONT:
+                Options.font = std::filesystem::path(optarg);
+                break;
+            case OPT_CONSOLE:
+                if (std::sscanf(optarg, "%ux%u", &Options.cols, &Options.rows) != 2 ||
+                    Options.cols == 0 || Options.rows == 0) {
+                    usage();
+                    return -1;
+                }
+                break;
+            case OPT_MDROOT:
+                Options.mdroot = std::filesystem::path(optarg);
+                break;
+            case OPT_JOBS:
+                if (std::sscanf(optarg, "%d", &Options.jobs) != 1 || Options.jobs < 0) {
+                    usage();
+                    return -1;
+                }
+                break;
+            case OPT_VERIFY:
+                Options.verify = std::filesystem::path(optarg);
+                break;
+            case OPT_INDEX:
+                Options.index = true;
+                break;
             case '?':
                 usage();
                 return -1;
@@ -116,17 +311,62 @@ int main(int argc, char* argv[])
             }
         }
 
-        /* positional argument 0: root */
-        for(int i = 0; i < argc; ++i) {
+        /* positional argument 0: root (getopt moved it past the options) */
+        for(int i = optind; i < argc; ++i) {
             if (std::string_view(argv[i]).empty() ||
                 std::string_view(argv[i])[0] == '-')
                 continue;
             Options.root = std::filesystem::path(argv[i]);
+            Options.roots.push_back(Options.root);
+        }
+
+        // the socket is root only, let it refuse us rather than checking here
+        if (Options.control.empty() == false) {
+            std::string reply = CDaemon::send(beastie::socketpath, Options.control);
+            std::cout << reply;
+            return reply.starts_with("error") ? 1 : 0;
+        }
+
+        // headers only, no need to be root (the index is only cached then)
+        if (Options.index) {
+            if (Options.roots.empty()) {
+                usage();
+                return -1;
+            }
+            if (Options.jobs >= 0)
+                CLoadPipeline::instance().setWorkers(Options.jobs);
+            auto kernels = CKernelIndex::scan(Options.roots,
+                                              Options.nocache ? "" : beastie::cachedir);
+            for (size_t i = 0; i < kernels.size(); ++i) {
+                auto& k = kernels[i];
+                if (k.bootable == false)
+                    std::cout << std::format("{}\tnot bootable\n", Options.roots[i].string());
+                else if (k.version == 0)
+                    std::cout << std::format("{}\tFreeBSD\t{} bytes\n", Options.roots[i].string(), k.loadsize);
+                else
+                    std::cout << std::format("{}\tFreeBSD {}.{} ({})\t{} bytes\n", Options.roots[i].string(),
+                                             k.version / 100000, k.version / 1000 % 100, k.version, k.loadsize);
+            }
+            return 0;
+        }
+
+        bool committing = Options.commit && Options.root.empty() && Options.bundle.empty();
+        if (Options.root.empty() == Options.bundle.empty() && committing == false) {
+            usage();
+            return -1;
+        }
+        if ((Options.stage || Options.daemon) && (Options.commit || Options.bundleCreate)) {
+            usage();
+            return -1;
         }
-        if (Options.root.empty()) {
+        if (Options.daemon && (Options.stage || Options.bundle.empty() == false)) {
             usage();
             return -1;
         }
+        if (Options.bundleCreate && Options.font.empty())
+            throw std::runtime_error("--bundle-create needs --font, a bundle can't pick one for the hosts it boots on");
+        if (Options.output.empty())
+            Options.output = beastie::bundlename;
 
         /* check super user permissions */
         auto uid = geteuid();
@@ -137,15 +377,121 @@ int main(int argc, char* argv[])
         if (Options.debug)
             std::cout << std::format("boot_howto=0x{:x}\n", Options.boot_howto);
 
+        if (Options.jobs >= 0)
+            CLoadPipeline::instance().setWorkers(Options.jobs);
+
+        if (Options.daemon) {
+            CDaemon daemon({
+                Options.root,
+                Options.modules,
+                Options.env,
+                Options.font,
+                Options.fontsubset,
+                Options.mdroot,
+                Options.verify,
+                Options.cols,
+                Options.rows,
+                beastie::socketpath,
+                beastie::stagefile,
+                Options.boot_howto,
+                Options.symfilter,
+                Options.force,
+                Options.debug,
+                Options.pretend,
+                Options.nocache == false,
+            });
+            daemon.run();
+            return 0;
+        }
+
+        if (Options.stats)
+            CProfiler::instance().enable(Options.statsPath);
+
+        // only the reboot is left to do, don't even probe the platform
+        if (committing) {
+            auto staged = CStageManifest::read(beastie::stagefile);
+            if (staged.has_value() == false || CStageManifest::valid(*staged) == false)
+                throw std::runtime_error("no staged image, run with --stage first");
+            if (Options.pretend == false)
+                Bootloader::commit(Options.force);
+            CProfiler::instance().report();
+            return 0;
+        }
+
+        // warm the page cache while the platform is probed, with the cache
+        // on the boot files may not be needed at all
+        auto& pipeline = CLoadPipeline::instance();
+        if (Options.bundle.empty() == false)
+            pipeline.readahead(Options.bundle);
+        else if (Options.nocache || Options.bundleCreate) {
+            pipeline.readahead(Options.root/"boot/kernel/kernel");
+            if (Options.mdroot.empty() == false)
+                pipeline.readahead(Options.mdroot);
+        }
+
+        CProfiler::Phase probe("platform probe");
         Bootloader bootloader;
+        probe.end();
         bootloader.setDebug(Options.debug);
         bootloader.setHowto(Options.boot_howto);
         bootloader.setForce(Options.force);
-        bootloader.fontLoad(Options.root/"boot/fonts/12x24.fnt.gz");
-        bootloader.fileLoad(Options.root/"boot/kernel/kernel");
+        bootloader.setSymbolFilter(Options.symfilter);
+        bootloader.setFontSubset(Options.fontsubset);
+        bootloader.setConsole(Options.cols, Options.rows);
+        if (Options.nocache == false)
+            bootloader.setCache(beastie::cachedir);
+        if (Options.verify.empty() == false)
+            bootloader.setManifest(Options.verify);
+
+        if (Options.bundle.empty() == false) {
+            bootloader.bundleLoad(Options.bundle);
+        } else {
+            bootloader.loaderConfLoad(Options.root);
+            bootloader.fontLoad(Options.font.empty() ? Options.root/"boot/fonts" : Options.font);
+            bootloader.fileLoad(Options.root/"boot/kernel/kernel");
+            for (auto& module : Options.modules)
+                bootloader.moduleLoad(module);
+            if (Options.mdroot.empty() == false)
+                bootloader.mdrootLoad(Options.mdroot);
+        }
+        for (auto& assignment : Options.env)
+            bootloader.setEnv(assignment);
+
+        if (Options.bundleCreate) {
+            bootloader.bundleCreate(Options.output);
+            CProfiler::instance().report();
+            return 0;
+        }
+
+        // pretending prepares the image but leaves the loaded one alone
+        if (Options.stage && Options.pretend) {
+            bootloader.prepare();
+            if (Options.debug)
+                std::cout << std::format("[STAGE]    pretending, nothing loaded\n");
+            CProfiler::instance().report();
+            return 0;
+        }
+
+        if (Options.stage) {
+            bootloader.stage(beastie::stagefile);
+            CProfiler::instance().report();
+            return 0;
+        }
+
+        if (Options.commit && bootloader.isStaged(beastie::stagefile)) {
+            if (Options.debug)
+                std::cout << std::format("[STAGE]    already loaded, committing\n");
+            if (Options.pretend == false)
+                Bootloader::commit(Options.force);
+            CProfiler::instance().report();
+            return 0;
+        }
+
+        bootloader.prepare();
         if (Options.pretend == false) {
             bootloader.boot();
         }
+        CProfiler::instance().report();
 
     }
     catch(std::exception& e) {
@@ -1,21 +1,27 @@
 #include "misc.hxx"
 #include "constants.hxx"
+#include "cdecompressor.hxx"
+#include "cfilereader.hxx"
+#include "cloadpipeline.hxx"
 using namespace beastie;
 
-#include <cassert>
+#include <algorithm>
+#include <cstdio>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <format>
-#include <fstream>
 #include <iostream>
 #include <iterator>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <utility>
 
 #include <asm/bootparam.h>
+#include <cpuid.h>
 #include <fcntl.h>
 #include <linux/fb.h>
 #include <linux/reboot.h>
@@ -24,25 +30,10 @@ using namespace beastie;
 #include <syscall.h>
 #include <unistd.h>
 
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#include <boost/iostreams/copy.hpp>
-
 template<class T>
 T beastie::slurp(std::filesystem::path path)
 {
-    T buffer;
-
-    std::ifstream file(path, std::ios::binary | std::ios::in);
-    typedef std::istreambuf_iterator<char> Iter;
-    if (file) {
-        buffer.insert(buffer.end(), Iter(file), Iter());
-        file.close();
-    } else {
-        throw std::runtime_error(std::strerror(errno));
-    }
-
-    return buffer;
+    return CFileReader::instance().read<T>(path);
 }
 template
 std::string beastie::slurp<std::string>(std::filesystem::path path);
@@ -51,19 +42,20 @@ std::vector<char> beastie::slurp<std::vector<char>>(std::filesystem::path path);
 
 std::vector<std::string> beastie::slurpLines(std::filesystem::path path)
 {
-    std::vector<std::string> lines;
-    std::string line;
+    return splitLines(slurp(path));
+}
 
-    std::ifstream file(path, std::ios::in);
-    if (file) {
-        while (std::getline(file, line)) {
-            lines.push_back(line);
-        }
-        file.close();
-    } else {
-        throw std::runtime_error(std::strerror(errno));
+// As getline() would, a last line without a newline still counts
+std::vector<std::string> beastie::splitLines(std::string_view text)
+{
+    std::vector<std::string> lines;
+    while (text.empty() == false) {
+        size_t end = text.find('\n');
+        lines.emplace_back(text.substr(0, end));
+        if (end == std::string_view::npos)
+            break;
+        text.remove_prefix(end + 1);
     }
-
     return lines;
 }
 
@@ -75,25 +67,166 @@ unsigned long long beastie::slurpULL(std::filesystem::path path)
     return result;
 }
 
+std::vector<std::optional<std::string>> beastie::slurpMany(std::span<const std::filesystem::path> paths)
+{
+    return CFileReader::instance().readMany(paths);
+}
+
 std::vector<char> beastie::zslurp(std::filesystem::path path)
 {
-    std::vector<char> buffer;
-    typedef std::istreambuf_iterator<char> Iter;
+    auto file = zmap(path);
+    return std::vector<char>(file.data(), file.data() + file.size());
+}
 
-    std::ifstream file(path, std::ios::binary | std::ios::binary);
-    unsigned char magic0, magic1;
-    file >> magic0 >> magic1;
-    file.seekg(0);
+CMappedFile beastie::zmap(std::filesystem::path path, CSha256* sha256)
+{
+    CMappedFile file(path);
+    if (CDecompressor::detect(file.span()) == CDecompressor::Format::None) {
+        if (sha256) {
+            file.willNeed(0, file.size());
+            sha256->update(file.span());
+        }
+        return file;
+    }
 
-    if (magic0 == 0x1f && magic1 == 0x8b) {
-        boost::iostreams::filtering_istreambuf in;
-        in.push(boost::iostreams::gzip_decompressor());
-        in.push(file);
-        buffer.assign(Iter(&in), {});
-        return buffer;
-    } else {
-        return slurp<std::vector<char>>(path);
+    // read the rest while the start is decompressed
+    file.willNeed(0, file.size());
+    CDecompressor z(file.span(), path.string());
+    return z.readAll(sha256);
+}
+
+uint64_t beastie::hash64(std::span<const char> data, uint64_t seed)
+{
+    uint64_t h = seed;
+    for (char c : data) {
+        h ^= uint8_t(c);
+        h *= 0x100'0000'01b3ULL;
     }
+    return h;
+}
+
+bool beastie::writeParts(int fd, std::span<const filepart> parts)
+{
+    for (auto& part : parts) {
+        const char* p = part.data.data();
+        size_t n = part.data.size();
+        uint64_t at = part.offset;
+        while (n > 0) {
+            ssize_t done = pwrite(fd, p, n, at);
+            if (done == -1 && errno == EINTR)
+                continue;
+            if (done == -1)
+                return false;
+            if (done == 0) {
+                errno = EIO;
+                return false;
+            }
+            p += done;
+            n -= done;
+            at += done;
+        }
+    }
+    return true;
+}
+
+void beastie::writeAtomic(std::filesystem::path path, std::span<const filepart> parts)
+{
+    // one writer per thread, several threads of a process may race
+    auto temp = path;
+    temp += std::format(".{}.{}", getpid(), gettid());
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error(std::format("{}: {}", temp.string(), std::strerror(errno)));
+
+    bool ok = writeParts(fd, parts) && fsync(fd) == 0;
+    int err = errno;
+    ok = close(fd) == 0 && ok;
+    if (ok && std::rename(temp.c_str(), path.c_str()) == -1) {
+        err = errno;
+        ok = false;
+    }
+    if (ok == false) {
+        unlink(temp.c_str());
+        throw std::runtime_error(std::format("{}: {}", temp.string(), std::strerror(err)));
+    }
+
+    // the rename is only durable once the directory is
+    auto dir = path.parent_path();
+    int dirfd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd != -1) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+}
+
+void beastie::writeAtomic(std::filesystem::path path, std::span<const char> data)
+{
+    filepart part{0, data};
+    writeAtomic(path, {&part, 1});
+}
+
+void beastie::CBinaryWriter::bytes(const void* p, size_t n)
+{
+    m_data.insert(m_data.end(), (const char*)p, (const char*)p + n);
+}
+
+void beastie::CBinaryWriter::u32(uint32_t v)
+{
+    bytes(&v, sizeof(v));
+}
+
+void beastie::CBinaryWriter::u64(uint64_t v)
+{
+    bytes(&v, sizeof(v));
+}
+
+void beastie::CBinaryWriter::blob(std::span<const char> data)
+{
+    u32(data.size());
+    bytes(data.data(), data.size());
+}
+
+beastie::CBinaryReader::CBinaryReader(std::span<char> buffer, std::string name)
+    : m_buffer(buffer)
+    , m_name(std::move(name))
+    , m_pos(0)
+{
+}
+
+std::span<char> beastie::CBinaryReader::bytes(size_t n)
+{
+    if (n > m_buffer.size() - m_pos)
+        throw std::runtime_error(std::format("{}: truncated", m_name));
+    auto s = m_buffer.subspan(m_pos, n);
+    m_pos += n;
+    return s;
+}
+
+uint32_t beastie::CBinaryReader::u32()
+{
+    uint32_t v;
+    std::memcpy(&v, bytes(sizeof(v)).data(), sizeof(v));
+    return v;
+}
+
+uint64_t beastie::CBinaryReader::u64()
+{
+    uint64_t v;
+    std::memcpy(&v, bytes(sizeof(v)).data(), sizeof(v));
+    return v;
+}
+
+std::vector<char> beastie::CBinaryReader::blob()
+{
+    auto s = bytes(u32());
+    return std::vector<char>(s.begin(), s.end());
+}
+
+std::string beastie::CBinaryReader::string()
+{
+    auto s = bytes(u32());
+    return std::string(s.begin(), s.end());
 }
 
 void beastie::printBuffer(std::span<char> vs, std::string_view name)
@@ -146,60 +279,98 @@ void beastie::forcedshutdown()
     syscall(SYS_reboot, LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, LINUX_REBOOT_CMD_KEXEC, nullptr);
 }
 
-std::pair<uintptr_t,uintptr_t> beastie::fetchACPI20(bool efi)
+std::optional<boot_params> beastie::fetchBootParams()
 {
-    /*
-     * Advanced Configuration and Power Interface (ACPI) Specification
-     * 5.2.5.2 Finding the RSDP on UEFI Enabled Systems
-     */
-    intptr_t acpi20 = 0;
-    intptr_t rsdt = 0;
+    std::string data;
+    try {
+        data = slurp<std::string>("/sys/kernel/boot_params/data");
+    } catch (std::runtime_error&) {
+        return std::nullopt;
+    }
 
-    if (efi) {
-        std::string systab, line;
-        unsigned char hdr[20];
-        systab = slurp<std::string>("/sys/firmware/efi/systab");
-
-        std::istringstream stream(systab);
-        while(std::getline(stream, line) && line.starts_with("ACPI20=")) {
-            size_t pos = line.find('=');
-            acpi20 = std::stoull(line.substr(pos + 1), 0, 16);
-        }
-        assert(acpi20);
+    boot_params bp;
+    std::memset(&bp, 0, sizeof(bp));
+    std::memcpy(&bp, data.data(), std::min(data.size(), sizeof(bp)));
+    return bp;
+}
 
-        /* look up rsdt in /dev/mem */
-        std::FILE* fd = std::fopen("/dev/mem", "rb");
-        assert(fd);
-        std::fseek(fd, acpi20, SEEK_SET);
-        std::fread(hdr, 20, 1, fd);
-        std::fclose(fd);
+// The boot_params of the caller, else read now
+static boot_params needBootParams(const boot_params* bp)
+{
+    if (bp)
+        return *bp;
+    auto read = fetchBootParams();
+    if (read.has_value() == false)
+        throw std::runtime_error("/sys/kernel/boot_params/data: not available");
+    return *read;
+}
 
-        rsdt = *reinterpret_cast<uint32_t*>(hdr + 16);
-        //assert(rsdt);
-    } else {
-        /* try old boot time params */
-        struct boot_params bp;
+// Physical memory, unbuffered: only the bytes asked for are read
+static bool readPhys(uintptr_t addr, void* buf, size_t size)
+{
+    int fd = open("/dev/mem", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t n = pread(fd, buf, size, addr);
+    close(fd);
+    return n == ssize_t(size);
+}
 
-        std::filesystem::path bpd("/sys/kernel/boot_params/data");
-        std::ifstream file(bpd);
-        if (file.is_open() == false) {
-            throw std::runtime_error(std::format("{}: {}", bpd.string(), strerror(errno)));
-        }
+// ACPI 5.2.5.3, the checksum covers the first 20 bytes (ACPI 1.0 RSDP)
+static bool isRSDP(const unsigned char* p)
+{
+    if (std::memcmp(p, "RSD PTR ", 8) != 0)
+        return false;
+    uint8_t sum = 0;
+    for (int i = 0; i < 20; ++i)
+        sum += p[i];
+    return sum == 0;
+}
 
-        file.read(reinterpret_cast<char*>(&bp), sizeof(bp));
-        acpi20 = bp.acpi_rsdp_addr;
-        assert(acpi20);
+/*
+ * Advanced Configuration and Power Interface (ACPI) Specification
+ * 5.2.5.1 Finding the RSDP on IA-PC Systems
+ * 5.2.5.2 Finding the RSDP on UEFI Enabled Systems
+ *
+ * The RSDP comes from the EFI system table or boot_params, else from a
+ * scan of the BIOS area. The RSDT address is read from the RSDP through
+ * /dev/mem, it is 0 when that is locked down (the kernel finds it from
+ * the RSDP anyway).
+ */
+std::pair<uintptr_t,uintptr_t> beastie::fetchACPI20(bool efi, const boot_params* bp)
+{
+    uintptr_t acpi20 = 0;
+    uintptr_t rsdt = 0;
 
-        /* look up rsdt in /dev/mem */
-        unsigned char hdr[20];
-        std::FILE* fd = std::fopen("/dev/mem", "rb");
-        assert(fd);
-        std::fseek(fd, acpi20, SEEK_SET);
-        std::fread(hdr, 20, 1, fd);
-        std::fclose(fd);
+    if (efi) {
+        for (auto& line : slurpLines("/sys/firmware/efi/systab")) {
+            if (line.starts_with("ACPI20="))
+                acpi20 = std::stoull(line.substr(7), 0, 16);
+        }
+    } else {
+        acpi20 = needBootParams(bp).acpi_rsdp_addr;
+    }
 
-        rsdt = *reinterpret_cast<uint32_t*>(hdr + 16);
-        assert(rsdt);
+    if (acpi20 == 0 && efi == false) {
+        constexpr uintptr_t BIOS = 0xe'0000;
+        std::vector<unsigned char> area(0x2'0000);
+        if (readPhys(BIOS, area.data(), area.size())) {
+            for (size_t off = 0; off + 20 <= area.size(); off += 16) {
+                if (isRSDP(area.data() + off)) {
+                    acpi20 = BIOS + off;
+                    break;
+                }
+            }
+        }
+    }
+    if (acpi20 == 0)
+        throw std::runtime_error("ACPI RSDP not found");
+
+    unsigned char hdr[20];
+    if (readPhys(acpi20, hdr, sizeof(hdr)) && isRSDP(hdr)) {
+        uint32_t addr;
+        std::memcpy(&addr, hdr + 16, sizeof(addr));
+        rsdt = addr;
     }
     return {acpi20, rsdt};
 }
@@ -210,36 +381,24 @@ static void vmware_write(uint32_t iostart, uint32_t reg, uint32_t value)
     outl(value, iostart + 1);
 }
 
-fbinfo beastie::fetchFB()
+fbinfo beastie::fetchFB(const boot_params* bp)
 {
     std::filesystem::path fp("/dev/fb0");
-    std::ifstream file("/dev/fb0", std::ios::binary | std::ios::in);
-    if (file.is_open() == false) {
+    int fd = open(fp.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         throw std::runtime_error(std::format("{}: {}", fp.string(), strerror(errno)));
     }
 
     struct fb_fix_screeninfo fix;
     struct fb_var_screeninfo var;
 
-#if defined(__cpp_lib_fstream_native_handle)
-    int fd = file.native_handle();
-#else
-    struct Hack : std::basic_filebuf<char> {
-        Hack(std::basic_filebuf<char> rhs)
-            :std::basic_filebuf<char>(std::move(rhs))
-        {}
-        int fd() {
-            return this->_M_file.fd();
-        }
-    } hack = std::move(*file.rdbuf());
-    int fd = hack.fd();
-    *file.rdbuf() = std::move(hack);
-#endif
-
     if (-1 == ioctl(fd, FBIOGET_FSCREENINFO, &fix) ||
         -1 == ioctl(fd, FBIOGET_VSCREENINFO, &var)) {
-        throw std::runtime_error(std::format("{}: {}", fp.string(), strerror(errno)));
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(std::format("{}: {}", fp.string(), strerror(err)));
     }
+    close(fd);
 
     fbinfo fb0;
     std::string_view id(fix.id);
@@ -257,14 +416,7 @@ fbinfo beastie::fetchFB()
 
     } else {
         /* try old boot time video */
-        struct screen_info si;
-
-        std::filesystem::path path("/sys/kernel/boot_params/data");
-        std::ifstream file(path);
-        if (file.is_open() == false) {
-            throw std::runtime_error(std::format("{}: {}", path.string(), strerror(errno)));
-        }
-        file.read(reinterpret_cast<char*>(&si), sizeof(si));
+        struct screen_info si = needBootParams(bp).screen_info;
 
         fb0.id = id;
         fb0.phys = si.lfb_base + (static_cast<uint64_t>(si.ext_lfb_base) << 32);
@@ -280,41 +432,100 @@ fbinfo beastie::fetchFB()
     throw std::runtime_error("fb0 not found");
 }
 
-smapinfo beastie::fetchSMAP(bool debug)
+smapinfo beastie::buildSMAP(std::vector<smapentry> entries)
 {
-    /* try old boot time params */
-    struct boot_params bp;
+    std::erase_if(entries, [](auto& e) { return e.size == 0; });
+    std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+        return a.addr != b.addr ? a.addr < b.addr : a.type < b.type;
+    });
 
-    std::filesystem::path path("/sys/kernel/boot_params/data");
-    std::ifstream file(path);
-    if (file.is_open() == false) {
-        throw std::runtime_error(std::format("{}: {}", path.string(), strerror(errno)));
+    smapinfo si;
+    for (auto& e : entries) {
+        if (si.e820_table.empty() == false) {
+            auto& last = si.e820_table.back();
+            if (last.type == e.type && e.addr <= last.addr + last.size) {
+                uint64_t end = e.addr + e.size;
+                if (end > last.addr + last.size)
+                    last.size = end - last.addr;
+                continue;
+            }
+        }
+        si.e820_table.push_back(e);
     }
+    return si;
+}
 
-    file.seekg(0);
-    file.read(reinterpret_cast<char*>(&bp), sizeof(bp));
-    assert(bp.e820_entries);
-    file.close();
+// The e820 type of a /sys/firmware/memmap entry
+static uint32_t memmapType(std::string_view type)
+{
+    if (type == "System RAM")
+        return SMAP_TYPE_MEMORY;
+    if (type == "ACPI Tables")
+        return SMAP_TYPE_ACPI_RECLAIM;
+    if (type == "ACPI Non-volatile Storage")
+        return SMAP_TYPE_ACPI_NVS;
+    if (type == "Unusable memory")
+        return SMAP_TYPE_ACPI_ERROR;
+    if (type == "Persistent Memory")
+        return SMAP_TYPE_PMEM;
+    if (type == "Persistent Memory (legacy)")
+        return SMAP_TYPE_PRAM;
+    return SMAP_TYPE_RESERVED;
+}
 
-    smapinfo si;
-    std::memset(&si, 0, sizeof(si));
-    si.e820_entries = bp.e820_entries;
-    for (int i = 0; i < 128; ++i) {
-        si.e820_table[i].addr = bp.e820_table[i].addr;
-        si.e820_table[i].size = bp.e820_table[i].size;
-        si.e820_table[i].type = bp.e820_table[i].type;
-
-        if (debug && (si.e820_table[i].size > 0)) {
+/*
+ * /sys/firmware/memmap has every entry the firmware gave, the table in
+ * boot_params stops at 128. The latter is only used without the former
+ * (CONFIG_FIRMWARE_MEMMAP=n).
+ */
+smapinfo beastie::fetchSMAP(const boot_params* bp, bool debug)
+{
+    std::vector<smapentry> entries;
+
+    // three attributes per entry, all read in one go
+    std::filesystem::path memmap("/sys/firmware/memmap");
+    std::vector<std::filesystem::path> attrs;
+    std::error_code ec;
+    for (auto& dir : std::filesystem::directory_iterator(memmap, ec)) {
+        attrs.push_back(dir.path()/"start");
+        attrs.push_back(dir.path()/"end");
+        attrs.push_back(dir.path()/"type");
+    }
+
+    auto values = slurpMany(attrs);
+    for (size_t i = 0; i + 2 < values.size(); i += 3) {
+        if (values[i].has_value() == false || values[i + 1].has_value() == false ||
+            values[i + 2].has_value() == false)
+            continue;
+        uint64_t start = std::stoull(*values[i], 0, 0);
+        uint64_t end = std::stoull(*values[i + 1], 0, 0);
+        auto type = splitLines(*values[i + 2]);
+        if (end < start || type.empty())
+            continue;
+        entries.push_back({start, end - start + 1, memmapType(type[0])});
+    }
+
+    if (entries.empty()) {
+        /* try old boot time params */
+        auto params = needBootParams(bp);
+        if (params.e820_entries == 0)
+            throw std::runtime_error("no memory map");
+
+        for (int i = 0; i < params.e820_entries && i < E820_MAX_ENTRIES_ZEROPAGE; ++i)
+            entries.push_back({params.e820_table[i].addr, params.e820_table[i].size, params.e820_table[i].type});
+    }
+
+    auto si = buildSMAP(std::move(entries));
+    if (debug) {
+        for (auto& e : si.e820_table) {
             std::cout << std::format("SMAP  phys={:x} size={:x} type={:d}\n",
-                                     uint64_t(si.e820_table[i].addr),
-                                     uint64_t(si.e820_table[i].size),
-                                     uint32_t(si.e820_table[i].type));
+                                     uint64_t(e.addr), uint64_t(e.size), uint32_t(e.type));
         }
     }
     return (si);
 }
 
-efimapinfo beastie::fetchEFIMAP()
+efimapinfo beastie::fetchEFIMAP(const smapinfo& smap)
 {
 
     /*
@@ -322,24 +533,68 @@ efimapinfo beastie::fetchEFIMAP()
      * the efi/runtime-map, so take the descriptors from the e820 map
      **/
 
-    auto map = fetchSMAP(false);
-
     efimapinfo ei;
-    std::memset(&ei, 0, sizeof(ei));
-    ei.memory_size = map.e820_entries * sizeof(efimapentry);
-    ei.descriptor_size = sizeof(efimapentry);
-    ei.descriptor_version = 1;
-
-    for (int i = 0; i < 128; ++i) {
-        if (map.e820_table[i].type != SMAP_TYPE_MEMORY)
+    std::memset(&ei.header, 0, sizeof(ei.header));
+
+    for (auto& e : smap.e820_table) {
+        efimapentry d;
+        std::memset(&d, 0, sizeof(d));
+        switch (e.type) {
+        case SMAP_TYPE_MEMORY:       d.type = EFI_MD_TYPE_FREE; break;
+        case SMAP_TYPE_ACPI_RECLAIM: d.type = EFI_MD_TYPE_RECLAIM; break;
+        case SMAP_TYPE_ACPI_NVS:     d.type = EFI_MD_TYPE_FIRMWARE; break;
+        case SMAP_TYPE_PMEM:         d.type = EFI_MD_TYPE_PERSISTENT; break;
+        default:
             continue;
-
-        ei.efi_table[i].type = EFI_MD_TYPE_FREE;
-        ei.efi_table[i].phys = map.e820_table[i].addr;
-        ei.efi_table[i].virt = 0;
-        ei.efi_table[i].pages = map.e820_table[i].size / 4096;
-        ei.efi_table[i].attr = 0x0f;  // seems to be standard attr
+        }
+        d.phys = e.addr;
+        d.virt = 0;
+        d.pages = e.size / 4096;
+        d.attr = 0x0f;  // seems to be standard attr
+        ei.efi_table.push_back(d);
     }
 
+    ei.header.memory_size = ei.efi_table.size() * sizeof(efimapentry);
+    ei.header.descriptor_size = sizeof(efimapentry);
+    ei.header.descriptor_version = 1;
     return (ei);
 }
+
+bool beastie::hasGigPages()
+{
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x8000'0001, &eax, &ebx, &ecx, &edx) == 0)
+        return false;
+    return edx & (1u << 26);
+}
+
+/*
+ * Each source is read once: boot_params up front for all the probes
+ * that fall back on it, the rest don't depend on each other and the
+ * slow ones (the ioctls, /dev/mem) run on the load pipeline. The EFI
+ * memory map is derived from the SMAP, only for the hosts that need it.
+ */
+platforminfo beastie::fetchPlatform()
+{
+    platforminfo pi;
+    pi.efi = isEFI();
+    auto bp = fetchBootParams();
+    const boot_params* params = bp.has_value() ? &*bp : nullptr;
+
+    // the jobs get their own copy, they may outlive us when a probe throws
+    auto& pipeline = CLoadPipeline::instance();
+    auto fb = pipeline.async([bp]() {
+        return fetchFB(bp.has_value() ? &*bp : nullptr);
+    });
+    auto acpi = pipeline.async([efi = pi.efi, bp]() {
+        return fetchACPI20(efi, bp.has_value() ? &*bp : nullptr);
+    });
+
+    pi.smap = fetchSMAP(params);
+    if (pi.efi)
+        pi.efimap = fetchEFIMAP(pi.smap);
+    pi.gbpages = hasGigPages();
+    pi.fb = fb.get();
+    std::tie(pi.rsdp, pi.rsdt) = acpi.get();
+    return pi;
+}
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "types.hxx"
+#include "cmappedfile.hxx"
+#include "csha256.hxx"
 using namespace beastie;
 
 #include <cerrno>
 #include <cstring>
 
 #include <filesystem>
+#include <optional>
 #include <span>
 #include <string>
 #include <string_view>
@@ -25,9 +28,78 @@ std::vector<std::string> slurpLines(std::filesystem::path path);
 // Read a file (in its entirety) into an ull.
 unsigned long long slurpULL(std::filesystem::path path);
 
-// gzip version of slurp()
+// Read many small files (sysfs attributes) at once, nullopt for
+// those that can't be read
+std::vector<std::optional<std::string>> slurpMany(std::span<const std::filesystem::path> paths);
+
+// Split text into lines, without their newlines
+std::vector<std::string> splitLines(std::string_view text);
+
+// gzip/zstd/xz version of slurp()
 std::vector<char> zslurp(std::filesystem::path path);
 
+// Map a file, decompressing it into anonymous memory if needed. The
+// file as stored is fed to sha256 on the way, when given.
+CMappedFile zmap(std::filesystem::path path, CSha256* sha256 = nullptr);
+
+// A piece of a file, at its offset
+struct filepart {
+    uint64_t offset;
+    std::span<const char> data;
+};
+
+// Write the parts to fd, false (with errno) when that fails
+bool writeParts(int fd, std::span<const filepart> parts);
+
+// Replace path with the parts, or data: written to a temporary file,
+// synced and renamed over path, then the directory synced. After a
+// crash path is either the old file or the whole new one.
+void writeAtomic(std::filesystem::path path, std::span<const filepart> parts);
+void writeAtomic(std::filesystem::path path, std::span<const char> data);
+
+// Builds the header of a binary file, in host byte order: fixed size
+// values and blobs prefixed with their u32 length
+class CBinaryWriter
+{
+public:
+    void bytes(const void* p, size_t n);
+    void u32(uint32_t v);
+    void u64(uint64_t v);
+    void blob(std::span<const char> data);
+
+    const std::vector<char>& data() const {
+        return m_data;
+    }
+    size_t size() const {
+        return m_data.size();
+    }
+
+private:
+    std::vector<char> m_data;
+};
+
+// Reads what CBinaryWriter wrote, throws "<name>: truncated" when
+// something runs past the end of buffer
+class CBinaryReader
+{
+public:
+    CBinaryReader(std::span<char> buffer, std::string name);
+
+    std::span<char> bytes(size_t n);
+    uint32_t u32();
+    uint64_t u64();
+    std::vector<char> blob();
+    std::string string();
+
+private:
+    std::span<char> m_buffer;
+    std::string m_name;
+    size_t m_pos;
+};
+
+// 64-bit FNV-1a, chain calls by passing the previous result as seed
+uint64_t hash64(std::span<const char> data, uint64_t seed = 0xcbf2'9ce4'8422'2325ULL);
+
 // Debugging tool...
 void printBuffer(std::span<char>, std::string_view name);
 
@@ -51,16 +123,30 @@ void shutdown();
 // Forced shutdown of the system, kexec now
 void forcedshutdown();
 
-// Returns RSDP and RSDT
-std::pair<uintptr_t,uintptr_t> fetchACPI20(bool efi);
+// Returns the boot_params the kernel was started with, nullopt without them
+std::optional<boot_params> fetchBootParams();
+
+// The probes below fall back on bp, read when they need it and it is null
+
+// Returns RSDP and RSDT (0 when /dev/mem can't be read)
+std::pair<uintptr_t,uintptr_t> fetchACPI20(bool efi, const boot_params* bp = nullptr);
 
 // Returns framebuffer info
-fbinfo fetchFB();
+fbinfo fetchFB(const boot_params* bp = nullptr);
+
+// Returns system map info, from /sys/firmware/memmap when there is one
+smapinfo fetchSMAP(const boot_params* bp = nullptr, bool debug = false);
+
+// Sort entries and coalesce the touching ones of a type
+smapinfo buildSMAP(std::vector<smapentry> entries);
+
+// Returns system map info, as EFI descriptors
+efimapinfo fetchEFIMAP(const smapinfo& smap);
 
-// Returns system map info
-smapinfo fetchSMAP(bool debug = true);
+// Returns 1 GiB page support (pdpe1gb)
+bool hasGigPages();
 
-// Returns system map info
-efimapinfo fetchEFIMAP();
+// Returns everything above, each source read once
+platforminfo fetchPlatform();
 
 } // namespace beastie
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #include <asm/bootparam.h>
 
@@ -39,9 +41,61 @@ struct smapentry {
     uint32_t type;
 } __attribute__((packed));
 
+// The memory map, sorted, touching entries of a type coalesced
 struct smapinfo {
-    smapentry e820_table[128];
-    uint8_t e820_entries;
+    std::vector<smapentry> e820_table;
+};
+
+struct loadsegment {
+    const char* buf;    // source bytes (may point into a mapped file)
+    size_t    bufsz;    // bytes taken from buf, kexec zero-fills the rest
+    uintptr_t phys;     // physical destination, page aligned
+    size_t    memsz;    // size in memory, page aligned
+};
+
+// MODULE_DEPEND() of a kernel module
+struct moddepend {
+    std::string name;
+    int minimum;
+    int preferred;
+    int maximum;
+};
+
+// MODULE_VERSION() of a kernel module
+struct modversion {
+    std::string name;
+    int version;
+};
+
+// Preload metadata of a kernel module or other preloaded file, as
+// written for the kernel. Only ELF modules have headers.
+struct modrecord {
+    std::string name;
+    std::string type;
+    uintptr_t addr;
+    size_t size;
+    std::vector<char> ehdr;
+    std::vector<char> shdr;
+};
+
+// Identity of a file on disk, used to validate cached data
+struct fileid {
+    std::string path;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t ctime;
+
+    bool operator==(const fileid&) const = default;
+};
+
+// SHA-256 of a file checked against the manifest, path on disk and the
+// name the kernel knows it by
+struct filedigest {
+    std::string path;
+    std::string name;
+    std::array<uint8_t, 32> sha256;
 };
 
 struct efimapentry {
@@ -53,15 +107,20 @@ struct efimapentry {
     uint64_t attr;
 } __attribute__((packed));
 
-struct efimapinfo {
+// struct efi_map_header, padded to 16 bytes like the descriptors after it
+struct efimapheader {
     uint64_t memory_size;
     uint64_t descriptor_size;
     uint32_t descriptor_version;
     uint32_t pad1;
     uint64_t pad2;
-    efimapentry efi_table[128];
 } __attribute__((packed));
 
+struct efimapinfo {
+    efimapheader header;
+    std::vector<efimapentry> efi_table;
+};
+
 struct efifbinfo {
     uint64_t addr;
     uint64_t size;
@@ -106,4 +165,15 @@ struct vfnt_map {
 } __attribute__((packed));
 typedef struct vfnt_map vfnt_map_t;
 
+// What the bootloader needs to know about the running host
+struct platforminfo {
+    bool        efi;
+    fbinfo      fb;
+    smapinfo    smap;
+    efimapinfo  efimap;
+    uintptr_t   rsdp;
+    uintptr_t   rsdt;
+    bool        gbpages;
+};
+
 } // namespace beastie